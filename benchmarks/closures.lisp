@@ -0,0 +1,32 @@
+; Closure benchmark - 30000 rounds of messages to an object in the style of
+; uos:window, with the constructor interpreted, compiled, and compiled
+; along with its caller, for the flat closures of user-012.
+
+(defun window-object (x y w h &optional title)
+  (let* ((set-pos_ (lambda (x_ y_) (setf x x_ y y_)))
+         (set-size_ (lambda (w_ h_) (setf w w_ h h_))))
+    (lambda (&rest msgs)
+      (case (car msgs)
+        (x x) (y y) (w w) (h h)
+        (title (if (cadr msgs) (setf title (cadr msgs)) title))
+        (in-x (+ x 2))
+        (in-y (if title (+ y 5) (+ y 2)))
+        (set-pos (apply set-pos_ (cdr msgs)))
+        (set-size (apply set-size_ (cdr msgs)))))))
+
+(defun send-loop (win n)
+  (let ((s 0))
+    (dotimes (i n) (win 'set-pos i i) (setq s (+ s (win 'in-x) (win 'in-y) (win 'h))))
+    s))
+
+(defun run-loop ()
+  (let ((start (millis)))
+    (unless (= (send-loop (window-object 1 2 3 4 "t") 30000) 900300000)
+      (error "send-loop returned the wrong result"))
+    (print (list 'send-loop (- (millis) start)))))
+
+(run-loop)
+(compile 'window-object)
+(run-loop)
+(compile 'send-loop)
+(run-loop)
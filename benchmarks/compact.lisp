@@ -0,0 +1,20 @@
+; Compaction benchmark - builds about 95000 live cells of strings, lists and
+; symbols and times save-image, which compacts the workspace before it
+; writes it, for user-006. Then it checks every item survived load-image.
+
+(defvar *keep* nil)
+
+(dotimes (i 11000)
+  (push (list (format nil "item-~a" i) i 'anotherlongsymbol) *keep*))
+
+(time (save-image))
+(load-image)
+
+(let ((i 11000))
+  (dolist (item *keep*)
+    (decf i)
+    (unless (and (string= (first item) (format nil "item-~a" i))
+                 (= (second item) i)
+                 (eq (third item) 'anotherlongsymbol))
+      (error "item ~a is wrong after load-image" i)))
+  (unless (zerop i) (error "~a items are missing after load-image" i)))
@@ -0,0 +1,31 @@
+; Compiler benchmark - fib, tak and a string building loop, interpreted
+; and then compiled, for user-011. Each run checks its result.
+
+(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+
+(defun tak (x y z)
+  (if (not (< y x)) z
+      (tak (tak (1- x) y z) (tak (1- y) z x) (tak (1- z) x y))))
+
+(defun build (n)
+  (let ((s ""))
+    (dotimes (i n) (setq s (concatenate 'string s (princ-to-string (mod i 10)))))
+    (length s)))
+
+(defun run-all ()
+  (let (start)
+    (setq start (millis))
+    (unless (= (fib 23) 28657) (error "fib returned the wrong result"))
+    (print (list 'fib (- (millis) start)))
+    (setq start (millis))
+    (unless (= (tak 18 12 6) 7) (error "tak returned the wrong result"))
+    (print (list 'tak (- (millis) start)))
+    (setq start (millis))
+    (unless (= (build 2000) 2000) (error "build returned the wrong result"))
+    (print (list 'build (- (millis) start)))))
+
+(run-all)
+(compile 'fib)
+(compile 'tak)
+(compile 'build)
+(run-all)
@@ -0,0 +1,29 @@
+; Event queue check - for user-021. A posted key comes back from
+; next-event with its code and no delay, a posted touch comes back with
+; its position, 40 posts into the empty 32-slot ring keep 31 and drop 9,
+; and next-event with a timeout returns nil after waiting that long.
+
+(keyboard-flush)
+
+(post-event 66)
+(let ((e (next-event 100)))
+  (unless (and (eq (first e) 'key) (= (second e) 66)) (error "next-event returned ~a for key 66" e))
+  (print (list 'latency (- (millis) (third e))))
+  (when (> (- (millis) (third e)) 5) (error "the key event took too long to arrive")))
+
+(post-event 10 20)
+(let ((e (next-event 100)))
+  (unless (and (eq (first e) 'touch) (= (second e) 10) (= (third e) 20))
+    (error "next-event returned ~a for a touch at 10, 20" e)))
+
+(let ((kept 0))
+  (dotimes (i 40) (when (post-event (+ i 32)) (incf kept)))
+  (unless (= kept 31) (error "the queue kept ~a of 40 events, not 31" kept))
+  (dotimes (i 31)
+    (unless (= (second (next-event 0)) (+ i 32)) (error "event ~a came back out of order" i)))
+  (when (next-event 0) (error "the queue returned more events than it kept")))
+
+(let ((start (millis)) (e (next-event 50)))
+  (when e (error "next-event returned ~a from an empty queue" e))
+  (print (list 'timeout (- (millis) start)))
+  (when (< (- (millis) start) 50) (error "next-event returned before its timeout")))
@@ -0,0 +1,49 @@
+; File view benchmark - writes a 1.7 MB log of 20000 lines, 55000 rows at
+; 38 columns, to the SD card, checks every 97th row against the lines read
+; with read-line, and times opening a view and reading a page and 200
+; jumps of 20 rows, for user-024. The old viewer read the whole file with
+; read-file before drawing, which took over ten minutes on the host, so
+; it isn't timed here.
+
+(defvar *width* 38)
+
+(with-sd-card (s "big.log" 2)
+  (dotimes (i 20000)
+    (princ "L" s) (princ i s) (princ ":" s)
+    (dotimes (j (mod (* i 7919) 16)) (princ "abcdefghij" s))
+    (dotimes (j (mod i 9)) (princ (code-char (+ 97 j)) s))
+    (terpri s)))
+
+(defun check-rows (view)
+  (let ((row 0))
+    (with-sd-card (s "big.log")
+      (loop
+       (let ((line (read-line s)) (start 0))
+         (unless line (return row))
+         (loop
+          (when (zerop (mod row 97))
+            (unless (equal (view-lines view row)
+                           (list (subseq line start (min (length line) (+ start *width*)))))
+              (error "row ~a doesn't match the file" row)))
+          (incf row)
+          (incf start *width*)
+          (when (>= start (length line)) (return))))))))
+
+(defvar *view* (view-open "big.log" *width*))
+(defvar *rows* (check-rows *view*))
+(unless (= (view-length *view*) *rows*) (error "view-length is ~a, not ~a" (view-length *view*) *rows*))
+(view-close *view*)
+
+(let ((start (millis)))
+  (setq *view* (view-open "big.log" *width*))
+  (unless (= (length (view-lines *view* 0 12)) 12) (error "the first page is short"))
+  (print (list 'open (- (millis) start))))
+
+(let ((start (millis)))
+  (dotimes (i 200)
+    (let ((row (mod (* i 7919) *rows*)))
+      (unless (= (length (view-lines *view* row 20)) (min 20 (- *rows* row)))
+        (error "reading 20 rows from ~a returned the wrong number" row))))
+  (print (list 'jumps (- (millis) start))))
+
+(view-close *view*)
@@ -0,0 +1,16 @@
+; Hash table benchmark - 2000 lookups among 500 integer keys, through an
+; association list and through a hash table, for user-015.
+
+(defvar *alist* nil)
+(dotimes (i 500) (push (cons i (* i 3)) *alist*))
+
+(defvar *table* (make-hash-table))
+(dotimes (i 500) (setf (gethash i *table*) (* i 3)))
+
+(defvar *sum* 0)
+(time (dotimes (k 4) (dotimes (i 500) (incf *sum* (cdr (assoc i *alist*))))))
+(unless (= *sum* 1497000) (error "assoc returned the wrong values"))
+(setq *sum* 0)
+(time (dotimes (k 4) (dotimes (i 500) (incf *sum* (gethash i *table*)))))
+(unless (= *sum* 1497000) (error "gethash returned the wrong values"))
+(when (gethash 500 *table*) (error "gethash found a key that isn't there"))
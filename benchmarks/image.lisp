@@ -0,0 +1,16 @@
+; Image benchmark - times save-image and load-image of an image of about 150 KB, the
+; Lisp Library plus strings, arrays and a closure, for user-007. Then it
+; checks they came back intact.
+
+(defvar *strings* nil)
+(dotimes (i 1800) (push (format nil "string ~a" i) *strings*))
+(defvar *array* (make-array '(20 30) :initial-element 0))
+(dotimes (i 20) (dotimes (j 30) (setf (aref *array* i j) (* i j))))
+(defvar *counter* (let ((n 0)) (lambda () (incf n))))
+
+(time (save-image))
+(time (load-image))
+
+(unless (string= (nth 10 *strings*) "string 1789") (error "strings are wrong after load-image"))
+(unless (= (aref *array* 19 29) 551) (error "array is wrong after load-image"))
+(unless (and (= (funcall *counter*) 1) (= (funcall *counter*) 2)) (error "closure is wrong after load-image"))
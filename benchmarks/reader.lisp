@@ -0,0 +1,15 @@
+; Reader benchmark - reads a 20-token defun 20000 times, which is mostly
+; builtin name lookups. Paste it into the REPL or load it from the SD card.
+
+(defvar *reader-source*
+  "(defun foo (x) (let ((y (car x))) (if (numberp y) (+ y 1) (string-upcase (cdr x)))))")
+
+(defun reader-bench (n)
+  (let ((start (millis)))
+    (dotimes (i n)
+      (unless (eq (first (read-from-string *reader-source*)) 'defun)
+        (error "read-from-string returned the wrong form")))
+    (let ((ms (max 1 (- (millis) start))))
+      (list 'reads n 'ms ms 'tokens/s (truncate (* n 20000) ms)))))
+
+(print (reader-bench 20000))
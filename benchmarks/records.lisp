@@ -0,0 +1,28 @@
+; Record benchmark - 20000 reads of a window's height, through a closure
+; answering messages as the uos windows did and through a defstruct
+; accessor, interpreted and then compiled, for user-016.
+
+(defun closure-window (x y w h &optional title)
+  (lambda (&rest msgs)
+    (case (car msgs) (x x) (y y) (w w) (h h) (title title) (in-x (+ x 2)))))
+
+(defstruct bench-window x y w h title)
+
+(defvar *closure* (closure-window 1 2 3 4 "t"))
+(defvar *record* (make-bench-window :x 1 :y 2 :w 3 :h 4 :title "t"))
+
+(defun read-closure (n) (let ((s 0)) (dotimes (i n) (setq s (+ s (*closure* 'h)))) s))
+(defun read-record (n) (let ((s 0)) (dotimes (i n) (setq s (+ s (bench-window-h *record*)))) s))
+
+(defun run-all ()
+  (let ((start (millis)))
+    (unless (= (read-closure 20000) 80000) (error "the closure returned the wrong height"))
+    (print (list 'closure (- (millis) start)))
+    (setq start (millis))
+    (unless (= (read-record 20000) 80000) (error "the accessor returned the wrong height"))
+    (print (list 'record (- (millis) start)))))
+
+(run-all)
+(compile 'read-closure)
+(compile 'read-record)
+(run-all)
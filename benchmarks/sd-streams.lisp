@@ -0,0 +1,40 @@
+; SD card stream benchmark - writes 1400 lines, about 99 KB, with princ and
+; terpri, reads them back with read-line and read-byte, and copies the file
+; with read-sequence and write-sequence, for user-022. Each pass checks
+; what it read.
+
+(defvar *line* "(defun foo (x y) (+ x y (* 2 x))) ; a typical line of source code here")
+
+(let ((start (millis)))
+  (with-sd-card (s "big.lisp" 2)
+    (dotimes (i 1400) (princ *line* s) (terpri s)))
+  (print (list 'write (- (millis) start))))
+
+(let ((start (millis)) (n 0))
+  (with-sd-card (s "big.lisp")
+    (loop
+     (let ((l (read-line s)))
+       (unless l (return))
+       (unless (string= l *line*) (error "line ~a reads back as ~a" n l))
+       (incf n))))
+  (print (list 'read-line (- (millis) start)))
+  (unless (= n 1400) (error "read-line read ~a lines, not 1400" n)))
+
+(let ((start (millis)) (n 0))
+  (with-sd-card (s "big.lisp")
+    (loop (unless (read-byte s) (return)) (incf n)))
+  (print (list 'read-byte (- (millis) start)))
+  (unless (= n 99400) (error "read-byte read ~a bytes, not 99400" n)))
+
+(defvar *bytes* (make-array 100000 :element-type '(unsigned-byte 8)))
+
+(let ((start (millis)) (n 0))
+  (with-sd-card (s "big.lisp") (setq n (read-sequence *bytes* s)))
+  (with-sd-card (s "copy.lisp" 2) (write-sequence *bytes* s 0 n))
+  (print (list 'sequence-copy (- (millis) start)))
+  (unless (= n 99400) (error "read-sequence read ~a bytes, not 99400" n)))
+
+(with-sd-card (s "copy.lisp")
+  (dotimes (i 1400)
+    (unless (string= (read-line s) *line*) (error "line ~a of the copy is wrong" i)))
+  (when (read-line s) (error "the copy is too long")))
@@ -0,0 +1,11 @@
+; Search benchmark - search, search-str and searchn over a 25560-character
+; text, 20 times each, for user-010.
+
+(defvar *numbers* (format nil "~{~a ~}" (let (l) (dotimes (i 1500) (push i l)) l)))
+(defvar *text* (concatenate 'string *numbers* *numbers* *numbers* *numbers*))
+
+(unless (= (length *text*) 25560) (error "the text is the wrong length"))
+(time (dotimes (k 20) (when (search "0 1 2" *text*) (error "search found a match that isn't there"))))
+(time (dotimes (k 20) (unless (equal (search-str "1 0" *text*) 6386) (error "search-str returned the wrong index"))))
+(time (dotimes (k 20) (when (search-str "~" *text*) (error "search-str found a match that isn't there"))))
+(time (dotimes (k 20) (unless (equal (searchn "99" *text* 30) 8890) (error "searchn returned the wrong index"))))
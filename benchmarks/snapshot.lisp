@@ -0,0 +1,8 @@
+; Snapshot benchmark - times load-image of an image holding just the Lisp
+; Library, which is what restoring the boot snapshot does, for user-008.
+; Run it from a fresh start. Then it checks the library still works.
+
+(save-image)
+(time (load-image))
+
+(unless (= (window-in-x (uos:window 10 20 100 50 "T")) 12) (error "library is wrong after load-image"))
@@ -0,0 +1,26 @@
+; Sort benchmark - 4000 random integers sorted with a builtin predicate
+; and with a lambda, for user-018. Each result is checked to be in order,
+; and equal keys are checked to keep their order.
+
+(defvar *numbers* (let (l) (dotimes (i 4000) (push (random 10000) l)) l))
+(defvar *sorted* nil)
+
+(defun check-sorted (list)
+  (unless (= (length list) 4000) (error "sort lost elements"))
+  (loop
+   (when (null (cdr list)) (return))
+   (when (< (second list) (first list)) (error "sort left elements out of order"))
+   (setq list (cdr list))))
+
+(time (length (setq *sorted* (sort (copy-list *numbers*) #'<))))
+(check-sorted *sorted*)
+(time (length (setq *sorted* (sort (copy-list *numbers*) (lambda (a b) (< a b))))))
+(check-sorted *sorted*)
+
+(defvar *pairs* (let (l) (dotimes (i 4000) (push (cons (random 100) i) l)) l))
+(let ((list (sort (copy-list *pairs*) (lambda (a b) (< (car a) (car b))))))
+  (loop
+   (when (null (cdr list)) (return))
+   (when (and (= (car (first list)) (car (second list))) (< (cdr (first list)) (cdr (second list))))
+     (error "sort reordered equal elements"))
+   (setq list (cdr list))))
@@ -0,0 +1,23 @@
+; String benchmark - a char loop, subseq and read-from-string on a
+; 75600-character string, for user-009.
+
+(defvar *long*
+  (with-output-to-string (s)
+    (princ "(" s)
+    (dotimes (i 15119) (princ "word " s))
+    (princ "end)" s)))
+
+(defun count-o (s)
+  (let ((n 0))
+    (dotimes (i (length s) n)
+      (when (eq (char s i) #\o) (incf n)))))
+
+(unless (= (length *long*) 75600) (error "the string is the wrong length"))
+(defvar *result* nil)
+
+(time (setq *result* (count-o *long*)))
+(unless (= *result* 15119) (error "char returned the wrong characters"))
+(time (setq *result* (subseq *long* 10000 70000)))
+(unless (and (= (length *result*) 60000) (string= (subseq *result* 59995) " word")) (error "subseq returned the wrong characters"))
+(time (setq *result* (read-from-string *long*)))
+(unless (eq (nth 15119 *result*) 'end) (error "read-from-string returned the wrong list"))
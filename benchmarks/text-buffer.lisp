@@ -0,0 +1,79 @@
+; Text buffer benchmark - 100 keys, 50 deletes and 20 enters near the end
+; of a 20000-line document, in the editor's old list-of-strings display
+; and in the library's uos:texteditdisplay on a text buffer, for user-025.
+; Both have to end up with the same document.
+
+(defvar *win* (uos:window 0 0 320 240 "T"))
+
+(defun old-move-window ()
+  (when (> txtpos-x (+ scroll-x (1- (tmax-x win))))
+    (setf scroll-x (- txtpos-x (1- (tmax-x win)))))
+  (when (> txtpos-y (+ scroll-y (1- (tmax-y win))))
+    (setf scroll-y (- txtpos-y (1- (tmax-y win)))))
+  (when (< txtpos-x scroll-x)
+    (setf scroll-x txtpos-x))
+  (when (< txtpos-y scroll-y)
+    (setf scroll-y txtpos-y)))
+
+(defun old-set-to-eol ()
+  (let ((len (length (nth txtpos-y lines))))
+    (when (> txtpos-x len) (setf txtpos-x len))))
+
+(defun old-texteditdisplay (lines win)
+  (let* ((scroll-x 0) (scroll-y 0)
+         (txtpos-x 0) (txtpos-y 0)
+         (len (length lines)))
+    (lambda (&rest msgs)
+      (case (car msgs)
+        (lines lines)
+        (up (when (> txtpos-y 0) (decf txtpos-y) (old-set-to-eol) (old-move-window)))
+        (down (when (< txtpos-y (1- len)) (incf txtpos-y) (old-set-to-eol) (old-move-window)))
+        (enter (let* ((line (nth txtpos-y lines))
+                      (firstlines (subseq lines 0 txtpos-y))
+                      (lastlines (subseq lines (1+ txtpos-y))))
+                 (setf lines (append firstlines (list (subseq line 0 txtpos-x) (subseq line txtpos-x)) lastlines)))
+               (setf len (length lines))
+               (setf txtpos-x 0) (incf txtpos-y)
+               (old-move-window))
+        (del (let* ((line (nth txtpos-y lines)))
+               (if (> txtpos-x 0)
+                   (progn (setf (nth txtpos-y lines)
+                                (concatenate 'string (subseq line 0 (1- txtpos-x)) (subseq line txtpos-x)))
+                          (decf txtpos-x))
+                   (when (> txtpos-y 0)
+                     (setf lines (remove-nth txtpos-y lines))
+                     (decf txtpos-y)
+                     (let ((prevline (nth txtpos-y lines)))
+                       (setf (nth txtpos-y lines) (concatenate 'string prevline line))
+                       (setf txtpos-x (length prevline)))
+                     (setf len (length lines)))))
+             (old-move-window))
+        (t (let* ((line (nth txtpos-y lines)))
+             (setf (nth txtpos-y lines)
+                   (concatenate 'string (subseq line 0 txtpos-x) (string (car msgs)) (subseq line txtpos-x)))
+             (incf txtpos-x))
+           (old-move-window))))))
+
+(defun document ()
+  (let (lines)
+    (dotimes (i 20000) (push "some line of text in the document" lines))
+    lines))
+
+(defun edit (display)
+  (dotimes (i 18000) (funcall display 'down))
+  (let ((start (millis)))
+    (dotimes (i 100) (funcall display #\x))
+    (dotimes (i 50) (funcall display 'del))
+    (dotimes (i 20) (funcall display 'enter))
+    (- (millis) start)))
+
+(defvar *old* (old-texteditdisplay (document) *win*))
+(print (list 'old (edit *old*)))
+
+(defvar *buffer* (text-open (document)))
+(print (list 'new (edit (uos:texteditdisplay *buffer* *win*))))
+
+(unless (equal (*old* 'lines) (text-lines *buffer* 0 (text-length *buffer*)))
+  (error "the text buffer and the old editor disagree about the document"))
+(unless (= (text-length *buffer*) 20020) (error "the document has the wrong number of lines"))
+(text-close *buffer*)
@@ -0,0 +1,57 @@
+; Text drawing benchmark - 440 lines of 51 characters drawn with the
+; library's disp-line-hilite, which uses draw-text-run, and with the old
+; version, which set the cursor and colour and printed one character at a
+; time, for user-020. On the host the display is a stub, so this is the
+; interpreter time only. Then both versions draw into the framebuffer and
+; the two screens are checked to be the same.
+
+(defun old-disp-line-hilite (win line y)
+  (let* ((ypos (+ (window-in-y win) (* y leading)))
+         (myl (if line (concatenate 'string line " ") " "))
+         (len (min (length myl) (+ (tmax-x win) 1))))
+    (set-cursor (window-in-x win) ypos)
+    (set-text-color code_col bg_col)
+    (dotimes (i len)
+      (let ((c (char myl i)))
+        (cond ((eq c #\STX) (set-text-color code_col cursor_col))
+              ((eq c #\ETX) (set-text-color code_col bg_col))
+              ((logbitp 7 (char-code c)) (set-text-color code_col cursor_col)
+                                         (write-text " ") (set-text-color code_col bg_col))
+              (t (write-text c)))))))
+
+(defvar write-text nil)
+(defvar *win* (uos:window 0 0 320 240 "T"))
+(defvar *line*
+  (format nil "(defun foo (x) ~a(+ x 1)~a) ; some comment text that runs past the edge of the window ok"
+          (code-char 2) (code-char 3)))
+
+(defun draw-lines (fn times)
+  (with-gfx (scr)
+    (setq write-text (lambda (s) (princ s scr)))
+    (let ((start (millis)))
+      (dotimes (k times) (dotimes (i 22) (funcall fn *win* *line* i)))
+      (- (millis) start))))
+
+(print (list 'old (draw-lines old-disp-line-hilite 20)))
+(print (list 'new (draw-lines disp-line-hilite 20)))
+
+(defun read-screen (filename)
+  (let ((bytes (make-array 230415 :element-type '(unsigned-byte 8))))
+    (with-sd-card (s filename) (read-sequence bytes s))
+    bytes))
+
+(defun same-bytes (a b)
+  (dotimes (i (length a) t)
+    (unless (= (aref a i) (aref b i)) (return nil))))
+(compile 'same-bytes)
+
+(gfx-framebuffer t)
+(fill-screen)
+(draw-lines old-disp-line-hilite 1)
+(gfx-save-ppm "old.ppm")
+(fill-screen)
+(draw-lines disp-line-hilite 1)
+(gfx-save-ppm "new.ppm")
+(gfx-framebuffer nil)
+(unless (same-bytes (read-screen "old.ppm") (read-screen "new.ppm"))
+  (error "draw-text-run drew a different screen from the old disp-line-hilite"))
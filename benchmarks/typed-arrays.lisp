@@ -0,0 +1,28 @@
+; Typed array benchmark - storage for 2000 elements and compiled loops
+; over a general array and an unsigned-byte 8 array, for user-017.
+
+(defvar *before* (room))
+(defvar *general* (make-array 2000 :initial-element 0))
+(defvar *middle* (room))
+(defvar *bytes* (make-array 2000 :element-type '(unsigned-byte 8)))
+(print (list 'general-cells (- *before* *middle*) 'byte-cells (- *middle* (room))))
+
+(defun write-general (n) (dotimes (i n) (setf (aref *general* i) (logand i 255))))
+(defun write-bytes (n) (dotimes (i n) (setf (aref *bytes* i) (logand i 255))))
+(defun read-general (n) (let ((s 0)) (dotimes (i n) (setq s (+ s (aref *general* i)))) s))
+(defun read-bytes (n) (let ((s 0)) (dotimes (i n) (setq s (+ s (aref *bytes* i)))) s))
+(compile 'write-general)
+(compile 'write-bytes)
+(compile 'read-general)
+(compile 'read-bytes)
+
+(time (dotimes (k 10) (write-general 2000)))
+(time (dotimes (k 10) (write-bytes 2000)))
+(time (dotimes (k 10) (read-general 2000)))
+(time (dotimes (k 10) (read-bytes 2000)))
+(unless (= (read-general 2000) 250008) (error "the general array holds the wrong values"))
+(unless (= (read-bytes 2000) 250008) (error "the byte array holds the wrong values"))
+(unless (= (array-sum *bytes*) 250008) (error "array-sum returned the wrong total"))
+(time (dotimes (k 10) (array-sum *bytes*)))
+(time (dotimes (k 10) (fill *bytes* 7)))
+(unless (= (array-sum *bytes*) 14000) (error "fill stored the wrong values"))
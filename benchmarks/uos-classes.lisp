@@ -0,0 +1,20 @@
+; uos class benchmark - messages sent to a uos:menu and to a
+; uos:texteditdisplay, which LispLibrary.h compiles at startup. To compare
+; with the interpreted classes, evaluate their defuns from LispLibrary.h
+; again before running this. The user-012 review fix quotes these figures.
+
+(defvar *win* (uos:window 0 0 200 100 "W"))
+
+(defvar *menu*
+  (uos:menu (list (cons "a" 1) (cons "b" 2) (cons "c" 3) (cons "d" 4) (cons "e" 5)
+                  (cons "f" 6) (cons "g" 7) (cons "h" 8) (cons "i" 9) (cons "j" 10))
+            *win*))
+
+(defvar *buffer* (text-open (list "first line" "second" "third line")))
+(defvar *edit* (uos:texteditdisplay *buffer* *win*))
+
+(time (dotimes (i 5000) (*menu* 'down) (*menu* 'up) (*menu* 'select-car)))
+(unless (equal (*menu* 'select-car) "a") (error "the menu selection moved"))
+(time (dotimes (i 2000) (*edit* #\A) (*edit* 'left) (*edit* 'right)))
+(unless (= (length (first (text-lines *buffer* 0 1))) 2010) (error "the editor lost characters"))
+(text-close *buffer*)
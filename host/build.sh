@@ -0,0 +1,37 @@
+#!/bin/bash
+# Builds the sketch as a freestanding i386 Linux program, host/build/ulisp, for testing and benchmarks.
+# Extra arguments go to g++, for example -DBOARD_HAS_PSRAM for the PSRAM workspace size, or
+# -fno-omit-frame-pointer so a fault reports its callers. Needs g++ with 32-bit support.
+set -e
+HOST=$(cd "$(dirname "$0")" && pwd)
+SKETCH=$(cd "$HOST/../ulisp-tdeck" && pwd)
+mkdir -p "$HOST/build"
+cd "$HOST/build"
+# Concatenate the .ino files and add prototypes, as the Arduino IDE does
+python3 - "$SKETCH" <<'PY'
+import os, re, sys
+d = sys.argv[1]
+src = open(os.path.join(d, 'ulisp-tdeck.ino')).read()
+for f in sorted(f for f in os.listdir(d) if f.endswith('.ino') and f != 'ulisp-tdeck.ino'):
+  src += '\n' + open(os.path.join(d, f)).read()
+# Input comes from stdin, so don't wait for a keypress to skip autorun
+src = src.replace("if (Serial.available() && Serial.read() == '~')", "if (false)")
+src = src.replace("delay(100); while (Serial.available()) Serial.read();", "delay(100);")
+pat = re.compile(r'^((?:[A-Za-z_]\w*[ \t\*]+)+?)([A-Za-z_]\w*)[ \t]*\(([^;{}()]*)\)[ \t]*\{', re.M)
+kw = {'if', 'while', 'for', 'switch', 'return', 'else', 'do'}
+protos = []
+for m in pat.finditer(src):
+  t, n, p = m.group(1), m.group(2), m.group(3)
+  if t.strip() in kw or n in kw: continue
+  protos.append(f"{t.strip()} {n}({p});")
+lines = src.split('\n')
+first = None
+for i, l in enumerate(lines):
+  if pat.match(l + '\n' + (lines[i+1] if i+1 < len(lines) else '')) and not l.startswith(('if', 'while')):
+    first = i; break
+lines.insert(first, '\n'.join(protos) + '\n#line %d' % (first+1))
+open('sketch.cpp', 'w').write('#line 1 "ulisp-tdeck.ino"\n' + '\n'.join(lines))
+PY
+g++ -m32 -O1 -g -ffreestanding -nostdinc -nostdlib -static -fno-pic -no-pie -fno-exceptions -fno-rtti \
+  -fno-stack-protector -fpermissive -Wall -I"$HOST/inc" -I"$SKETCH" -include "$HOST/host.h" "$@" \
+  "$HOST/host.cpp" sketch.cpp -o ulisp
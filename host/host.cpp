@@ -0,0 +1,286 @@
+// Runtime for the host build: raw Linux syscalls, a bump allocator, serial from stdin, and the SD card as a directory
+#include "host.h"
+
+extern "C" int sysc(int n, int a, int b, int c, int d) {
+  int r;
+  __asm__ volatile("push %%ebx; mov %2, %%ebx; int $0x80; pop %%ebx"
+    : "=a"(r) : "a"(n), "r"(a), "c"(b), "d"(c), "S"(d) : "memory");
+  return r;
+}
+extern "C" void host_exit(int c) { sysc(1, c); for (;;); }
+
+// memory
+static char Heap[96*1024*1024] __attribute__((aligned(16)));
+static size_t HeapTop = 0;
+extern "C" void *malloc(size_t n) {
+  n = (n + 15) & ~15u;
+  if (HeapTop + n + 16 > sizeof(Heap)) return NULL;
+  char *p = Heap + HeapTop + 16;
+  *(size_t *)(p - 16) = n;
+  HeapTop += n + 16;
+  return p;
+}
+extern "C" void free(void *) { }
+extern "C" void *realloc(void *p, size_t n) {
+  void *q = malloc(n); if (!q) return q;
+  if (p) { size_t o = *(size_t *)((char *)p - 16); memcpy(q, p, o < n ? o : n); }
+  return q;
+}
+extern "C" void *calloc(size_t a, size_t b) { void *p = malloc(a*b); if (p) memset(p, 0, a*b); return p; }
+void *operator new(size_t n) { return malloc(n); }
+void *operator new[](size_t n) { return malloc(n); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+extern "C" void __cxa_pure_virtual() { host_exit(99); }
+extern "C" int __cxa_atexit(void (*)(void *), void *, void *) { return 0; }
+void *__dso_handle;
+extern "C" int __cxa_guard_acquire(long long *g) { return !*(char *)g; }
+extern "C" void __cxa_guard_release(long long *g) { *(char *)g = 1; }
+extern "C" void __cxa_guard_abort(long long *) { }
+
+// strings
+extern "C" size_t strlen(const char *s) { size_t n = 0; while (s[n]) n++; return n; }
+extern "C" int strcmp(const char *a, const char *b) { while (*a && *a == *b) { a++; b++; } return (uint8_t)*a - (uint8_t)*b; }
+extern "C" int strncmp(const char *a, const char *b, size_t n) { for (; n; n--, a++, b++) { if (*a != *b || !*a) return (uint8_t)*a - (uint8_t)*b; } return 0; }
+static int lc(int c) { return (c >= 'A' && c <= 'Z') ? c + 32 : c; }
+extern "C" int strcasecmp(const char *a, const char *b) { while (*a && lc(*a) == lc(*b)) { a++; b++; } return lc((uint8_t)*a) - lc((uint8_t)*b); }
+extern "C" char *strstr(const char *h, const char *n) {
+  size_t m = strlen(n); if (!m) return (char *)h;
+  for (; *h; h++) if (strncmp(h, n, m) == 0) return (char *)h;
+  return NULL;
+}
+extern "C" char *strcpy(char *d, const char *s) { char *r = d; while ((*d++ = *s++)); return r; }
+extern "C" char *strncpy(char *d, const char *s, size_t n) { size_t i = 0; for (; i < n && s[i]; i++) d[i] = s[i]; for (; i < n; i++) d[i] = 0; return d; }
+extern "C" char *strchr(const char *s, int c) { for (;; s++) { if (*s == (char)c) return (char *)s; if (!*s) return NULL; } }
+extern "C" char *strrchr(const char *s, int c) { const char *r = NULL; for (;; s++) { if (*s == (char)c) r = s; if (!*s) return (char *)r; } }
+extern "C" char *strcat(char *d, const char *s) { strcpy(d + strlen(d), s); return d; }
+extern "C" void *memcpy(void *d, const void *s, size_t n) { char *a = (char *)d; const char *b = (const char *)s; while (n--) *a++ = *b++; return d; }
+extern "C" void *memmove(void *d, const void *s, size_t n) {
+  char *a = (char *)d; const char *b = (const char *)s;
+  if (a < b) while (n--) *a++ = *b++; else { a += n; b += n; while (n--) *--a = *--b; }
+  return d;
+}
+extern "C" void *memset(void *d, int c, size_t n) { char *a = (char *)d; while (n--) *a++ = c; return d; }
+extern "C" int memcmp(const void *x, const void *y, size_t n) { const uint8_t *a = (const uint8_t *)x, *b = (const uint8_t *)y; for (; n; n--, a++, b++) if (*a != *b) return *a - *b; return 0; }
+extern "C" void *memchr(const void *s, int c, size_t n) { const uint8_t *a = (const uint8_t *)s; for (; n; n--, a++) if (*a == (uint8_t)c) return (void *)a; return NULL; }
+extern "C" int abs(int x) { return x < 0 ? -x : x; }
+static unsigned Seed = 1;
+extern "C" int rand(void) { Seed = Seed * 1103515245 + 12345; return (Seed >> 1) & RAND_MAX; }
+extern "C" void srand(unsigned s) { Seed = s; }
+extern "C" void qsort(void *b, size_t n, size_t s, int (*c)(const void*, const void*)) {
+  char *base = (char *)b; char tmp[256];
+  for (size_t i = 1; i < n; i++) for (size_t j = i; j > 0 && c(base+(j-1)*s, base+j*s) > 0; j--) {
+    memcpy(tmp, base+j*s, s); memcpy(base+j*s, base+(j-1)*s, s); memcpy(base+(j-1)*s, tmp, s); }
+}
+
+// math via x87
+extern "C" double sqrt(double x) { double r; __asm__("fsqrt" : "=t"(r) : "0"(x)); return r; }
+extern "C" float sqrtf(float x) { return sqrt(x); }
+extern "C" double sin(double x) { double r; __asm__("fsin" : "=t"(r) : "0"(x)); return r; }
+extern "C" double cos(double x) { double r; __asm__("fcos" : "=t"(r) : "0"(x)); return r; }
+extern "C" double tan(double x) { return sin(x)/cos(x); }
+extern "C" double atan2(double y, double x) { double r; __asm__("fpatan" : "=t"(r) : "0"(x), "u"(y) : "st(1)"); return r; }
+extern "C" double atan(double x) { return atan2(x, 1.0); }
+extern "C" double asin(double x) { return atan2(x, sqrt(1 - x*x)); }
+extern "C" double acos(double x) { return atan2(sqrt(1 - x*x), x); }
+extern "C" double log(double x) { double r; __asm__("fldln2; fxch; fyl2x" : "=t"(r) : "0"(x)); return r; }
+extern "C" double log10(double x) { return log(x) / 2.302585092994046; }
+extern "C" double fabs(double x) { return x < 0 ? -x : x; }
+extern "C" double floor(double x) { double t = (double)(long long)x; return (t > x) ? t - 1 : t; }
+extern "C" float floorf(float x) { return floor(x); }
+extern "C" double ceil(double x) { double t = (double)(long long)x; return (t < x) ? t + 1 : t; }
+extern "C" double round(double x) { return x < 0 ? -floor(-x + 0.5) : floor(x + 0.5); }
+extern "C" double fmod(double x, double y) { return x - y * (double)(long long)(x / y); }
+extern "C" double exp(double x) {
+  // e^x = 2^(x*log2e)
+  double t = x * 1.4426950408889634, i = round(t), f = t - i, r;
+  __asm__("f2xm1" : "=t"(r) : "0"(f)); r += 1.0;
+  __asm__("fscale" : "=t"(r) : "0"(r), "u"(i));
+  return r;
+}
+extern "C" double pow(double x, double y) {
+  if (y == (double)(int)y && y >= 0 && y < 64) { double r = 1; for (int i = 0; i < (int)y; i++) r *= x; return r; }
+  if (y == (double)(int)y && y < 0 && y > -64) { double r = 1; for (int i = 0; i < -(int)y; i++) r *= x; return 1/r; }
+  return exp(y * log(x));
+}
+extern "C" double sinh(double x) { return (exp(x) - exp(-x))/2; }
+extern "C" double cosh(double x) { return (exp(x) + exp(-x))/2; }
+extern "C" double tanh(double x) { return sinh(x)/cosh(x); }
+extern "C" long long __divdi3(long long a, long long b);
+
+// setjmp/longjmp
+__asm__(
+".globl setjmp\n setjmp:\n"
+" mov 4(%esp), %eax\n mov %ebx, (%eax)\n mov %esi, 4(%eax)\n mov %edi, 8(%eax)\n mov %ebp, 12(%eax)\n"
+" lea 4(%esp), %ecx\n mov %ecx, 16(%eax)\n mov (%esp), %ecx\n mov %ecx, 20(%eax)\n xor %eax, %eax\n ret\n"
+".globl longjmp\n longjmp:\n"
+" mov 4(%esp), %edx\n mov 8(%esp), %eax\n test %eax, %eax\n jnz 1f\n inc %eax\n1:\n"
+" mov (%edx), %ebx\n mov 4(%edx), %esi\n mov 8(%edx), %edi\n mov 12(%edx), %ebp\n mov 16(%edx), %esp\n jmp *20(%edx)\n");
+
+// time
+struct ts32 { int s, ns; };
+static unsigned long long nowus() { ts32 t; sysc(265, 1, (int)&t); return (unsigned long long)t.s * 1000000ULL + t.ns / 1000; }
+static unsigned long long T0;
+unsigned long millis() { return (unsigned long)((nowus() - T0) / 1000); }
+unsigned long micros() { return (unsigned long)(nowus() - T0); }
+void delay(unsigned long ms) { ts32 t = { (int)(ms/1000), (int)(ms%1000)*1000000 }; sysc(162, (int)&t, 0); }
+void delayMicroseconds(unsigned int us) { ts32 t = { 0, (int)us*1000 }; sysc(162, (int)&t, 0); }
+long random(long n) { return n ? rand() % n : 0; }
+long random(long a, long b) { return a + random(b - a); }
+void randomSeed(unsigned long s) { srand(s); }
+void pinMode(int, int) {} void digitalWrite(int, int) {} int digitalRead(int) { return 1; } int analogRead(int) { return 0; }
+void analogWrite(int, int) {} void analogReadResolution(int) {}
+void attachInterrupt(int, void (*)(), int) {} void detachInterrupt(int) {}
+bool psramInit() { return true; }
+#ifndef PSOFFSET
+#define PSOFFSET 0
+#endif
+void *ps_malloc(size_t n) { return (char *)malloc(n + PSOFFSET) + PSOFFSET; }
+
+// serial: stdin is slurped at start
+static char *In; static int InLen = 0, InPos = 0;
+static char OutBuf[4096]; static int OutLen = 0;
+static void outflush() { if (OutLen) sysc(4, 1, (int)OutBuf, OutLen); OutLen = 0; }
+// Writes what the display shows to screen.ppm, converting RGB565 the same way as gfx-save-ppm
+extern TFT_eSPI tft;
+static void writescreen() {
+  if (!tft.panel) return;
+  int fd = sysc(5, (int)"screen.ppm", 0x241 /* O_WRONLY|O_CREAT|O_TRUNC */, 0644);
+  if (fd < 0) return;
+  const char *header = "P6\n320 240\n255\n";
+  sysc(4, fd, (int)header, strlen(header));
+  uint8_t line[320*3];
+  for (int y=0; y<240; y++) {
+    for (int x=0; x<320; x++) {
+      uint16_t c = tft.panel[y*320+x];
+      line[x*3] = (c>>8 & 0xF8) | c>>13;
+      line[x*3+1] = (c>>3 & 0xFC) | (c>>9 & 0x03);
+      line[x*3+2] = (c<<3 & 0xF8) | (c>>2 & 0x07);
+    }
+    sysc(4, fd, (int)line, sizeof(line));
+  }
+  sysc(6, fd);
+}
+
+int HostSerial::available() {
+  if (this != &Serial) return 0;
+  if (InPos >= InLen) { outflush(); writescreen(); host_exit(0); }
+  return 1;
+}
+int HostSerial::read() { if (this != &Serial || InPos >= InLen) return -1; return (uint8_t)In[InPos++]; }
+int HostSerial::peek() { if (InPos >= InLen) return -1; return (uint8_t)In[InPos]; }
+size_t HostSerial::write(char c) {
+  if (this != &Serial) return 1;
+  OutBuf[OutLen++] = c; if (OutLen == sizeof(OutBuf) || c == '\n') outflush(); return 1;
+}
+void HostSerial::print(int i) { char b[16]; int n = 0; unsigned u = i < 0 ? -i : i; do { b[n++] = '0' + u % 10; u /= 10; } while (u); if (i < 0) write('-'); while (n) write(b[--n]); }
+HostSerial Serial, Serial1;
+TwoWire Wire, Wire1;
+SPIClass SPI;
+I2SClass I2S;
+WiFiClass WiFi;
+
+// files
+static const char *SDRoot = "sd";
+static void mkpath(char *out, const char *root, const char *name) {
+  strcpy(out, root); if (name[0] != '/') strcat(out, "/"); strcat(out, name);
+  size_t n = strlen(out); if (n > 1 && out[n-1] == '/') out[n-1] = 0;
+}
+struct stat64_32 { unsigned long long dev; unsigned char pad0[4]; unsigned int ino_; unsigned int mode; unsigned int nlink; unsigned int uid, gid; unsigned long long rdev; unsigned char pad3[4]; long long size; unsigned int blksize; unsigned long long blocks; unsigned int atime, atime_ns, mtime, mtime_ns, ctime, ctime_ns; unsigned long long ino; } __attribute__((packed));
+int File::read() { uint8_t c; return (fd >= 0 && sysc(3, fd, (int)&c, 1) == 1) ? c : -1; }
+int File::read(uint8_t *buf, size_t n) { if (fd < 0) return -1; int r = sysc(3, fd, (int)buf, n); return r < 0 ? -1 : r; }
+int File::peek() { int c = read(); if (c >= 0) sysc(19, fd, -1, 1); return c; }
+uint32_t File::position() { return fd < 0 ? 0 : sysc(19, fd, 0, 1); }
+uint32_t File::size() { stat64_32 st; if (fd < 0) return 0; sysc(197, fd, (int)&st); return (uint32_t)st.size; }
+int File::available() { return fd < 0 ? 0 : size() - position(); }
+size_t File::write(const uint8_t *buf, size_t n) { if (fd < 0) return 0; int r = sysc(4, fd, (int)buf, n); return r < 0 ? 0 : r; }
+bool File::seek(uint32_t pos) { return fd >= 0 && sysc(19, fd, pos, 0) >= 0; }
+void File::close() { if (fd >= 0) sysc(6, fd); fd = -1; }
+uint32_t File::getLastWrite() { stat64_32 st; if (fd < 0) return 0; sysc(197, fd, (int)&st); return st.mtime; }
+void File::rewindDirectory() { if (fd >= 0) sysc(19, fd, 0, 0); dpos = dlen = 0; }
+File File::openNextFile() {
+  File f;
+  if (fd < 0 || !dir) return f;
+  for (;;) {
+    if (dpos >= dlen) {
+      dlen = sysc(141, fd, (int)dbuf, sizeof(dbuf)); dpos = 0;
+      if (dlen <= 0) { dlen = 0; return f; }
+    }
+    char *ent = dbuf + dpos;
+    unsigned short reclen = *(unsigned short *)(ent + 8);
+    const char *name = ent + 10;
+    dpos += reclen;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+    char p[128]; strcpy(p, path); strcat(p, "/"); strcat(p, name);
+    int nfd = sysc(5, (int)p, 0x10000 /* O_DIRECTORY */ | 0);
+    if (nfd >= 0) { f.dir = true; } else nfd = sysc(5, (int)p, 0);
+    f.fd = nfd; strcpy(f.path, p); strncpy(f.nm, name, 63);
+    return f;
+  }
+}
+File FSClass::open(const char *name, const char *mode) {
+  File f; char p[128]; mkpath(p, root, name);
+  int flags = 0;
+  if (mode[0] == 'w') flags = 1 | 0100 | 01000; else if (mode[0] == 'a') flags = 1 | 0100 | 02000;
+  int fd = -1;
+  if (flags == 0) { fd = sysc(5, (int)p, 0x10000); if (fd >= 0) f.dir = true; else fd = sysc(5, (int)p, 0); }
+  else fd = sysc(5, (int)p, flags, 0644);
+  if (fd < 0) return f;
+  f.fd = fd; strcpy(f.path, p);
+  const char *b = strrchr(name, '/'); strncpy(f.nm, b ? b + 1 : name, 63);
+  return f;
+}
+bool FSClass::exists(const char *name) { char p[128]; mkpath(p, root, name); int fd = sysc(5, (int)p, 0); if (fd < 0) return false; sysc(6, fd); return true; }
+bool FSClass::remove(const char *name) { char p[128]; mkpath(p, root, name); return sysc(10, (int)p) == 0; }
+bool FSClass::mkdir(const char *name) { char p[128]; mkpath(p, root, name); return sysc(39, (int)p, 0755) == 0; }
+bool FSClass::rmdir(const char *name) { char p[128]; mkpath(p, root, name); return sysc(40, (int)p) == 0; }
+bool FSClass::rename(const char *a, const char *b) { char p[128], q[128]; mkpath(p, root, a); mkpath(q, root, b); return sysc(38, (int)p, (int)q) == 0; }
+FSClass SD(SDRoot), LittleFS("lfs");
+
+void setup(); void loop();
+typedef void (*initfn)();
+extern initfn __init_array_start[], __init_array_end[];
+// Reports the address of a fault, and the return addresses up the frame chain if it was built with
+// -fno-omit-frame-pointer, for addr2line; the kernel passes the old-style sigcontext after the signal number
+static void hexline (unsigned int x, const char *prefix) {
+  char b[24]; int n = 0;
+  while (*prefix) b[n++] = *prefix++;
+  for (int i=28; i>=0; i-=4) b[n++] = "0123456789abcdef"[(x>>i) & 15];
+  b[n++] = '\n'; sysc(4, 2, (int)b, n);
+}
+static void segv (int, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int,
+  unsigned int ebp, unsigned int esp, unsigned int, unsigned int, unsigned int, unsigned int, unsigned int,
+  unsigned int, unsigned int eip) {
+  outflush();
+  hexline(eip, "\nSEGV at 0x");
+  unsigned int *fp = (unsigned int *)ebp;
+  for (int k=0; k<12 && (unsigned int)fp > esp && (unsigned int)fp < esp + 0x1000000; k++) {
+    hexline(fp[1], "  from 0x"); fp = (unsigned int *)fp[0];
+  }
+  sysc(1, 139);
+}
+struct ksa { void *h; unsigned int mask; unsigned int flags; void *restorer; };
+extern "C" void host_main() {
+  { ksa a = { (void *)segv, 0, 0x40000000 /* SA_NODEFER */, 0 }; sysc(67, 11, (int)&a, 0); }
+  T0 = nowus();
+  In = (char *)malloc(4*1024*1024);
+  for (;;) { int r = sysc(3, 0, (int)(In + InLen), 65536); if (r <= 0) break; InLen += r; }
+  for (initfn *f = __init_array_start; f < __init_array_end; f++) (*f)();
+  setup();
+  for (;;) loop();
+}
+__asm__(".globl _start\n_start:\n and $-16, %esp\n call host_main\n hlt\n");
+
+extern "C" unsigned long long __udivmoddi4(unsigned long long n, unsigned long long d, unsigned long long *rem) {
+  unsigned long long q = 0, r = 0;
+  for (int i = 63; i >= 0; i--) { r = (r << 1) | ((n >> i) & 1); if (r >= d) { r -= d; q |= 1ULL << i; } }
+  if (rem) *rem = r;
+  return q;
+}
+extern "C" unsigned long long __udivdi3(unsigned long long n, unsigned long long d) { return __udivmoddi4(n, d, 0); }
+extern "C" unsigned long long __umoddi3(unsigned long long n, unsigned long long d) { unsigned long long r; __udivmoddi4(n, d, &r); return r; }
+extern "C" long long __divdi3(long long a, long long b) { int s = (a < 0) ^ (b < 0); unsigned long long q = __udivdi3(a < 0 ? -a : a, b < 0 ? -b : b); return s ? -(long long)q : q; }
+extern "C" long long __moddi3(long long a, long long b) { unsigned long long r; __udivmoddi4(a < 0 ? -a : a, b < 0 ? -b : b, &r); return a < 0 ? -(long long)r : r; }
+extern "C" int __popcountsi2 (unsigned int x) { int n = 0; while (x) { x &= x-1; n++; } return n; }
@@ -0,0 +1,301 @@
+// Minimal freestanding i386 host shim for compiling and running the uLisp sketch
+#pragma once
+typedef unsigned int size_t;
+typedef int ptrdiff_t;
+typedef signed char int8_t; typedef unsigned char uint8_t;
+typedef short int16_t; typedef unsigned short uint16_t;
+typedef int int32_t; typedef unsigned int uint32_t;
+typedef long long int64_t; typedef unsigned long long uint64_t;
+typedef int intptr_t; typedef unsigned int uintptr_t;
+#define NULL 0
+#define INT_MAX 2147483647
+#define INT_MIN (-INT_MAX-1)
+#define UINT32_MAX 0xFFFFFFFFu
+#define RAND_MAX 0x7FFFFFFF
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define bitRead(v,b) (((v)>>(b))&1)
+#define HIGH 1
+#define LOW 0
+#define INPUT 1
+#define OUTPUT 3
+#define INPUT_PULLUP 5
+#define INPUT_PULLDOWN 9
+#define LED_BUILTIN 2
+#define FALLING 2
+#define CHANGE 3
+#define IRAM_ATTR
+#define digitalPinToInterrupt(p) (p)
+#define ARDUINO_ESP32S3_DEV 1
+#define ESP32 1
+#define CPU_LX7 1
+#define GT911_SLAVE_ADDRESS_L 0x5D
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+extern "C" {
+int sysc(int n, int a=0, int b=0, int c=0, int d=0);
+void *malloc(size_t n); void free(void *p); void *realloc(void *p, size_t n); void *calloc(size_t a, size_t b);
+size_t strlen(const char *s); int strcmp(const char *a, const char *b); int strncmp(const char *a, const char *b, size_t n);
+int strcasecmp(const char *a, const char *b); char *strstr(const char *h, const char *n);
+char *strcpy(char *d, const char *s); char *strncpy(char *d, const char *s, size_t n); char *strchr(const char *s, int c);
+char *strrchr(const char *s, int c); char *strcat(char *d, const char *s);
+void *memcpy(void *d, const void *s, size_t n); void *memmove(void *d, const void *s, size_t n);
+void *memset(void *d, int c, size_t n); int memcmp(const void *a, const void *b, size_t n); void *memchr(const void *s, int c, size_t n);
+int abs(int x); int rand(void); void srand(unsigned s);
+void qsort(void *b, size_t n, size_t s, int (*c)(const void*, const void*));
+double sin(double); double cos(double); double tan(double); double asin(double); double acos(double);
+double atan2(double, double); double atan(double); double sinh(double); double cosh(double); double tanh(double);
+double exp(double); double sqrt(double); double log(double); double log10(double); double pow(double, double);
+double floor(double); double ceil(double); double round(double); double fmod(double, double); double fabs(double);
+float floorf(float); float sqrtf(float);
+typedef int jmp_buf[6];
+int setjmp(jmp_buf b) __attribute__((returns_twice));
+void longjmp(jmp_buf b, int v) __attribute__((noreturn));
+void host_exit(int c) __attribute__((noreturn));
+}
+inline float abs(float x) { return x < 0 ? -x : x; }
+#define isnan(x) __builtin_isnan(x)
+#define isinf(x) __builtin_isinf(x)
+#define INFINITY __builtin_inff()
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+
+unsigned long millis(); unsigned long micros(); void delay(unsigned long ms); void delayMicroseconds(unsigned int us);
+inline void noInterrupts() {} inline void interrupts() {}
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(m) ((void)(m))
+#define portEXIT_CRITICAL(m) ((void)(m))
+#define portENTER_CRITICAL_ISR(m) ((void)(m))
+#define portEXIT_CRITICAL_ISR(m) ((void)(m))
+inline void yield() {}
+long random(long n); long random(long a, long b); void randomSeed(unsigned long s);
+void pinMode(int, int); void digitalWrite(int, int); int digitalRead(int); int analogRead(int);
+void analogWrite(int, int); void analogReadResolution(int);
+void attachInterrupt(int, void (*)(), int); void detachInterrupt(int);
+bool psramInit(); void *ps_malloc(size_t n);
+inline void *operator new(size_t, void *p) { return p; }
+
+class HostSerial {
+public:
+  void begin(long) {}
+  operator bool() { return true; }
+  int available();
+  int read();
+  int peek();
+  size_t write(char c);
+  size_t write(const uint8_t *b, size_t n) { for (size_t i=0; i<n; i++) write(b[i]); return n; }
+  void print(const char *s) { while (*s) write(*s++); }
+  void print(char c) { write(c); }
+  void print(int i);
+  void println(const char *s) { print(s); write('\n'); }
+  void println(int i) { print(i); write('\n'); }
+  void println() { write('\n'); }
+  void flush() {}
+  void end() {}
+};
+extern HostSerial Serial, Serial1;
+
+class TwoWire {
+public:
+  void begin() {} void begin(int, int) {} void end() {}
+  uint8_t requestFrom(int, int) { return 0; }
+  int available() { return 0; }
+  int read() { return 0; }
+  size_t write(uint8_t) { return 1; }
+  void beginTransmission(int) {}
+  uint8_t endTransmission(bool = true) { return 0; }
+};
+extern TwoWire Wire, Wire1;
+
+#define SPI_MODE0 0
+#define SPI_MODE1 1
+#define SPI_MODE2 2
+#define SPI_MODE3 3
+#define MSBFIRST 1
+#define LSBFIRST 0
+struct SPISettings { SPISettings() {} SPISettings(long, int, int) {} };
+class SPIClass {
+public:
+  void begin() {} void begin(int, int, int) {} void begin(int, int, int, int) {}
+  uint8_t transfer(uint8_t) { return 0; }
+  void beginTransaction(SPISettings) {} void endTransaction() {}
+};
+extern SPIClass SPI;
+
+#define I2S_PHILIPS_MODE 0
+class I2SClass {
+public:
+  bool begin(int, long, int) { return true; } void end() {} size_t write(int) { return 1; }
+  void setAllPins(int, int, int, int, int) {}
+};
+extern I2SClass I2S;
+
+class IPAddress {
+public:
+  uint32_t a;
+  IPAddress() : a(0) {}
+  IPAddress(uint32_t x) : a(x) {}
+  IPAddress(int, int, int, int) : a(0) {}
+  operator uint32_t() { return a; }
+};
+class WiFiClient {
+public:
+  int available() { return 0; } int read() { return -1; } size_t write(char) { return 1; }
+  void stop() {} int connect(const char *, int) { return 0; } int connect(IPAddress, int) { return 0; }
+  bool connected() { return false; } operator bool() { return false; }
+};
+class WiFiServer {
+public:
+  WiFiServer(int) {} void begin() {} WiFiClient available() { return WiFiClient(); }
+  void setNoDelay(bool) {}
+};
+#define WIFI_STA 1
+#define WL_CONNECTED 3
+#define WL_NO_SSID_AVAIL 1
+#define WL_CONNECT_FAILED 4
+class WiFiClass {
+public:
+  IPAddress softAP(const char *, const char * = 0, int = 1, int = 0) { return IPAddress(); }
+  IPAddress softAPIP() { return IPAddress(); }
+  IPAddress localIP() { return IPAddress(); }
+  void mode(int) {} int begin(const char *, const char * = 0) { return 0; } int status() { return 0; }
+  void disconnect(bool = false) {}
+  bool softAPdisconnect(bool = false) { return true; }
+  int waitForConnectResult() { return 0; }
+};
+extern WiFiClass WiFi;
+
+extern "C" int sysc(int, int, int, int, int);
+class TFT_eSPI {
+public:
+  int16_t cx = 0, cy = 0; uint8_t ts = 1; bool swap = false;
+  uint16_t tfg = 0xFFFF, tbg = 0;
+  uint16_t *panel = 0;  // what the display shows, written to screen.ppm at exit
+  virtual ~TFT_eSPI() {}
+  void begin() {} void init() {}
+  void setRotation(int) {} void fillScreen(uint16_t c) { fillRect(0, 0, width(), height(), c); }
+  virtual void drawPixel(int32_t x, int32_t y, uint32_t c) {
+    if (x < 0 || y < 0 || x >= 320 || y >= 240) return;
+    if (!panel) panel = (uint16_t *)calloc(320*240, 2);
+    panel[y*320+x] = c;
+  }
+  virtual void drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t c) {
+    int dx = x1>x0?x1-x0:x0-x1, dy = y1>y0?y1-y0:y0-y1, n = dx>dy?dx:dy;
+    for (int i=0; i<=n; i++) drawPixel(x0 + (n?(x1-x0)*i/n:0), y0 + (n?(y1-y0)*i/n:0), c);
+  }
+  void drawRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t c) {
+    fillRect(x, y, w, 1, c); fillRect(x, y+h-1, w, 1, c); fillRect(x, y, 1, h, c); fillRect(x+w-1, y, 1, h, c);
+  }
+  virtual void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t c) {
+    for (int j=y; j<y+h; j++) for (int i=x; i<x+w; i++) drawPixel(i, j, c);
+  }
+  void drawCircle(int32_t x, int32_t y, int32_t r, uint32_t c) { drawPixel(x-r, y, c); drawPixel(x+r, y, c); drawPixel(x, y-r, c); drawPixel(x, y+r, c); }
+  void fillCircle(int32_t x, int32_t y, int32_t r, uint32_t c) { fillRect(x-r, y-r, 2*r+1, 2*r+1, c); }
+  void drawRoundRect(int32_t x, int32_t y, int32_t w, int32_t h, int32_t, uint32_t c) { drawRect(x, y, w, h, c); }
+  void fillRoundRect(int32_t x, int32_t y, int32_t w, int32_t h, int32_t, uint32_t c) { fillRect(x, y, w, h, c); }
+  void drawTriangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint32_t c) { drawLine(x0,y0,x1,y1,c); drawLine(x1,y1,x2,y2,c); drawLine(x2,y2,x0,y0,c); }
+  void fillTriangle(int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint32_t c) { drawTriangle(x0,y0,x1,y1,x2,y2,c); }
+  virtual void drawChar(int32_t x, int32_t y, uint16_t ch, uint32_t fg, uint32_t bg, uint8_t s) {
+    if (bg != fg) fillRect(x, y, 6*s, 8*s, bg);
+    if (ch != ' ') fillRect(x+s, y+s, 4*s, 6*s, fg ^ ch);
+  }
+  void setCursor(int16_t x, int16_t y) { cx = x; cy = y; }
+  void setTextColor(uint16_t c) { tfg = tbg = c; } void setTextColor(uint16_t f, uint16_t b) { tfg = f; tbg = b; }
+  void setTextSize(uint8_t s) { ts = s; } void setTextWrap(bool) {} void invertDisplay(bool) {}
+  virtual size_t write(uint8_t c) {
+    if (c == '\n') { cx = 0; cy += 8*ts; return 1; }
+    if (cx + 6*ts > width()) { cx = 0; cy += 8*ts; }
+    drawChar(cx, cy, c, tfg, tbg, ts); cx += 6*ts; return 1;
+  }
+  void startWrite() {} void endWrite() {}
+  void setAddrWindow(int32_t, int32_t, int32_t, int32_t) {}
+  void pushColors(uint16_t *, uint32_t, bool = true) {}
+  void pushPixels(const void *, uint32_t) {}
+  void pushImage(int32_t x, int32_t y, int32_t iw, int32_t ih, uint16_t *d) {
+    for (int j=0; j<ih; j++) for (int i=0; i<iw; i++) { uint16_t c = d[j*iw+i]; drawPixel(x+i, y+j, swap ? c : (uint16_t)(c>>8 | c<<8)); }
+  }
+  bool initDMA(bool = false) { return true; }
+  void pushPixelsDMA(uint16_t *, uint32_t) {} void dmaWait() {}
+  void setSwapBytes(bool s) { swap = s; } bool getSwapBytes() { return swap; }
+  void pushImage(int32_t x, int32_t y, int32_t iw, int32_t ih, const uint16_t *d) { pushImage(x, y, iw, ih, (uint16_t *)d); }
+  int16_t getCursorX() { return cx; } int16_t getCursorY() { return cy; }
+  virtual int16_t width() { return 320; } virtual int16_t height() { return 240; }
+};
+
+class TFT_eSprite : public TFT_eSPI {
+public:
+  TFT_eSPI *tft; uint16_t *img = 0; int w = 0, h = 0;
+  TFT_eSprite(TFT_eSPI *t) : tft(t) {}
+  void setColorDepth(int) {}
+  void *createSprite(int16_t sw, int16_t sh) { img = (uint16_t *)calloc(sw*sh, 2); if (img) { w = sw; h = sh; } return img; }
+  void deleteSprite() { free(img); img = 0; w = h = 0; }
+  int16_t width() { return w; } int16_t height() { return h; }
+  void drawPixel(int32_t x, int32_t y, uint32_t c) { if (x >= 0 && y >= 0 && x < w && y < h) img[y*w+x] = c; }
+  uint16_t readPixel(int32_t x, int32_t y) { return img[y*w+x]; }
+  void pushSprite(int32_t x, int32_t y) { pushSprite(x, y, 0, 0, w, h); }
+  bool pushSprite(int32_t x, int32_t y, int32_t sx, int32_t sy, int32_t sw, int32_t sh) {
+    for (int j=0; j<sh; j++) for (int i=0; i<sw; i++) tft->drawPixel(x+i, y+j, img[(sy+j)*w+sx+i]);
+    return true;
+  }
+};
+
+class TouchDrvGT911 {
+public:
+  void setPins(int, int) {}
+  bool begin(TwoWire &, int) { return true; }
+  void setMaxCoordinates(int, int) {} void setSwapXY(bool) {} void setMirrorXY(bool, bool) {}
+  uint8_t getPoint(int16_t *, int16_t *, uint8_t) { return 0; }
+  uint8_t getSupportTouchPoint() { return 5; }
+  bool isPressed() { return false; }
+};
+
+// Files backed by a host directory
+class File {
+public:
+  int fd = -1;
+  bool dir = false;
+  char path[128];
+  char nm[64];
+  char dbuf[1024]; int dpos = 0, dlen = 0;
+  File() { path[0] = 0; nm[0] = 0; }
+  operator bool() { return fd >= 0; }
+  int read();
+  int read(uint8_t *buf, size_t n);
+  int available();
+  int peek();
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t *buf, size_t n);
+  size_t write(const char *buf, size_t n) { return write((const uint8_t *)buf, n); }
+  bool seek(uint32_t pos);
+  uint32_t position();
+  uint32_t size();
+  void close();
+  void flush() {}
+  const char *name() { return nm; }
+  const char *path_() { return path; }
+  bool isDirectory() { return dir; }
+  File openNextFile();
+  void rewindDirectory();
+  uint32_t getLastWrite();
+};
+
+class FSClass {
+public:
+  const char *root;
+  FSClass(const char *r) : root(r) {}
+  bool begin(int = 0, SPIClass & = SPI, uint32_t = 0) { return true; }
+  bool begin(bool) { return true; }
+  File open(const char *name, const char *mode = FILE_READ);
+  bool exists(const char *name);
+  bool remove(const char *name);
+  bool mkdir(const char *name);
+  bool rmdir(const char *name);
+  bool rename(const char *a, const char *b);
+  uint32_t totalBytes() { return 16000000; }
+};
+extern FSClass SD, LittleFS;
@@ -0,0 +1 @@
+// stub
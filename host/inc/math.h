@@ -0,0 +1,2 @@
+// stub
+#define INFINITY __builtin_inff()
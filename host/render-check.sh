@@ -0,0 +1,33 @@
+#!/bin/bash
+# Renders a Lisp scene on the host build twice, once straight to the display and once through the
+# framebuffer with its dirty-rectangle flushing, and checks the two screens match pixel for pixel:
+#   host/render-check.sh [scene.lisp [reference.ppm]]
+# The scene defaults to host/scene.lisp. The screens are left in host/build/direct.ppm and
+# host/build/framebuffer.ppm. With a reference PPM, the framebuffer screen must match that too.
+HOST=$(cd "$(dirname "$0")" && pwd)
+SCENE=${1:-$HOST/scene.lisp}
+BUILD=$HOST/build
+
+render () {
+  { echo "(gfx-framebuffer $1)"; cat "$SCENE"; } > "$BUILD/render.lisp"
+  rm -f "$BUILD/screen.ppm"
+  "$HOST/run.sh" "$BUILD/render.lisp" > /dev/null || exit 1
+  mv "$BUILD/screen.ppm" "$BUILD/$2.ppm"
+}
+
+# Counts the pixels that differ between two PPM files of the same size
+compare () {
+  python3 - "$1" "$2" <<'PY'
+import sys
+a, b = (open(f, 'rb').read() for f in sys.argv[1:3])
+if len(a) != len(b): sys.exit(f"{sys.argv[1]} and {sys.argv[2]} are different sizes")
+n = sum(1 for i in range(15, len(a), 3) if a[i:i+3] != b[i:i+3])
+if n: sys.exit(f"{sys.argv[1]} and {sys.argv[2]} differ in {n} pixels")
+PY
+}
+
+render nil direct
+render t framebuffer
+compare "$BUILD/direct.ppm" "$BUILD/framebuffer.ppm" || exit 1
+if [ -n "$2" ]; then compare "$2" "$BUILD/framebuffer.ppm" || exit 1; fi
+echo "render-check: $(basename "$SCENE") matches"
@@ -0,0 +1,12 @@
+#!/bin/bash
+# Runs Lisp source through the host build as if typed at the REPL: host/run.sh file.lisp
+# The SD card is the directory host/build/sd, and LispLibrary is loaded at startup as on the T-Deck.
+# Exits with an error if the program crashes or any form signals an error.
+HOST=$(cd "$(dirname "$0")" && pwd)
+FILE=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+mkdir -p "$HOST/build/sd"
+cd "$HOST/build"
+./ulisp < "$FILE" | tee output.txt
+status=${PIPESTATUS[0]}
+if [ "$status" -ne 0 ]; then echo "run.sh: $1 exited with status $status" >&2; exit "$status"; fi
+if grep -q "^Error:" output.txt; then echo "run.sh: $1 signalled an error" >&2; exit 1; fi
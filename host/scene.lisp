@@ -0,0 +1,42 @@
+; Render check scene - a uos style screen with windows, text runs, shapes
+; and images. Most of it is drawn inside one form, so the framebuffer
+; collects more dirty rectangles than it has slots and has to merge them.
+
+(defun draw-scene ()
+  (fill-screen bg_col)
+  (let ((files (uos:window 4 4 180 110 "Files"))
+        (text (uos:window 190 4 126 110)))
+    (draw-window-border files)
+    (dotimes (i 7)
+      (disp-line-hilite files (format nil "file-~a.lisp ~asel~a ~a" i (code-char 2) (code-char 3) (* i 37)) i))
+    (draw-window-border text)
+    (dotimes (i 9) (disp-line text (format nil "row ~a" i) i (= i 4))))
+  (dotimes (i 20)
+    (fill-rect (+ 4 (* i 15)) (+ 120 (mod (* i 37) 60)) 7 5 (rgb (* i 12) 120 (- 255 (* i 12)))))
+  (draw-line 0 239 319 190 highlight_col)
+  (draw-circle 40 205 20 cursor_col)
+  (fill-circle 90 210 12 header_col)
+  (draw-triangle 130 235 150 195 170 235 code_col)
+  (fill-round-rect 190 196 50 30 6 border_col)
+  (draw-char 250 200 #\Q code_col bg_col 2)
+  (dotimes (i 10) (draw-pixel (+ 270 (* i 4)) 230 #xFFFF)))
+
+(defun draw-images ()
+  (let ((colours (make-array 64 :element-type '(unsigned-byte 16)))
+        (indexes (make-array 64 :element-type '(unsigned-byte 8)))
+        (palette (make-array 4 :element-type '(unsigned-byte 16))))
+    (dotimes (i 64)
+      (setf (aref colours i) (rgb (* i 4) 0 (- 255 (* i 4))))
+      (setf (aref indexes i) (mod i 4)))
+    (setf (aref palette 0) bg_col (aref palette 1) code_col (aref palette 2) cursor_col (aref palette 3) highlight_col)
+    (draw-image 280 140 8 colours)
+    (draw-image 300 140 8 indexes palette)))
+
+(defvar write-text nil)
+
+(with-gfx (scr)
+  (setq write-text (lambda (s) (princ s scr)))
+  (draw-scene))
+(draw-images)
+(fill-rect 60 40 40 30 bg_col2)
+(with-gfx (scr) (set-cursor 100 150) (set-text-color code_col bg_col) (princ "with-gfx text" scr))
@@ -36,52 +36,42 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 
 ;;;; Window class
 
+;; A window is a record, so reading its geometry is a slot load rather than a message dispatch
+(defstruct window x y w h title)
+
 (defun uos:window (x y w h &optional title)
-  (let* (	
-         (set-pos_ (lambda (x_ y_) (setf x x_ y y_)))
-         (set-size_ (lambda (w_ h_) (setf w w_ h h_)))
-         )
-    (lambda (&rest msgs)
-      (case (car msgs)
-        (x x) 
-        (y y)
-        (w w)
-        (h h)
-        (title (if (cadr msgs) 
-                   (setf title (cadr msgs))
-                   title))
-        (in-x (+ x 2))
-        (in-y (if title (+ y 2 3 leading) (+ y 2)))
-        (in-w (- w 2))
-        (in-h (if title (- h 2 3 leading) (- h 2)))
-        (set-pos (apply set-pos_ (cdr msgs)))
-        (set-size (apply set-size_ (cdr msgs)))
-        )  
-      )))
+  (make-window :x x :y y :w w :h h :title title))
+
+(defun window-in-x (win) (+ (window-x win) 2))
+(defun window-in-y (win) (if (window-title win) (+ (window-y win) 2 3 leading) (+ (window-y win) 2)))
+(defun window-in-w (win) (- (window-w win) 2))
+(defun window-in-h (win) (if (window-title win) (- (window-h win) 2 3 leading) (- (window-h win) 2)))
+(defun window-set-pos (win x y) (setf (window-x win) x (window-y win) y))
+(defun window-set-size (win w h) (setf (window-w win) w (window-h win) h))
 
 (defun draw-window-border (win)
-  (let ((x (win 'x)) (y (win 'y)) (w (win 'w)) (h (win 'h)))
+  (let ((x (window-x win)) (y (window-y win)) (w (window-w win)) (h (window-h win)))
 
     (fill-rect x y w h bg_col )	
     (draw-rect x y w h border_col )
 	
-    (when (win 'title )
+    (when (window-title win)
       (draw-rect x y w (+ 3 leading) border_col  )
       (set-text-color header_col bg_col )
       (set-cursor (+ x 2)  (+ y 3))
-      (write-text (win 'title )))
+      (write-text (window-title win)))
     ))
 		
-(defun tmax-x (win) (- (truncate (win 'in-w) cwidth) 1))
-(defun tmax-y (win) (truncate (win 'in-h) leading))
+(defun tmax-x (win) (- (truncate (window-in-w win) cwidth) 1))
+(defun tmax-y (win) (truncate (window-in-h win) leading))
 
 #| scroll bars dont work yet |#
 (defun draw-scroll-h (win scrollpos-h scrolltotal-h)
-  (let* ((x (win 'x)) (y (win 'y)) (h (win 'h)) (w (win 'w))
-                      (barlen (max 4 (truncate (win 'in-h) scrolltotal-h))))
+  (let* ((x (window-x win)) (y (window-y win)) (h (window-h win)) (w (window-w win))
+                      (barlen (max 4 (truncate (window-in-h win) scrolltotal-h))))
     (fill-rect (+ x (- w 2)) 
-               (+  (win 'in-y)
-                   (truncate (* (- h barlen (if (win 'title ) (+ 2 leading) 0)) 
+               (+  (window-in-y win)
+                   (truncate (* (- h barlen (if (window-title win) (+ 2 leading) 0)) 
                                 (/ scrollpos-h scrolltotal-h)))) 
                2  barlen
                header_col)))
@@ -91,85 +81,63 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 (defun windows-split-v (win1 win2 &optional (ratio .5) container )
   (if container
       (progn 
-       (win1 'set-pos (container 'in-x) (container 'in-y))
-       (win1 'set-size (round (* (container 'in-w) ratio)) (container 'in-h))
-       (win2 'set-pos (+ (container 'in-x) (round (* (container 'in-w) ratio))) (container 'in-y))
-       (win2 'set-size (round (* (container 'in-w) (- 1 ratio))) (container 'in-h)))
+       (window-set-pos win1 (window-in-x container) (window-in-y container))
+       (window-set-size win1 (round (* (window-in-w container) ratio)) (window-in-h container))
+       (window-set-pos win2 (+ (window-in-x container) (round (* (window-in-w container) ratio))) (window-in-y container))
+       (window-set-size win2 (round (* (window-in-w container) (- 1 ratio))) (window-in-h container)))
       (progn
-       (win1 'set-pos 0 0)
-       (win1 'set-size (round (* SCR-W ratio)) SCR-H)
-       (win2 'set-pos (round (* SCR-W ratio)) 0)
-       (win2 'set-size (round (* SCR-W (- 1 ratio))) SCR-H))
+       (window-set-pos win1 0 0)
+       (window-set-size win1 (round (* SCR-W ratio)) SCR-H)
+       (window-set-pos win2 (round (* SCR-W ratio)) 0)
+       (window-set-size win2 (round (* SCR-W (- 1 ratio))) SCR-H))
       ))
 
 (defun windows-split-h (win1 win2 &optional (ratio .5) container )
   (if container
       (progn 
-       (win1 'set-pos (container 'in-x) (container 'in-y))
-       (win1 'set-size (container 'in-w) (round (* (container 'in-h) ratio)) )
-       (win2 'set-pos (container 'in-x) (+ (container 'in-y) (round (* (container 'in-h) ratio))))
-       (win2 'set-size (container 'in-w) (round (* (container 'in-h) (- 1 ratio)))))
+       (window-set-pos win1 (window-in-x container) (window-in-y container))
+       (window-set-size win1 (window-in-w container) (round (* (window-in-h container) ratio)) )
+       (window-set-pos win2 (window-in-x container) (+ (window-in-y container) (round (* (window-in-h container) ratio))))
+       (window-set-size win2 (window-in-w container) (round (* (window-in-h container) (- 1 ratio)))))
       (progn
-       (win1 'set-pos 0 0)
-       (win1 'set-size  SCR-W (round (* SCR-H ratio)))
-       (win2 'set-pos 0 (round (* SCR-H ratio))) 
-       (win2 'set-size SCR-W (round (* SCR-H (- 1 ratio)))))
+       (window-set-pos win1 0 0)
+       (window-set-size win1  SCR-W (round (* SCR-H ratio)))
+       (window-set-pos win2 0 (round (* SCR-H ratio))) 
+       (window-set-size win2 SCR-W (round (* SCR-H (- 1 ratio)))))
       ))
 
 ;;; Text display functions
 
 (defun disp-line (win line y &optional is_selected)
-  (let ((ypos (+ (win 'in-y) (* y leading)))  (myl " "))
-    (when line (setf myl (concatenate 'string line myl)))
-    (set-cursor (win 'in-x) ypos)
-    (when (> (length myl) 0)
-      (if is_selected 
-          (set-text-color code_col cursor_col) 
-          (set-text-color code_col bg_col ))
-      (write-text (subseq myl 0 (min (length myl) (+ (tmax-x win) 1))))
-      )))
-	
+  (let ((myl (if line (concatenate 'string line " ") " ")))
+    (draw-text-run (window-in-x win) (+ (window-in-y win) (* y leading)) myl
+                   code_col (if is_selected cursor_col bg_col) nil 0 (min (length myl) (+ (tmax-x win) 1)))))
+
+#| STX and ETX in the line switch the background to cursor_col and back, and characters with the top bit set show as a cursor |#
 (defun disp-line-hilite (win line y)
-  (let* ((ypos (+ (win 'in-y) (* y leading)))  
-		 (myl (if line (concatenate 'string line " ") " "))
-         (len (min (length myl) (+ (tmax-x win) 1)))
-		)
-    (set-cursor (win 'in-x) ypos)
-    (set-text-color code_col bg_col )
-    (dotimes (i len)
-             (let ((c (char myl i)))
-               (cond ((eq c #\STX)(set-text-color code_col cursor_col))
-                     ((eq c #\ETX)(set-text-color code_col bg_col ))
-                     #| no idea why its 239 |#
-                     ((logbitp 7 (char-code c)) (set-text-color code_col cursor_col) 
-                                                (write-text " ") (set-text-color code_col bg_col ))
-                     (t (write-text c)))))))
+  (let ((myl (if line (concatenate 'string line " ") " ")))
+    (draw-text-run (window-in-x win) (+ (window-in-y win) (* y leading)) myl
+                   code_col bg_col cursor_col 0 (min (length myl) (+ (tmax-x win) 1)))))
 
+#| text objects hand over just the lines in view as their page |#
 (defun show-text (textobj)
-  (let* ((i 0) 
-         (ymax (min (tmax-y (textobj 'win)) (- (length (textobj 'lines)) (textobj 'scroll)))))
-    (draw-window-border (textobj 'win))
-    (loop
-     (disp-line (textobj 'win) (nth (+ (textobj 'scroll) i) (textobj 'lines)) i)
-     (incf i)
-     (when (>= i ymax) (return))
-     )
-    ))
+  (let ((i 0) (win (textobj 'win)))
+    (draw-window-border win)
+    (dolist (line (textobj 'page))
+      (disp-line win line i)
+      (incf i))))
 
 (defun show-text-hilite (textobj)
-  (let* ((i 0) 
-         (ymax (min (tmax-y (textobj 'win)) (- (length (textobj 'lines)) (textobj 'scroll)))))
-    (draw-window-border (textobj 'win))
-    (loop
-     (disp-line-hilite (textobj 'win) (nth (+ (textobj 'scroll) i) (textobj 'lines)) i)
-     (incf i)
-     (when (>= i ymax) (return))
-     )))
+  (let ((i 0) (win (textobj 'win)))
+    (draw-window-border win)
+    (dolist (line (textobj 'page))
+      (disp-line-hilite win line i)
+      (incf i))))
 
 (defun show-menu (menuobj &optional (show_selected t))
   (let* ((scroll (menuobj 'scroll)) 
          (i 0) 
-         (ymax (min (tmax-y (menuobj 'win)) (- (length  (menuobj 'opts)) scroll))))
+         (ymax (min (tmax-y (menuobj 'win)) (- (menuobj 'count) scroll))))
     (draw-window-border (menuobj 'win))
     (loop
      (disp-line (menuobj 'win) (princ-to-string (menuobj 'nth-car (+ scroll i))) i  
@@ -208,6 +176,7 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
         (select-car (let ((sel (nth selected opts))) (when sel (car sel))))
         (select-cdr (let ((sel (nth selected opts))) (when sel (cdr sel))))
         (opts opts)
+        (count (length opts))
         (set-opts (setf opts (cadr msgs))
                   (setf scroll 0) (setf selected 0))
         (push-opts (push (cadr msgs) opts )
@@ -221,6 +190,59 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
     ))
 
 
+;;;;; Directory Menu Class
+
+;; a menu over the entries of a directory, which only holds the ones around the visible part,
+;; read from a cached directory stream, so large folders don't fill the workspace
+(defun uos:dir-menu (dir win)
+  (let* ((cursor (dir-open dir t))
+         (count (dir-seek cursor 32767))
+         (scroll 0)
+         (selected 0)
+         (base 0)
+         (page nil)
+         (entry (lambda (i)
+                  (when (and (>= i 0) (< i count))
+                    (unless (and (>= i base) (< i (+ base (length page))))
+                      (setf base (max 0 (- i (tmax-y win))))
+                      (dir-seek cursor base)
+                      (setf page (dir-next cursor (* 3 (tmax-y win)))))
+                    (nth (- i base) page)))))
+    (lambda (&rest msgs)
+      (case (car msgs)
+        (down (when (< selected (- count 1))
+                (incf selected)
+                (setf scroll (max (- selected (tmax-y win) -1) scroll))
+                selected))
+        (up (when (> selected 0)
+              (decf selected)
+              (when (< selected scroll) (setf scroll selected))
+              selected))
+        (scroll scroll)
+        (count count)
+        (nth (funcall entry (cadr msgs)))
+        (nth-car (car (funcall entry (cadr msgs))))
+        (nth-cdr (cdr (funcall entry (cadr msgs))))
+        (selected selected)
+        (select (funcall entry selected))
+        (select-car (car (funcall entry selected)))
+        (select-cdr (cdr (funcall entry selected)))
+        #| reopens the directory, which also picks up any changes to it |#
+        (set-dir (dir-close cursor)
+                 (setf cursor (dir-open (cadr msgs) t) count (dir-seek cursor 32767)
+                       scroll 0 selected 0 base 0 page nil))
+        (close (dir-close cursor))
+        (win win)
+        (set-win (setf win (cadr msgs)))
+        ))
+    ))
+
+#| the classes only use their own variables, so they are compiled to flat closures;
+   the apps below stay interpreted, as they use the variables bound by uos |#
+(compile 'uos:menu)
+(compile 'uos:dir-menu)
+
+
 ;;; Textdisplay Class
 
 (defun wrap-lines (text maxlen) (mapcan (lambda (x) (split-line x maxlen)) text))
@@ -232,6 +254,7 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
     (lambda (&rest msgs)
       (case (car msgs)
         (lines lines)
+        (page (subseq lines scroll (min (length lines) (+ scroll (tmax-y win)))))
         (set-lines (setf lines (wrap-lines (cadr msgs) (tmax-x win))) (setf scroll 0))
         (up (when (> scroll 0) (decf scroll)))
         (down (when (< scroll (length lines) ) (incf scroll)))
@@ -242,6 +265,25 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
         (print (format t "scroll: ~a " scroll))
         ))))
 
+;; the same as a textdisplay, but over a file view, so only the rows on screen are read from the file
+(defun uos:fileview-display (path win)
+  (let ((view (view-open path (tmax-x win)))
+        (scroll 0))
+    (lambda (&rest msgs)
+      (case (car msgs)
+        (page (view-lines view scroll (tmax-y win)))
+        (up (when (> scroll 0) (decf scroll)))
+        (down (when (view-lines view (1+ scroll)) (incf scroll)))
+        (goto (setf scroll (max 0 (min (cadr msgs) (1- (view-length view))))))
+        (scroll scroll)
+        (close (view-close view))
+        (win win)
+        (set-win (setf win (cadr msgs)))
+        ))))
+
+(compile 'uos:textdisplay)
+(compile 'uos:fileview-display)
+
 
 ;
 ;
@@ -272,12 +314,12 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 
 (defun update-doc (doc menu win)
   (doc 'set-lines (get-doc-text (menu 'select-car)))
-  (win 'title (menu 'select-car))
+  (setf (window-title win) (menu 'select-car))
   (show-text doc))
 	
 (defun update-menu (menu win)
   (menu 'set-opts (mapcar (lambda (x) (list x)) (apropos-list search)))
-  (win 'title search)
+  (setf (window-title win) search)
   (show-menu menu))
 
 (defun uos:doc-browser (&optional args (win (uos:window 0 0 SCR-W SCR-H "Function Browser")) )
@@ -308,6 +350,7 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
         (win win)
         (select (string  (menu 'select-car)))
         (title (concatenate 'string "Function Browser " search))
+        (close nil)
         (t (when (printable (code-char lastkey))
              (setf search (concatenate 'string search (string (code-char lastkey))))
              (update-menu menu menu-win)
@@ -329,12 +372,13 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 								(let ((c (char txt x))) 
 									(when (not (or (eq c #\ETX) (eq c #\STX)))
 										(princ c str))))))))))
-          (lines (if path (read-file path) (if text text (list "no file selected"))))
-          (txt (uos:textdisplay lines win))
+          (txt (if path
+                   (uos:fileview-display path win)
+                   (uos:textdisplay (if text text (list "no file selected")) win)))
           )
-    (win 'title (concatenate 'string "TextViewer: " 
+    (setf (window-title win) (concatenate 'string "TextViewer: " 
 								(if path path "") 
-								(when (eq (cadr args) 'symbol) (princ-to-string (car args)))))
+								(if (eq (cadr args) 'symbol) (princ-to-string (car args)) "")))
     (lambda (&rest msgs)
       (case (car msgs)
         (up (txt 'up) (show-text txt))
@@ -342,7 +386,8 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 		(ppage (dotimes (x 5) (txt 'up)) (show-text txt))
         (npage (dotimes (x 5) (txt 'down)) (show-text txt))
         (show (draw-window-border (txt 'win)) (show-text txt))
-        (title (win 'title))
+        (title (window-title win))
+        (close (txt 'close))
         ))))
 
 
@@ -351,95 +396,62 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 ; Text Editor Application
 ;
 
-(defun set-to-eol ()
-  (let ((len (length (nth txtpos-y lines)))) 
-    (when (> txtpos-x len) (setf txtpos-x len))))
-		
-(defun move-window ()
-  (when (> txtpos-x (+ scroll-x (1- (tmax-x win))))
-    (setf scroll-x (- txtpos-x (1- (tmax-x win)))))
-  (when (> txtpos-y (+ scroll-y (1- (tmax-y win))))
-    (setf scroll-y (- txtpos-y (1- (tmax-y win)))))
-  (when (< txtpos-x scroll-x)
-    (setf scroll-x txtpos-x))
-  (when (< txtpos-y scroll-y)
-    (setf scroll-y txtpos-y)))
-
-(defun uos:texteditdisplay (lines win)
-  (let* ((scroll-x 0) 
-		 (scroll-y 0)
-	     (txtpos-x 0) (txtpos-y 0)
-	     (len (length lines))
-	     )
+#| the text lives in a text buffer, so an edit costs the same however long the text is |#
+(defun uos:texteditdisplay (buf win)
+  (let* ((scroll-x 0)
+         (scroll-y 0)
+         (txtpos-x 0) (txtpos-y 0)
+         (cursor (lambda ()
+                   (let ((pos (text-cursor buf)))
+                     (setf txtpos-y (first pos) txtpos-x (second pos))
+                     (when (> txtpos-x (+ scroll-x (1- (tmax-x win))))
+                       (setf scroll-x (- txtpos-x (1- (tmax-x win)))))
+                     (when (> txtpos-y (+ scroll-y (1- (tmax-y win))))
+                       (setf scroll-y (- txtpos-y (1- (tmax-y win)))))
+                     (when (< txtpos-x scroll-x)
+                       (setf scroll-x txtpos-x))
+                     (when (< txtpos-y scroll-y)
+                       (setf scroll-y txtpos-y))))))
     (lambda (&rest msgs)
       (case (car msgs)
-        (lines lines)
-        (up (when (> txtpos-y 0) (decf txtpos-y) (set-to-eol) (move-window) ))
-        (down (when (< txtpos-y (1- len)) (incf txtpos-y) (set-to-eol) (move-window)))
-        (left (cond ((> txtpos-x 0) (decf txtpos-x))
-                    ((> txtpos-y 0)  (decf txtpos-y) (setf txtpos-x  (length (nth txtpos-y lines)))))
-              (move-window))
-        (right (cond ((< txtpos-x (length (nth txtpos-y lines))) (incf txtpos-x)) 
-                     ((< txtpos-y (1- len)) (incf txtpos-y) (setf txtpos-x 0)))
-               (move-window))
+        (buffer buf)
+        (lines (text-lines buf 0 (text-length buf)))
+        (page (text-lines buf scroll-y (tmax-y win) scroll-x (1+ (tmax-x win))))
+        (cursor-char (let ((c (car (text-lines buf txtpos-y 1 txtpos-x 1))))
+                       (if (and c (> (length c) 0)) (char c 0) #\Space)))
+        (up (when (> txtpos-y 0) (text-goto buf (1- txtpos-y) txtpos-x) (funcall cursor)))
+        (down (when (< txtpos-y (1- (text-length buf))) (text-goto buf (1+ txtpos-y) txtpos-x) (funcall cursor)))
+        (left (text-move buf -1) (funcall cursor))
+        (right (text-move buf 1) (funcall cursor))
         (scroll-x scroll-x)
         (scroll-y scroll-y)
         (txtpos-x txtpos-x)
         (txtpos-y txtpos-y)
         (win win)
         (set-win (setf win (cadr msgs)))
-        (enter (let* ((line (nth txtpos-y lines)) 
-                      (firstlines (subseq lines 0 txtpos-y))
-                      (lastlines (subseq lines (1+ txtpos-y))))
-                 (setf lines (append firstlines (list (subseq line 0 txtpos-x) (subseq line txtpos-x)) lastlines)))
-               (setf len (length lines))
-               (setf txtpos-x 0) (incf txtpos-y) 
-               (move-window))
-        (del (let* ((line (nth txtpos-y lines)))
-               (if (> txtpos-x 0)
-                   (progn (setf (nth txtpos-y lines) 
-                                (concatenate 'string (subseq line 0 (1- txtpos-x)) (subseq line txtpos-x)))
-                          (decf txtpos-x))
-                   (when (> txtpos-y 0)
-                     (setf lines (remove-nth txtpos-y lines))
-                     (decf txtpos-y)
-                     (let ((prevline (nth txtpos-y lines)))
-                       (if prevline
-                           (progn (setf (nth txtpos-y lines) (concatenate 'string prevline line))
-                                  (setf txtpos-x (length prevline)))
-                           (progn (setf (nth txtpos-y lines)  line)
-                                  (setf txtpos-x 0))))))
-               (move-window)))
-        (t (let* ((line (nth txtpos-y lines)))
-             (setf (nth txtpos-y lines) 
-                   (concatenate 'string (subseq line 0 txtpos-x) 
-                                (string (car msgs)) (subseq line txtpos-x)))
-             (incf txtpos-x))
-           (move-window))
-					
-        (print (format t "scroll: ~a " scroll))))))
-	
+        (enter (text-insert buf #\Newline) (funcall cursor))
+        (del (text-delete buf) (funcall cursor))
+        (undo (text-undo buf) (funcall cursor))
+        (t (text-insert buf (car msgs)) (funcall cursor))))))
+
+(compile 'uos:texteditdisplay)
+
 (defun show-edittext (textobj)
-  (let* ((ymax (min (tmax-y (textobj 'win)) (- (length (textobj 'lines)) (textobj 'scroll-y)))))
-    (draw-window-border (textobj 'win))
-    (dotimes (i ymax)
-             (let* ((line  (nth (+ (textobj 'scroll-y) i) (textobj 'lines)))
-                    (scroll-x (textobj 'scroll-x)) )
-               (setq line (if (< scroll-x (length line))  (subseq line scroll-x) " "))
-               (disp-line (textobj 'win) line i)))
-    ))
+  (let ((i 0) (win (textobj 'win)))
+    (draw-window-border win)
+    (dolist (line (textobj 'page))
+      (disp-line win line i)
+      (incf i))))
 
 (defun show-cursor (textobj show)
   (let* ( (x (- (textobj 'txtpos-x) (textobj 'scroll-x) ))
           (y  (- (textobj 'txtpos-y) (textobj 'scroll-y) ))
-          (line (nth (textobj 'txtpos-y) (textobj 'lines)))
           (w (textobj 'win)))
-    (set-cursor (+ (w 'in-x) (* x cwidth))  (+ (w 'in-y) (* y leading)))
-    (setf line (if line (concatenate 'string line " ") " "))
+    (set-cursor (+ (window-in-x w) (* x cwidth))  (+ (window-in-y w) (* y leading)))
     (if show 
         (set-text-color code_col cursor_col) 
         (set-text-color code_col bg_col ))
-    (write-text (string (char line (textobj 'txtpos-x))))))
+    (write-text (string (textobj 'cursor-char)))))
 
 
 (defun uos:teditor (&optional (args nil) (win (uos:window 0 0 SCR-W SCR-H "Text Editor")) )
@@ -454,11 +466,10 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 								(let ((c (char txt x))) 
 									(when (not (or (eq c #\ETX) (eq c #\STX)))
 										(princ c str))))))))))
-          (lines (if path (read-file path) (if text text (list " "))))
-          (txt (uos:texteditdisplay lines win))
+          (txt (uos:texteditdisplay (text-open (if path path (if text text (list " ")))) win))
           (edittext-disp (lambda () (show-edittext txt) (show-cursor txt t)))
           )
-    (win 'title (concatenate 'string "Text Editor: " 
+    (setf (window-title win) (concatenate 'string "Text Editor: " 
 					(cond (path path) 
 					((eq (cadr args) 'symbol) (princ-to-string (car args))) 
 					(t ""))))
@@ -474,19 +485,21 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
         (lend (dotimes (x 5) (txt 'right)) (edittext-disp))
         (enter (txt 'enter) (edittext-disp))
         (del (txt 'del) (edittext-disp))
+        (undo (txt 'undo) (edittext-disp))
         (show (draw-window-border (txt 'win)) (edittext-disp))
-        (title (win 'title))
+        (title (window-title win))
         (save (cond
 				(path 
 					(when (eq #\y (display-message (list "Press y to save to " path) t)) 
-						(with-sd-card (str (subseq path 1) 2) #| remove the forward slash on the path |#
-						(dolist (line (txt 'lines)) (princ line str) (terpri str)))))
+						(text-save (txt 'buffer) (subseq path 1)))) #| remove the forward slash on the path |#
 				((eq (cadr args) 'symbol) 
 					(when (eq #\y (display-message (list " Press y to bind to " (string (car args))) t))
 						(eval  (read-from-string (with-output-to-string (str) 
 						(princ "(defvar " str) (princ (car args) str) (princ " " str)  
 						(mapc (lambda (x) (princ x str)) (txt 'lines)) (princ ")" str))))) ))
 			(edittext-disp))
+        #| frees the text buffer when the app is removed |#
+        (close (text-close (txt 'buffer)))
         (t (when (printable (code-char lastkey)) (txt (code-char lastkey)) (edittext-disp)))
         ))))
 
@@ -500,7 +513,7 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 (defun concat-dir (lst) (let ((rev-lst (reverse lst)))  (concat-string-list (cdr rev-lst) "/" (car rev-lst))))
 
 (defun uos:dir-browser (&optional args (win (uos:window 0 0 SCR-W SCR-H "Directory Browser")) )
-  (let* ((menu (uos:menu (map-dir) win)) 
+  (let* ((menu (uos:dir-menu "" win)) 
          (prev (list ""))
          (search "")
          (state t)
@@ -519,15 +532,16 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 						(concatenate 'string (concat-dir prev) "/" search)))
 			  (save nil)
               (appenddata nil))
-            (funcall (menu 'win ) 'title (concat-dir prev))
-            (menu 'set-opts (map-dir (concat-dir prev)) ) 
+            (setf (window-title (menu 'win)) (concat-dir prev))
+            (menu 'set-dir (concat-dir prev)) 
             (setf state t))
            (del (setf search (subseq search 0 (- (length search) 1)))
-                (win 'title (concatenate 'string (string state) ": " search))
+                (setf (window-title win) (concatenate 'string (string state) ": " search))
                 )
+           (close (menu 'close))
            (t (when (printable (code-char lastkey))
                 (setf search (concatenate 'string search (string (code-char lastkey))))
-                (win 'title (concatenate 'string (string state) ": " search))
+                (setf (window-title win) (concatenate 'string (string state) ": " search))
                 ))
            )
          (draw-window-border (menu 'win))
@@ -540,15 +554,15 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
            (down (menu 'down) (show-menu menu) )
            (right (when (and (not (eq nil (menu 'select-car))) (eq nil (menu 'select-cdr))) 
                     (push (menu 'select-car) prev)
-                    (menu 'set-opts (map-dir (concat-dir prev))) 
-                    (funcall (menu 'win ) 'title (concat-dir prev))
+                    (menu 'set-dir (concat-dir prev)) 
+                    (setf (window-title (menu 'win)) (concat-dir prev))
                     #|show-menu does't draw the backgroud for whatever reason so we draw it first |#
                     (draw-window-border (menu 'win))					
                     (show-menu menu)))
            (left (when (not (string= (car prev) "")) 
                    (pop prev) 
-                   (menu 'set-opts (map-dir (concat-dir prev)) ) 
-                   (funcall (menu 'win ) 'title (concat-dir prev))
+                   (menu 'set-dir (concat-dir prev)) 
+                   (setf (window-title (menu 'win)) (concat-dir prev))
                    (draw-window-border (menu 'win))					
                    (show-menu menu)))
            (enter (unless (eq nil (menu 'select-cdr))  
@@ -563,12 +577,13 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
                       (sd-file-remove (concatenate 'string (concat-dir prev) "/" (menu 'select-car))))
                   (display-message (list "Deleted!" "" "Press any key to continue") t)
                   (display-message (list "Didnt delete!" "" "Press any key to continue") t)))
-            (menu 'set-opts (map-dir (concat-dir prev)) ) 
+            (menu 'set-dir (concat-dir prev)) 
             (draw-window-border (menu 'win))					
             (show-menu menu))
            (show (draw-window-border (menu 'win)) (show-menu menu))
            (title "Directory Browser")
            (win win)
+           (close (menu 'close))
            (t (when (printable (code-char lastkey))
                 (let ((c (code-char lastkey)))
                   (cond 
@@ -579,7 +594,7 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 					((eq c #\r) (setf state 'rename))
                     )
                   (setf search "")
-                  (win 'title (concatenate 'string (string state) ": " search))
+                  (setf (window-title win) (concatenate 'string (string state) ": " search))
                   (draw-window-border (menu 'win))
                   (show-menu menu)
                   )))))))))
@@ -616,7 +631,7 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 						(write-byte 11) (princ "set name:") 
 						(setq name (eval 
 							(read-from-string (concatenate 'string "(defvar " (string (read)) ")")))) 
-						(win 'title (concatenate 'string "Edit: " (string name)))))
+						(setf (window-title win) (concatenate 'string "Edit: " (string name)))))
           (%show (lambda ()  
                    (setq cc (append cc (list #\h)))
                    (setq *cmds* cc)
@@ -628,7 +643,7 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
                    (setq cc (butlast cc))))
           )
 		
-    (win 'title (concatenate 'string "Edit: " (string name)))
+    (setf (window-title win) (concatenate 'string "Edit: " (string name)))
 		
     (define-atomic-cmd #\b "back"
       #'(lambda (fun) (pop *cmds*) fun))
@@ -672,7 +687,8 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
         (down (dotimes (x 3) (disp 'down)) (show-text-hilite disp))
         (right (dotimes (x 8) (disp 'down)) (show-text-hilite disp))
         (left (dotimes (x 8) (disp 'up)) (show-text-hilite disp))
-        (title (win 'title))
+        (title (window-title win))
+        (close nil)
         (t (let ((c (code-char lastkey)))
              (when (printable c)
                (cond
@@ -714,6 +730,7 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
           (results-win (uos:window 0 0 100 100 "Results"))
           (results-menu (uos:menu (cons (when results (car results)) nil) results-win))
           (selected-menu app-menu) 
+          (close-apps (lambda () (dolist (app (open-menu 'opts)) (funcall (cdr app) 'close))))
           )
 	
     (windows-split-v app-win container-win .3)
@@ -739,6 +756,8 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
                  (show-menu results-menu) (show-menu app-menu nil) (show-menu open-menu nil))))
 			
         (del (when (or (eq selected-menu open-menu) (eq selected-menu results-menu))
+               #| let a removed app free what it holds, such as a text buffer |#
+               (when (and (eq selected-menu open-menu) (open-menu 'opts)) (funcall (open-menu 'select-cdr) 'close))
                (selected-menu 'set-opts (remove-nth (selected-menu 'selected) (selected-menu 'opts)))
                (when (> window-index (- (length (selected-menu 'opts)) 1)) (decf window-index))
                (show-menu selected-menu)))
@@ -749,7 +768,7 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
                                      (when (results-menu 'opts) (results-menu 'select)))))
 						
               #| EXIT HERE WHEN WE CALL THE EXIT APP |#
-              (when exit (fill-screen) (return (wm 'results)))
+              (when exit (funcall close-apps) (fill-screen) (return (wm 'results)))
 						
               (open-menu 'push-opts (cons (new-app 'title) new-app)))
             (setf window-index 0)
@@ -766,6 +785,7 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
         (current-window current-window)
         (set-current-window (setf (cadr msgs) current-window))
         (show (draw-window-border win) (show-menu results-menu) (show-menu app-menu)  (show-menu open-menu nil))
+        (close (funcall close-apps))
         )
       )
     ))
@@ -782,9 +802,11 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
 		 (current-window wm)
 		 (lastkey nil) (exit nil)
 		 )
+    (gfx-framebuffer t)
     (current-window 'show)
+    (gfx-flush)
     (loop
-     (setf lastkey (keyboard-get-key))
+     (setf lastkey (let ((event (next-event))) (when (eq (first event) 'key) (second event))))
      (when lastkey 
        (case lastkey
          #|get back to window manager menu touchscreen + space|#
@@ -805,10 +827,12 @@ const char LispLibrary[] PROGMEM = R"lisplibrary(
          (203 (current-window 'save))
          (204 (current-window 'load))
          (24 (current-window 'new))
+         (26 (current-window 'undo))
          (t  (current-window lastkey))
          )
+       (gfx-flush)
        )
-     (when exit (fill-screen) (return (wm 'results)))
+     (when exit (wm 'close) (fill-screen) (gfx-framebuffer nil) (return (wm 'results)))
      )
     )))
 
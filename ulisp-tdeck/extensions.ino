@@ -24,7 +24,21 @@ TouchDrvGT911 touch;
 #define TDECK_TRACKBALL_LEFT 1
 #define TDECK_TRACKBALL_RIGHT 2
 
-volatile int ball_val = 0;
+// Input event queue, filled by the trackball interrupts and by pollevents()
+#define EVENTQUEUE 32
+#define KEYPOLL 20                         // ms between keyboard polls if its interrupt doesn't fire
+#define TOUCHHOLD 80                       // ms a touch sample counts as the screen still being touched
+
+enum eventtype { KEYEVENT, TOUCHEVENT };
+typedef struct { uint32_t time; uint8_t type; int16_t a, b; } event_t;
+
+event_t Events[EVENTQUEUE];
+volatile uint8_t EventHead = 0, EventTail = 0;
+portMUX_TYPE EventMux = portMUX_INITIALIZER_UNLOCKED; // Guards the queue, as the interrupts may run on the other core
+volatile bool KeyPending = false, TouchPending = false;
+uint32_t EventsDropped = 0, LastKeyPoll = 0, TouchTime = 0;
+int16_t TouchX = 0, TouchY = 0;
+bool TouchValid = false;
 
 void initTouch(){
   #if defined (touchscreen)
@@ -46,25 +60,62 @@ void initTouch(){
   #endif
 }
 
-void ISR_trackball_up(){
-  if(ball_val == 0){
-    ball_val = 218;
+// Adds an event to the queue, or counts it as dropped if the queue is full; the caller must hold EventMux
+bool pushevent (uint8_t type, int16_t a, int16_t b) {
+  uint8_t next = (EventHead + 1) % EVENTQUEUE;
+  if (next == EventTail) { EventsDropped++; return false; }
+  event_t *e = &Events[EventHead];
+  e->time = millis(); e->type = type; e->a = a; e->b = b;
+  EventHead = next;
+  return true;
+}
+
+// Queues an event from outside an interrupt
+bool queueevent (uint8_t type, int16_t a, int16_t b) {
+  portENTER_CRITICAL(&EventMux);
+  bool queued = pushevent(type, a, b);
+  portEXIT_CRITICAL(&EventMux);
+  return queued;
+}
+
+// Queues a key event from an interrupt
+void isrevent (int16_t key) {
+  portENTER_CRITICAL_ISR(&EventMux);
+  pushevent(KEYEVENT, key, 0);
+  portEXIT_CRITICAL_ISR(&EventMux);
+}
+
+// Removes the oldest event and copies it out, or returns false if the queue is empty;
+// it's copied before the slot is freed, so an interrupt can't overwrite it first
+bool popevent (uint8_t *type, int16_t *a, int16_t *b, uint32_t *time) {
+  portENTER_CRITICAL(&EventMux);
+  bool found = (EventTail != EventHead);
+  if (found) {
+    event_t *e = &Events[EventTail];
+    *type = e->type; *a = e->a; *b = e->b; *time = e->time;
+    EventTail = (EventTail + 1) % EVENTQUEUE;
   }
+  portEXIT_CRITICAL(&EventMux);
+  return found;
+}
+
+void ISR_trackball_up(){
+  isrevent(218);
 }
 void ISR_trackball_down(){
-  if(ball_val == 0){
-    ball_val = 217;
-  }
+  isrevent(217);
 }
 void ISR_trackball_left(){
-  if(ball_val == 0){
-    ball_val = 216;
-  }
+  isrevent(216);
 }
 void ISR_trackball_right (){
-  if(ball_val == 0){
-    ball_val = 215;
-  }
+  isrevent(215);
+}
+void ISR_keyboard () {
+  KeyPending = true;
+}
+void ISR_touch () {
+  TouchPending = true;
 }
 void inittrackball(){
   pinMode(TDECK_TRACKBALL_UP, INPUT_PULLUP);
@@ -77,6 +128,41 @@ void inittrackball(){
   attachInterrupt(digitalPinToInterrupt(TDECK_TRACKBALL_RIGHT), ISR_trackball_right, FALLING);
 }
 
+void initevents () {
+  pinMode(TDECK_KEYBOARD_INT, INPUT);
+  attachInterrupt(digitalPinToInterrupt(TDECK_KEYBOARD_INT), ISR_keyboard, FALLING);
+  #if defined(touchscreen)
+  attachInterrupt(digitalPinToInterrupt(TDECK_TOUCH_INT), ISR_touch, FALLING);
+  #endif
+}
+
+// Reads the touch panel once if it has interrupted since the last sample, and queues a touch event for a new press
+void sampletouch () {
+  #if defined(touchscreen)
+  if (!TouchPending) return;
+  TouchPending = false;
+  int16_t x[5], y[5];
+  if (touch.getPoint(x, y, touch.getSupportTouchPoint()) > 0) {
+    uint32_t now = millis();
+    if (!TouchValid || now - TouchTime >= TOUCHHOLD) queueevent(TOUCHEVENT, x[0], y[0]);
+    TouchX = x[0]; TouchY = y[0]; TouchTime = now; TouchValid = true;
+  }
+  #endif
+}
+
+// Samples the touch panel and keyboard if they have interrupted, or the keyboard if it's due a poll
+void pollevents () {
+  sampletouch();
+  uint32_t now = millis();
+  if (!KeyPending && now - LastKeyPoll < KEYPOLL) return;
+  KeyPending = false; LastKeyPoll = now;
+  Wire1.requestFrom(0x55, 1);
+  if (Wire1.available()) {
+    uint8_t temp = Wire1.read();
+    if (temp != 0 && temp != 255) queueevent(KEYEVENT, (uint8_t)touchKeyModEditor(temp), 0);
+  }
+}
+
 object *fn_get_touch_points (object *args, object *env) {
   #if defined(touchscreen)
   int16_t x[5], y[5];
@@ -98,27 +184,29 @@ object *fn_get_touch_points (object *args, object *env) {
   #endif
 }
 
-bool isScreenTouched(){
-  bool received_touch = false;
-  //clear any previous readings since it buffers those
-  do {
-    int16_t x[5], y[5];
-    uint8_t touched = touch.getPoint(x, y, touch.getSupportTouchPoint());
-  } while(touch.isPressed());
+// Uses the cached touch sample, rather than draining the panel's buffered readings over I2C
+bool isScreenTouched () {
+  sampletouch();
+  return TouchValid && millis() - TouchTime < TOUCHHOLD;
+}
 
-  // touch.ispressed() will trigger like 5 times if you press it once so we have to loop through it and get the touchpoints
-  do {
-    int16_t x[5], y[5];
-    uint8_t touched = touch.getPoint(x, y, touch.getSupportTouchPoint());
-    if (touched > 0) {
-      received_touch = true;
+// The trackball moves by line ends and pages while the screen is touched
+int trackballkey (int key) {
+  if (key >= 215 && key <= 218 && isScreenTouched()) {
+    // ((or 1 210) (se:linestart))
+    // ((or 5 213) (se:lineend))
+    // (211 (se:prevpage))
+    // (214 (se:nextpage))
+    switch(key){
+      case 218: return 211; //up -> prevpage
+      case 217: return 214; //down -> nextpage
+      case 216: return 210; //left -> linestart
+      case 215: return 213; //right -> lineend
     }
-  } while(touch.isPressed());
-
-  return received_touch;
+  }
+  return key;
 }
 
-
 // T-Deck extras
 char touchKeyModEditor(char temp){
   #if defined (touchscreen)
@@ -200,44 +288,73 @@ char touchKeyModEditor(char temp){
 
 object *fn_KeyboardGetKey (object *args, object *env) {
   (void) env, (void) args;
-  Wire1.requestFrom(0x55, 1);
-  if (Wire1.available()){
-    char temp = Wire1.read();
-    if ((temp != 0) && (temp !=255)){
-      temp = touchKeyModEditor(temp);
-      //Serial.println((int)temp);
-      return number(temp);
-    }
-  }
-  if(ball_val != 0){
-    int temp = ball_val;
-    ball_val = 0;
-    if (isScreenTouched()) {
-      // ((or 1 210) (se:linestart))
-      // ((or 5 213) (se:lineend))
-      // (211 (se:prevpage))
-      // (214 (se:nextpage))
-      switch(temp){
-        case 218: temp = 211; break; //up -> prevpage
-        case 217: temp = 214; break; //down -> nextpage
-        case 216: temp = 210; break; //left -> linestart
-        case 215: temp = 213; break; //right -> lineend
-      }
-    }
-    return number(temp);
+  pollevents();
+  uint8_t type; int16_t a, b; uint32_t time;
+  while (popevent(&type, &a, &b, &time)) {
+    if (type == KEYEVENT) return number(trackballkey(a));
   }
   return nil;
 }
 
 /*
   (keyboard-flush)
-  Discard missing key up/down events.
+  Discards any queued input events.
 */
 object *fn_KeyboardFlush (object *args, object *env) {
   (void) args, (void) env;
+  portENTER_CRITICAL(&EventMux);
+  EventTail = EventHead;
+  portEXIT_CRITICAL(&EventMux);
   return nil;
 }
 
+/*
+  (next-event [timeout])
+  Waits up to timeout milliseconds, or indefinitely if it's omitted or nil, for the next input event.
+  Returns (key code time) for a key or trackball movement, (touch x y time) for a touch, or nil on timeout.
+*/
+object *fn_nextevent (object *args, object *env) {
+  (void) env;
+  int timeout = -1;
+  if (args != NULL && first(args) != NULL) timeout = checkinteger(first(args));
+  unsigned long start = millis();
+  uint8_t type; int16_t a, b; uint32_t when;
+  for (;;) {
+    pollevents();
+    if (popevent(&type, &a, &b, &when)) break;
+    if (timeout >= 0 && millis() - start >= (unsigned long)timeout) return nil;
+    testescape();
+    delay(1);
+  }
+  char buffer[6];
+  object *time = number(when);
+  protect(time);
+  object *result;
+  if (type == KEYEVENT) {
+    result = cons(number(trackballkey(a)), cons(time, NULL));
+    strcpy(buffer, "key");
+  } else {
+    result = cons(number(a), cons(number(b), cons(time, NULL)));
+    strcpy(buffer, "touch");
+  }
+  unprotect();
+  return cons(bufsymbol(buffer), result);
+}
+
+/*
+  (post-event code)
+  (post-event x y)
+  Queues a key event, or a touch event at x, y, as if it came from the hardware.
+  Returns t, or nil if the queue is full and the event was dropped.
+*/
+object *fn_postevent (object *args, object *env) {
+  (void) env;
+  bool queued;
+  if (cdr(args) == NULL) queued = queueevent(KEYEVENT, checkinteger(first(args)), 0);
+  else queued = queueevent(TOUCHEVENT, checkinteger(first(args)), checkinteger(second(args)));
+  return queued ? tee : nil;
+}
+
 
 
 object *fn_searchstr (object *args, object *env) {
@@ -252,14 +369,9 @@ object *fn_searchstr (object *args, object *env) {
   if (args != NULL) startpos = checkinteger(car(args));
   
 if (stringp(pattern) && stringp(target)) {
-    int l = stringlength(target);
-    int m = stringlength(pattern);
-    if (startpos > l) error2(indexrange);
-    for (int i = startpos; i <= l-m; i++) {
-      int j = 0;
-      while (j < m && nthchar(target, i+j) == nthchar(pattern, j)) j++;
-      if (j == m) return number(i);
-    }
+    if (startpos < 0 || startpos > stringlength(target)) error2(indexrange);
+    int i = searchstring(pattern, target, startpos);
+    if (i >= 0) return number(i);
     return nil;
   } else error2("arguments are not both lists or strings");
   return nil;
@@ -274,7 +386,7 @@ object *fn_searchn (object *args, object *env) {
   if (cddr(args) != NULL){ 
     object *num = third(args);
     if(integerp(num)){
-      matches = num->integer;
+      matches = intval(num);
     }
   }
   if (pattern == NULL) return number(0);
@@ -301,17 +413,13 @@ object *fn_searchn (object *args, object *env) {
     }
     return nil;
   } else if (stringp(pattern) && stringp(target)) {
-    int l = stringlength(target);
-    int m = stringlength(pattern);
-    for (int i = 0; i <= l-m; i++) {
-      int j = 0;
-      while (j < m && nthchar(target, i+j) == nthchar(pattern, j)) j++;
-      if (j == m){ 
-        last_index = i;
-        if(matches-- == 0){
-          return number(i);
-        }
+    int i = searchstring(pattern, target, 0);
+    while (i >= 0) {
+      last_index = i;
+      if(matches-- == 0){
+        return number(i);
       }
+      i = searchstring(pattern, target, i+1);
     }
     if(last_index > 0){
       return number(last_index);
@@ -321,6 +429,542 @@ object *fn_searchn (object *args, object *env) {
   return nil;
 }
 
+/*
+  (gc-pauses [clear])
+  Returns the GC pause histogram as a list of counts, and clears it if clear is t.
+*/
+object *fn_gcpauses (object *args, object *env) {
+  (void) env;
+  object *result = NULL;
+  for (int b=PAUSEBUCKETS-1; b>=0; b--) push(number(PauseCounts[b]), result);
+  if (args != NULL && first(args) != NULL) {
+    for (int b=0; b<PAUSEBUCKETS; b++) PauseCounts[b] = 0;
+  }
+  return result;
+}
+
+/*
+  (compile symbol [function])
+  Compiles the function named by symbol to bytecode in place, or compiles function, returning it if symbol is nil.
+*/
+object *fn_compile (object *args, object *env) {
+  (void) env;
+  object *name = first(args);
+  if (name != NULL && !symbolp(name)) error(notasymbol, name);
+  object *pair = NULL, *function;
+  if (cdr(args) != NULL) function = second(args);
+  else {
+    if (name == NULL) error2(toofewargs);
+    pair = globalpair(name->name);
+    if (pair == NULL) error("undefined", name);
+    function = cdr(pair);
+  }
+  if (bytecodep(function)) return (name != NULL) ? name : function;
+  if (consp(function) && isbuiltin(car(function), CLOSURE)) error("can't compile a closure", function);
+  if (!consp(function) || !isbuiltin(car(function), LAMBDA) || cdr(function) == NULL) error("not a lambda", function);
+  object *bytecode = compilelambda(name, function, NULL);
+  if (name == NULL) return bytecode;
+  if (pair == NULL) pair = globalpair(name->name);
+  if (pair != NULL) cdr(pair) = bytecode;
+  else { push(cons(name, bytecode), GlobalEnv); addglobal(car(GlobalEnv)); }
+  return name;
+}
+
+/*
+  (make-hash-table [:test test])
+  Returns an empty hash table comparing keys with eq, or with equal if test is equal or string=.
+*/
+object *fn_makehashtable (object *args, object *env) {
+  object *test = testargument(args);
+  bool equalp = false;
+  intptr_t fn = (symbolp(test) && builtinp(test->name)) ? lookupfn(builtin(test->name)) : 0;
+  if (fn == (intptr_t)fn_equal || fn == (intptr_t)fn_stringeq) equalp = true;
+  else if (fn != (intptr_t)fn_eq) error("unsupported test", test);
+  return makehashtable(equalp, env);
+}
+
+/*
+  (gethash key hash-table [default])
+  Returns the value stored under key in hash-table, or default if there isn't one.
+*/
+object *fn_gethash (object *args, object *env) {
+  (void) env;
+  object *entry = hashentry(second(args), first(args));
+  if (entry != NULL) return cdr(entry);
+  return (cddr(args) != NULL) ? third(args) : nil;
+}
+
+/*
+  (remhash key hash-table)
+  Removes the entry for key from hash-table, returning t if there was one.
+*/
+object *fn_remhash (object *args, object *env) {
+  (void) env;
+  return remhash(second(args), first(args)) ? tee : nil;
+}
+
+/*
+  (maphash function hash-table)
+  Calls function on the key and value of each entry in hash-table.
+*/
+object *fn_maphash (object *args, object *env) {
+  object *function = first(args);
+  object *run = hashrun(second(args));
+  protect(run);
+  unsigned int slots = 1<<(fixnumvalue(car(run))>>2);
+  for (unsigned int i=0; i<slots; i++) {
+    object *entry = car(run+3+i);
+    if (entry != NULL && entry != TOMBSTONE) apply(function, cons(car(entry), cons(cdr(entry), NULL)), env);
+  }
+  unprotect();
+  return nil;
+}
+
+/*
+  (hash-table-count hash-table)
+  Returns the number of entries in hash-table.
+*/
+object *fn_hashtablecount (object *args, object *env) {
+  (void) env;
+  return number(fixnumvalue(car(hashrun(first(args))+1)));
+}
+
+// Returns the symbol prefix+name+suffix, followed by slot unless it's NULL
+object *structsymbol (const char *prefix, object *name, const char *suffix, object *slot) {
+  char buffer[64];
+  strcpy(buffer, prefix);
+  int n = strlen(buffer);
+  cstring(princtostring(name), &buffer[n], 64-n);
+  n = strlen(buffer);
+  if (n + strlen(suffix) >= 64) error2("no room for string");
+  strcpy(&buffer[n], suffix);
+  n = strlen(buffer);
+  if (slot != NULL) cstring(princtostring(slot), &buffer[n], 64-n);
+  return bufsymbol(buffer);
+}
+
+void structdefine (object *var, object *val) {
+  object *pair = globalpair(var->name);
+  if (pair != NULL) cdr(pair) = val;
+  else { protect(val); push(cons(var, val), GlobalEnv); addglobal(car(GlobalEnv)); unprotect(); }
+}
+
+/*
+  (defstruct name slot*)
+  Defines a structure type with the given slots, each a symbol or a list of a symbol and a default form.
+  Defines the constructor make-name, the predicate name-p, and an accessor name-slot for each slot.
+*/
+object *sp_defstruct (object *args, object *env) {
+  (void) env;
+  object *name = first(args);
+  if (!symbolp(name)) error(notasymbol, name);
+  object *desc = cons(name, NULL);
+  protect(desc);
+  object *tail = desc;
+  for (object *slots = cdr(args); slots != NULL; slots = cdr(slots)) {
+    object *slot = first(slots), *init = nil;
+    if (consp(slot)) { init = (cdr(slot) != NULL) ? second(slot) : nil; slot = first(slot); }
+    if (!symbolp(slot)) error(notasymbol, slot);
+    object *keyword = structsymbol(":", slot, "", NULL);
+    cdr(tail) = cons(cons(slot, cons(keyword, init)), NULL);
+    tail = cdr(tail);
+  }
+  object *var = structsymbol("make-", name, "", NULL);
+  structdefine(var, recordfn(var, OPRECORD, 0, desc, true));
+  var = structsymbol("", name, "-p", NULL);
+  structdefine(var, recordfn(var, OPRECORDP, 0, desc, false));
+  int index = 0;
+  for (object *slots = cdr(desc); slots != NULL; slots = cdr(slots)) {
+    var = structsymbol("", name, "-", first(first(slots)));
+    structdefine(var, recordfn(var, OPSLOT, index++, desc, false));
+  }
+  unprotect();
+  return name;
+}
+
+// Typed array kernels - plain loops over each element type, which the compiler can unroll
+
+object *checktyped (object *array) {
+  if (!typedarrayp(array)) error("argument is not a typed array", array);
+  return array;
+}
+
+// Reads optional start and end arguments, defaulting to the whole sequence
+void sequencerange (int length, object *args, int *start, int *end) {
+  *start = 0; *end = length;
+  if (args != NULL) { *start = checkinteger(first(args)); args = cdr(args); }
+  if (args != NULL) *end = checkinteger(first(args));
+  if (*start < 0 || *end > length || *start > *end) error2(indexrange);
+}
+
+void typedrange (object *array, object *args, int *start, int *end) {
+  sequencerange(typedlength(array), args, start, end);
+}
+
+#define RANGELOOP(T) { \
+  const T *p = (const T *)typeddata(array); \
+  for (int i=start; i<end; i++) { sum = sum + p[i]; if (p[i] < lo) lo = p[i]; if (p[i] > hi) hi = p[i]; } }
+
+// Sums the elements from start below end if op is 0, or returns their minimum if op is 1 or maximum if op is 2
+object *typedreduce (object *args, int op) {
+  object *array = checktyped(first(args));
+  int start, end;
+  typedrange(array, cdr(args), &start, &end);
+  if (start == end) return (op == 0) ? number(0) : nil;
+  if (typedelement(array) == SINGLEFLOAT) {
+    float sum = 0, lo = INFINITY, hi = -INFINITY;
+    RANGELOOP(float);
+    return makefloat((op == 0) ? sum : (op == 1) ? lo : hi);
+  }
+  int64_t sum = 0;
+  int32_t lo = INT_MAX, hi = INT_MIN;
+  switch (typedelement(array)) {
+    case UBYTE8: RANGELOOP(uint8_t); break;
+    case SBYTE16: RANGELOOP(int16_t); break;
+    case UBYTE16: RANGELOOP(uint16_t); break;
+    default: RANGELOOP(int32_t);
+  }
+  if (op == 1) return number(lo);
+  if (op == 2) return number(hi);
+  return (sum >= INT_MIN && sum <= INT_MAX) ? number(sum) : makefloat(sum);
+}
+
+#define MAPLOOP(T, W, LO, HI) { \
+  T *r = (T *)typeddata(result); \
+  const T *p = (const T *)typeddata(first(arrays)), *q = (const T *)typeddata(second(arrays)); \
+  for (int i=0; i<n; i++) { \
+    W x = p[i], y = q[i]; \
+    W v = (op == 0) ? x + y : (op == 1) ? x - y : (op == 2) ? x * y : (op == 3) ? max(x, y) : min(x, y); \
+    if (v < LO || v > HI) error2("result doesn't fit array element type"); \
+    r[i] = v; \
+  } }
+
+// Returns the kernel for a builtin map-into can apply to whole arrays, or -1
+int mapop (object *function) {
+  if (!symbolp(function) || !builtinp(function->name)) return -1;
+  intptr_t fn = lookupfn(builtin(function->name));
+  const intptr_t ops[] = { (intptr_t)fn_add, (intptr_t)fn_subtract, (intptr_t)fn_multiply, (intptr_t)fn_maxfn, (intptr_t)fn_minfn };
+  for (int op=0; op<5; op++) if (fn == ops[op]) return op;
+  return -1;
+}
+
+/*
+  (fill array value [start end])
+  Sets the elements of the typed array from start below end to value, and returns the array.
+*/
+object *fn_fill (object *args, object *env) {
+  (void) env;
+  object *array = checktyped(first(args));
+  int start, end;
+  typedrange(array, cddr(args), &start, &end);
+  fillelements(array, start, end, second(args));
+  return array;
+}
+
+/*
+  (replace array1 array2 [start1 start2])
+  Copies elements of the typed array array2 from start2 into array1 from start1, and returns array1.
+*/
+object *fn_replace (object *args, object *env) {
+  (void) env;
+  object *dest = checktyped(first(args)), *src = checktyped(second(args));
+  int start1 = 0, start2 = 0;
+  args = cddr(args);
+  if (args != NULL) { start1 = checkinteger(first(args)); args = cdr(args); }
+  if (args != NULL) start2 = checkinteger(first(args));
+  int length1 = typedlength(dest), length2 = typedlength(src);
+  if (start1 < 0 || start1 > length1 || start2 < 0 || start2 > length2) error2(indexrange);
+  int n = min(length1 - start1, length2 - start2), etype = typedelement(dest);
+  if (typedelement(src) == etype) {
+    int size = ElementSize[etype];
+    memmove((uint8_t *)typeddata(dest) + start1*size, (uint8_t *)typeddata(src) + start2*size, n*size);
+  } else {
+    for (int i=0; i<n; i++) settypedref(dest, start1+i, typedref(src, start2+i));
+  }
+  return dest;
+}
+
+/*
+  (map-into array function array*)
+  Sets each element of the typed array to function applied to the corresponding elements of the other arrays.
+*/
+object *fn_mapinto (object *args, object *env) {
+  object *result = checktyped(first(args)), *function = second(args), *arrays = cddr(args);
+  int n = typedlength(result), etype = typedelement(result);
+  for (object *a = arrays; a != NULL; a = cdr(a)) n = min(n, typedlength(checktyped(car(a))));
+  int op = mapop(function);
+  if (op >= 0 && arrays != NULL && cdr(arrays) != NULL && cddr(arrays) == NULL
+    && typedelement(first(arrays)) == etype && typedelement(second(arrays)) == etype) {
+    switch (etype) {
+      case UBYTE8: MAPLOOP(uint8_t, int32_t, 0, 255); break;
+      case SBYTE16: MAPLOOP(int16_t, int32_t, -32768, 32767); break;
+      case UBYTE16: MAPLOOP(uint16_t, int32_t, 0, 65535); break;
+      case SBYTE32: MAPLOOP(int32_t, int64_t, INT_MIN, INT_MAX); break;
+      default: MAPLOOP(float, float, -INFINITY, INFINITY);
+    }
+    return result;
+  }
+  for (int i=0; i<n; i++) {
+    object *head = cons(NULL, NULL), *tail = head;
+    protect(head);
+    for (object *a = arrays; a != NULL; a = cdr(a)) {
+      cdr(tail) = cons(typedref(car(a), i), NULL);
+      tail = cdr(tail);
+    }
+    settypedref(result, i, apply(function, cdr(head), env));
+    unprotect();
+  }
+  return result;
+}
+
+/*
+  (array-sum array [start end])
+  Returns the sum of the elements of the typed array from start below end.
+*/
+object *fn_arraysum (object *args, object *env) {
+  (void) env;
+  return typedreduce(args, 0);
+}
+
+/*
+  (array-min array [start end])
+  Returns the smallest element of the typed array from start below end, or nil if there are none.
+*/
+object *fn_arraymin (object *args, object *env) {
+  (void) env;
+  return typedreduce(args, 1);
+}
+
+/*
+  (array-max array [start end])
+  Returns the largest element of the typed array from start below end, or nil if there are none.
+*/
+object *fn_arraymax (object *args, object *env) {
+  (void) env;
+  return typedreduce(args, 2);
+}
+
+// Checks for the sequences read-sequence and write-sequence work on, apart from strings
+uint8_t *checkbytes (object *seq) {
+  if (!typedarrayp(seq) || typedelement(seq) != UBYTE8) error("argument is not a string or (unsigned-byte 8) array", seq);
+  return (uint8_t *)typeddata(seq);
+}
+
+/*
+  (read-sequence sequence stream [start end])
+  Reads bytes from stream into the string or (unsigned-byte 8) array from start below end,
+  and returns the index of the first element it didn't fill, which is less than end at the end of the file.
+*/
+object *fn_readsequence (object *args, object *env) {
+  (void) env;
+  object *seq = first(args);
+  gfun_t gfun = gstreamfun(cdr(args));
+  int start, end;
+  if (stringp(seq)) {
+    sequencerange(stringlength(seq), cddr(args), &start, &end);
+    int index = 0;
+    for (object *cell = cdr(seq); cell != NULL && index < end; cell = car(cell)) {
+      chars_t chars = cell->chars;
+      for (int i=(sizeof(int)-1)*8; i>=0 && index < end; i=i-8) {
+        if ((chars>>i & 0xFF) == 0) continue;
+        if (index++ < start) continue;
+        int c = gfun();
+        if (c == -1) { cell->chars = chars; return number(index - 1); }
+        if (c == 0) c = ' '; // A zero byte would end the cell's characters early
+        chars = (chars & ~((chars_t)0xFF<<i)) | (chars_t)c<<i;
+      }
+      cell->chars = chars;
+    }
+    return number(end);
+  }
+  uint8_t *data = checkbytes(seq);
+  sequencerange(typedlength(seq), cddr(args), &start, &end);
+  #if defined(sdcardsupport)
+  if (gfun == (gfun_t)SDread) return number(start + SDreadbytes(data + start, end - start));
+  #endif
+  for (int i=start; i<end; i++) {
+    int c = gfun();
+    if (c == -1) return number(i);
+    data[i] = c;
+  }
+  return number(end);
+}
+
+/*
+  (write-sequence sequence [stream start end])
+  Writes the characters of the string, or bytes of the (unsigned-byte 8) array, from start below end to stream,
+  and returns the sequence.
+*/
+object *fn_writesequence (object *args, object *env) {
+  (void) env;
+  object *seq = first(args);
+  pfun_t pfun = pstreamfun(cdr(args));
+  int start, end;
+  if (stringp(seq)) {
+    sequencerange(stringlength(seq), (cdr(args) != NULL) ? cddr(args) : NULL, &start, &end);
+    int index = 0;
+    for (object *cell = cdr(seq); cell != NULL && index < end; cell = car(cell)) {
+      chars_t chars = cell->chars;
+      for (int i=(sizeof(int)-1)*8; i>=0; i=i-8) {
+        char c = chars>>i & 0xFF;
+        if (c == 0) continue;
+        if (index >= start && index < end) pfun(c);
+        index++;
+      }
+    }
+    return seq;
+  }
+  uint8_t *data = checkbytes(seq);
+  sequencerange(typedlength(seq), (cdr(args) != NULL) ? cddr(args) : NULL, &start, &end);
+  #if defined(sdcardsupport)
+  if (pfun == (pfun_t)SDwrite) { SDwritebytes(data + start, end - start); return seq; }
+  #endif
+  for (int i=start; i<end; i++) pfun(data[i]);
+  return seq;
+}
+
+// pushImage isn't virtual, so a sprite target has to be called directly
+void gfxpushimage (int x, int y, int w, int h, uint16_t *data) {
+  if (Gfx == &Frame) Frame.pushImage(x, y, w, h, data); else tft.pushImage(x, y, w, h, data);
+  gfxdirty(x, y, w, h);
+}
+
+/*
+  (draw-image x y width array [palette])
+  Draws the typed array as rows of width pixels with the top left at x, y.
+  A (unsigned-byte 16) array holds colours; an (unsigned-byte 8) array holds indexes into the palette.
+*/
+object *fn_drawimage (object *args, object *env) {
+  (void) env;
+  #if defined(gfxsupport)
+  int x = checkinteger(first(args)), y = checkinteger(second(args)), w = checkinteger(third(args));
+  args = cdr(cddr(args));
+  object *array = checktyped(first(args)), *palette = (cdr(args) != NULL) ? checktyped(second(args)) : NULL;
+  if (w <= 0) error("width must be positive", third(args));
+  int h = typedlength(array) / w;
+  if (typedelement(array) == UBYTE16 && palette == NULL) {
+    bool swap = Gfx->getSwapBytes();
+    Gfx->setSwapBytes(true);
+    gfxpushimage(x, y, w, h, (uint16_t *)typeddata(array));
+    Gfx->setSwapBytes(swap);
+  } else if (typedelement(array) == UBYTE8 && palette != NULL && typedelement(palette) == UBYTE16) {
+    const uint8_t *pixels = (const uint8_t *)typeddata(array);
+    const uint16_t *colours = (const uint16_t *)typeddata(palette);
+    int ncolours = typedlength(palette);
+    uint16_t line[64];
+    bool swap = Gfx->getSwapBytes();
+    Gfx->setSwapBytes(true);
+    for (int row=0; row<h; row++) {
+      for (int col=0; col<w; col=col+64) {
+        int n = min(64, w - col);
+        for (int i=0; i<n; i++) {
+          uint8_t c = pixels[row*w + col + i];
+          line[i] = (c < ncolours) ? colours[c] : 0;
+        }
+        gfxpushimage(x + col, y + row, n, 1, line);
+      }
+    }
+    Gfx->setSwapBytes(swap);
+  } else error2("needs an (unsigned-byte 16) array, or an (unsigned-byte 8) array and palette");
+  #else
+  (void) args;
+  #endif
+  return nil;
+}
+
+// One line of glyphs, rendered in memory so draw-text-run can send it to the display as a single window
+TFT_eSprite Span = TFT_eSprite(&tft);
+
+/*
+  (draw-text-run x y string [fg bg hilite start end])
+  Draws the characters of string from start below end on one line with the top left at x, y, and returns the x after them.
+  STX and ETX switch to and from the hilite background, and characters with the top bit set draw as a hilited space.
+*/
+object *fn_drawtextrun (object *args, object *env) {
+  (void) env;
+  #if defined(gfxsupport)
+  int x = checkinteger(first(args)), y = checkinteger(second(args));
+  object *string = checkstring(third(args));
+  uint16_t fg = COLOR_WHITE, bg = COLOR_BLACK, hfg = COLOR_BLACK, hbg = COLOR_WHITE;
+  int start = 0, end = -1;
+  args = cdr(cddr(args));
+  if (args != NULL) { fg = checkinteger(first(args)); hbg = fg; args = cdr(args); }
+  if (args != NULL) { bg = checkinteger(first(args)); hfg = bg; args = cdr(args); }
+  if (args != NULL) { if (first(args) != NULL) { hfg = fg; hbg = checkinteger(first(args)); } args = cdr(args); }
+  if (args != NULL) { start = checkinteger(first(args)); args = cdr(args); }
+  if (args != NULL) { if (first(args) != NULL) end = checkinteger(first(args)); args = cdr(args); }
+  if (args != NULL) error2(toomanyargs);
+  // Collect the glyphs that fit on the screen, with a hilite flag in the top bit
+  int cw = 6*Textsize, ch = 8*Textsize, n = 0, index = 0;
+  int limit = min(Columns, (320 - x)/cw);
+  bool hilite = false;
+  uint8_t glyphs[Columns];
+  for (object *form = cdr(string); form != NULL && n < limit; form = car(form)) {
+    int chars = form->integer;
+    for (int i=(sizeof(int)-1)*8; i>=0 && n < limit; i=i-8) {
+      uint8_t c = chars>>i & 0xFF;
+      if (c == 0) continue;
+      if (index++ < start) continue;
+      if (end >= 0 && index > end) { form = NULL; break; }
+      if (c == STX) hilite = true;
+      else if (c == ETX) hilite = false;
+      else if (c & 0x80) glyphs[n++] = ' ' | 0x80;
+      else glyphs[n++] = c | (hilite ? 0x80 : 0);
+    }
+    if (form == NULL) break;
+  }
+  if (n == 0) return number(x);
+  // Draw straight into the framebuffer, or into Span and push that in one go
+  TFT_eSPI *target = Gfx;
+  int ox = x, oy = y;
+  if (Gfx == &tft) {
+    Span.setColorDepth(16);
+    if (Span.createSprite(n*cw, ch) != NULL) { target = &Span; ox = 0; oy = 0; }
+  }
+  for (int i=0; i<n; i++) {
+    uint8_t c = glyphs[i];
+    if (c & 0x80) target->drawChar(ox + i*cw, oy, c & 0x7F, hfg, hbg, Textsize);
+    else target->drawChar(ox + i*cw, oy, c, fg, bg, Textsize);
+  }
+  if (target == &Span) {
+    Span.pushSprite(x, y);
+    Span.deleteSprite();
+  } else gfxdirty(x, y, n*cw, ch);
+  return number(x + n*cw);
+  #else
+  (void) args;
+  return nil;
+  #endif
+}
+
+/*
+  (gfx-framebuffer on)
+  If on is true, graphics and the terminal draw into an off-screen framebuffer that gfx-flush copies to the display.
+  Returns nil if there isn't enough memory for the framebuffer. If on is nil, flushes and draws to the display again.
+*/
+object *fn_gfxframebuffer (object *args, object *env) {
+  (void) env;
+  #if defined(gfxsupport)
+  return gfxframebuffer(first(args) != NULL) ? tee : nil;
+  #else
+  (void) args;
+  return nil;
+  #endif
+}
+
+/*
+  (gfx-flush)
+  Copies the parts of the framebuffer drawn since the last flush to the display.
+  The REPL flushes automatically while it waits for a key.
+*/
+object *fn_gfxflush (object *args, object *env) {
+  (void) args, (void) env;
+  #if defined(gfxsupport)
+  gfxflush();
+  #endif
+  return nil;
+}
+
 #if defined sdcardsupport
 /*
   (sd-file-exists filename)
@@ -357,6 +1001,7 @@ object *fn_SDFileRemove (object *args, object *env) {
 
   if (SD.exists(fnbuf)) {
     SD.remove(fnbuf);
+    dircacheclear();
     return tee;
   }
   else {
@@ -377,6 +1022,7 @@ object *fn_SDmkdir (object *args, object *env) {
   cstring(first(args), fnbuf, slength);
 
   if (SD.mkdir(fnbuf)) {
+    dircacheclear();
     return tee;
   }
   else {
@@ -395,6 +1041,7 @@ object *fn_SDrmdir (object *args, object *env) {
   cstring(first(args), fnbuf, slength);
 
   if (SD.rmdir(fnbuf)) {
+    dircacheclear();
     return tee;
   }
   else {
@@ -443,6 +1090,839 @@ object *fn_directory2(object *args, object *env) {
   return cdr(result);
 }
 
+// File views - read the rows of a text file by number, without reading the whole file
+
+#define FILEVIEWS 4
+#define VIEWINDEX 256
+#define VIEWBUFFER 256
+#define VIEWROW 255
+
+// A row is a line of the file, or a piece of one if it's longer than the view's width. The index holds the
+// offset of every stride'th row scanned so far; when it fills up the stride doubles and every other entry is
+// dropped, so its size doesn't depend on the length of the file
+struct {
+  char path[BUFFERSIZE*4];
+  File file;
+  int width, stride, entries, rows;
+  uint32_t scanned, index[VIEWINDEX];
+  uint8_t buffer[VIEWBUFFER];
+  uint32_t start;
+  int length;
+  bool complete, stale, open;
+  uint8_t generation;
+  uint32_t used;
+} FileView[FILEVIEWS];
+
+uint32_t ViewTick = 0;
+
+// Returns the byte at offset in the view's file, or -1 past the end
+int viewbyte (int i, uint32_t offset) {
+  if (offset < FileView[i].start || offset >= FileView[i].start + FileView[i].length) {
+    FileView[i].file.seek(offset);
+    FileView[i].start = offset;
+    int length = FileView[i].file.read(FileView[i].buffer, VIEWBUFFER);
+    FileView[i].length = (length > 0) ? length : 0;
+    if (length <= 0) return -1;
+  }
+  return FileView[i].buffer[offset - FileView[i].start];
+}
+
+// Reads the row starting at *pos into row, if it's not NULL, and moves *pos to the next row;
+// returns the length of the row, or -1 at the end of the file
+int viewrow (int i, uint32_t *pos, char *row) {
+  int width = FileView[i].width, n = 0, c = viewbyte(i, *pos);
+  if (c == -1) return -1;
+  while (c != -1 && c != '\n' && n < width) {
+    if (c != '\r') { if (row != NULL) row[n] = c; n++; }
+    c = viewbyte(i, ++*pos);
+  }
+  while (c == '\r') c = viewbyte(i, ++*pos);
+  if (c == '\n') (*pos)++;
+  return n;
+}
+
+void viewreset (int i) {
+  FileView[i].stride = 16; FileView[i].entries = 0; FileView[i].rows = 0;
+  FileView[i].scanned = 0; FileView[i].start = 0; FileView[i].length = 0;
+  FileView[i].complete = false; FileView[i].stale = false;
+}
+
+// Indexes the file up to the given row, or to the end, and returns the offset of that row or -1 if there isn't one
+int32_t viewfind (int i, int row) {
+  if (FileView[i].stale) {
+    FileView[i].file.close();
+    FileView[i].file = SD.open(FileView[i].path);
+    viewreset(i);
+  }
+  while (!FileView[i].complete && FileView[i].rows <= row) {
+    uint32_t pos = FileView[i].scanned;
+    if (viewrow(i, &pos, NULL) == -1) { FileView[i].complete = true; break; }
+    if (FileView[i].rows % FileView[i].stride == 0) {
+      if (FileView[i].entries == VIEWINDEX) {
+        for (int k=0; k<VIEWINDEX/2; k++) FileView[i].index[k] = FileView[i].index[k*2];
+        FileView[i].entries = VIEWINDEX/2; FileView[i].stride = FileView[i].stride*2;
+      }
+      FileView[i].index[FileView[i].entries++] = FileView[i].scanned;
+    }
+    FileView[i].scanned = pos;
+    FileView[i].rows++;
+  }
+  if (row >= FileView[i].rows) return -1;
+  int k = row / FileView[i].stride;
+  uint32_t pos = FileView[i].index[k];
+  for (int r = k*FileView[i].stride; r < row; r++) viewrow(i, &pos, NULL);
+  return pos;
+}
+
+// Returns the index of the file view in a view stream, checking it's still open
+int checkview (object *arg) {
+  int address = isstream(arg);
+  int i = address & (FILEVIEWS-1);
+  if (address>>8 != VIEWSTREAM || !FileView[i].open || FileView[i].generation != (address & 0xFF)/FILEVIEWS)
+    error("not an open file view", arg);
+  FileView[i].used = ++ViewTick;
+  return i;
+}
+
+/*
+  (view-open filename [width])
+  Opens a text file on the SD card and returns a view stream for reading its rows by number.
+  Lines longer than width, or 255, are split into several rows.
+*/
+object *fn_viewopen (object *args, object *env) {
+  (void) env;
+  SDBegin();
+  int i = 0;
+  for (int j=0; j<FILEVIEWS; j++) {
+    if (!FileView[j].open) { i = j; break; }
+    if (FileView[j].used < FileView[i].used) i = j;
+  }
+  // Reuse the least recently used view if they're all open; its stream stops working
+  if (FileView[i].open) FileView[i].file.close();
+  FileView[i].open = false;
+  MakeFilename(checkstring(first(args)), FileView[i].path);
+  int width = VIEWROW;
+  if (cdr(args) != NULL) {
+    width = checkinteger(second(args));
+    if (width < 1 || width > VIEWROW) error("width out of range", second(args));
+  }
+  FileView[i].file = SD.open(FileView[i].path);
+  if (!FileView[i].file || FileView[i].file.isDirectory()) {
+    FileView[i].file.close();
+    error2("problem reading from SD card or invalid filename");
+  }
+  FileView[i].width = width;
+  viewreset(i);
+  FileView[i].open = true;
+  FileView[i].generation = (FileView[i].generation + 1) % (256/FILEVIEWS);
+  FileView[i].used = ++ViewTick;
+  return stream(VIEWSTREAM, FileView[i].generation*FILEVIEWS + i);
+}
+
+/*
+  (view-lines stream start [n])
+  Returns a list of up to n rows, default 1, from the file view starting at row start.
+  The list is shorter, or empty, at the end of the file.
+*/
+object *fn_viewlines (object *args, object *env) {
+  (void) env;
+  int i = checkview(first(args));
+  int start = checkinteger(second(args));
+  if (start < 0) error(indexnegative, second(args));
+  int n = (cddr(args) != NULL) ? checkinteger(third(args)) : 1;
+  int32_t pos = viewfind(i, start);
+  object *result = cons(NULL, NULL);
+  protect(result);
+  object *ptr = result;
+  char row[VIEWROW];
+  uint32_t p = pos;
+  while (pos != -1 && n-- > 0) {
+    int length = viewrow(i, &p, row);
+    if (length == -1) break;
+    object *string = newstring(), *tail = string;
+    buildchars((uint8_t *)row, length, &tail);
+    cdr(ptr) = cons(string, NULL);
+    ptr = cdr(ptr);
+  }
+  unprotect();
+  return cdr(result);
+}
+
+/*
+  (view-length stream)
+  Returns the number of rows in the file view, reading to the end of the file the first time.
+*/
+object *fn_viewlength (object *args, object *env) {
+  (void) env;
+  int i = checkview(first(args));
+  viewfind(i, INT_MAX);
+  return number(FileView[i].rows);
+}
+
+/*
+  (view-close stream)
+  Closes the file view.
+*/
+object *fn_viewclose (object *args, object *env) {
+  (void) env;
+  int i = checkview(first(args));
+  FileView[i].file.close();
+  FileView[i].open = false;
+  return nil;
+}
+
+// Text buffers - editable text held in a gap buffer, with an undo log
+
+#define TEXTBUFFERS 4
+#define TEXTGAP 1024
+#define UNDOSIZE 4096
+#define UNDOJOIN 64
+
+enum { UNDOINSERT, UNDODELETE };
+
+typedef struct { uint32_t pos; uint16_t length; uint8_t kind; } undorecord_t;
+
+// The text is data[0, gap) followed by data[gapend, size), and the cursor is at the gap. Each record in the
+// undo log is the characters inserted or deleted followed by an undorecord_t giving where, how many, and which
+struct {
+  uint8_t *data, *undo;
+  uint32_t size, gap, gapend;
+  uint32_t line, linestart, lines;
+  int undolength;
+  bool join, open;
+  uint8_t generation;
+} TextBuffer[TEXTBUFFERS];
+
+uint32_t textlength (int i) {
+  return TextBuffer[i].size - (TextBuffer[i].gapend - TextBuffer[i].gap);
+}
+
+uint8_t textchar (int i, uint32_t p) {
+  return TextBuffer[i].data[(p < TextBuffer[i].gap) ? p : p + TextBuffer[i].gapend - TextBuffer[i].gap];
+}
+
+// Returns the offset of the start of the line containing offset p
+uint32_t textstartofline (int i, uint32_t p) {
+  while (p > 0 && textchar(i, p-1) != '\n') p--;
+  return p;
+}
+
+// Moves the gap, and so the cursor, to offset p, keeping track of the cursor's line
+void textmovegap (int i, uint32_t p) {
+  uint8_t *data = TextBuffer[i].data;
+  uint32_t gap = TextBuffer[i].gap, gapend = TextBuffer[i].gapend, line = TextBuffer[i].line;
+  if (p < gap) {
+    uint32_t n = gap - p;
+    for (uint32_t k=p; k<gap; k++) if (data[k] == '\n') TextBuffer[i].line--;
+    memmove(data + gapend - n, data + p, n);
+    TextBuffer[i].gap = p; TextBuffer[i].gapend = gapend - n;
+  } else if (p > gap) {
+    uint32_t n = p - gap;
+    for (uint32_t k=gapend; k<gapend+n; k++) if (data[k] == '\n') TextBuffer[i].line++;
+    memmove(data + gap, data + gapend, n);
+    TextBuffer[i].gap = p; TextBuffer[i].gapend = gapend + n;
+  }
+  if (TextBuffer[i].line != line) TextBuffer[i].linestart = textstartofline(i, p);
+}
+
+// Makes the gap at least n long, growing the buffer by a quarter as well so that typing rarely reallocates
+void textreserve (int i, uint32_t n) {
+  if (TextBuffer[i].gapend - TextBuffer[i].gap >= n) return;
+  uint32_t size = TextBuffer[i].size, grow = n + TEXTGAP + size/4;
+  uint8_t *data = (uint8_t *)realloc(TextBuffer[i].data, size + grow);
+  if (data == NULL) error2("not enough memory for text");
+  memmove(data + TextBuffer[i].gapend + grow, data + TextBuffer[i].gapend, size - TextBuffer[i].gapend);
+  TextBuffer[i].data = data;
+  TextBuffer[i].gapend = TextBuffer[i].gapend + grow;
+  TextBuffer[i].size = size + grow;
+}
+
+// Adds an edit to the undo log, extending the last record if the edit carries on from it,
+// and dropping the oldest records if the log is full
+void textrecord (int i, uint8_t kind, uint32_t pos, const uint8_t *chars, uint32_t n) {
+  uint8_t *log = TextBuffer[i].undo;
+  int length = TextBuffer[i].undolength, need = n + sizeof(undorecord_t);
+  undorecord_t record;
+  if (TextBuffer[i].join && length > 0 && length + (int)n <= UNDOSIZE) {
+    memcpy(&record, log + length - sizeof(undorecord_t), sizeof(undorecord_t));
+    bool before = (pos + n == record.pos), after = (pos == record.pos + (kind == UNDOINSERT ? record.length : 0));
+    if (record.kind == kind && record.length + n <= UNDOJOIN && (after || (kind == UNDODELETE && before))) {
+      uint8_t *bytes = log + length - sizeof(undorecord_t) - record.length;
+      if (after) memcpy(bytes + record.length, chars, n);
+      else { memmove(bytes + n, bytes, record.length); memcpy(bytes, chars, n); record.pos = pos; }
+      record.length = record.length + n;
+      memcpy(bytes + record.length, &record, sizeof(undorecord_t));
+      TextBuffer[i].undolength = length + n;
+      return;
+    }
+  }
+  if (need > UNDOSIZE) { TextBuffer[i].undolength = 0; return; }
+  if (length + need > UNDOSIZE) {
+    int p = length;
+    while (p > 0) {
+      memcpy(&record, log + p - sizeof(undorecord_t), sizeof(undorecord_t));
+      int q = p - sizeof(undorecord_t) - record.length;
+      if (length - q + need > UNDOSIZE) break;
+      p = q;
+    }
+    memmove(log, log + p, length - p);
+    length = length - p;
+  }
+  memcpy(log + length, chars, n);
+  record.pos = pos; record.length = n; record.kind = kind;
+  memcpy(log + length + n, &record, sizeof(undorecord_t));
+  TextBuffer[i].undolength = length + need;
+  TextBuffer[i].join = true;
+}
+
+// Inserts n characters at the cursor, leaving the cursor after them
+void textinsert (int i, const uint8_t *chars, uint32_t n, bool record) {
+  textreserve(i, n);
+  uint32_t gap = TextBuffer[i].gap;
+  if (record) textrecord(i, UNDOINSERT, gap, chars, n);
+  memcpy(TextBuffer[i].data + gap, chars, n);
+  for (uint32_t k=0; k<n; k++) {
+    if (chars[k] == '\n') { TextBuffer[i].line++; TextBuffer[i].lines++; TextBuffer[i].linestart = gap + k + 1; }
+  }
+  TextBuffer[i].gap = gap + n;
+}
+
+// Deletes n characters before the cursor, or -n after it if n is negative
+void textdelete (int i, int n, bool record) {
+  uint8_t *data = TextBuffer[i].data;
+  uint32_t gap = TextBuffer[i].gap, gapend = TextBuffer[i].gapend, lines = 0;
+  if (n > 0) {
+    if ((uint32_t)n > gap) n = gap;
+    uint32_t p = gap - n;
+    if (record) textrecord(i, UNDODELETE, p, data + p, n);
+    for (uint32_t k=p; k<gap; k++) if (data[k] == '\n') lines++;
+    TextBuffer[i].gap = p;
+    if (lines > 0) { TextBuffer[i].line = TextBuffer[i].line - lines; TextBuffer[i].linestart = textstartofline(i, p); }
+  } else {
+    n = -n;
+    if ((uint32_t)n > TextBuffer[i].size - gapend) n = TextBuffer[i].size - gapend;
+    if (record) textrecord(i, UNDODELETE, gap, data + gapend, n);
+    for (uint32_t k=gapend; k<gapend+n; k++) if (data[k] == '\n') lines++;
+    TextBuffer[i].gapend = gapend + n;
+  }
+  TextBuffer[i].lines = TextBuffer[i].lines - lines;
+}
+
+// Inserts the characters of a Lisp string at the cursor, a block at a time
+void textinsertstring (int i, object *string, bool record) {
+  uint8_t block[64];
+  int n = 0;
+  for (object *cell = cdr(string); cell != NULL; cell = car(cell)) {
+    int quad = cell->chars;
+    for (int shift=(sizeof(int)-1)*8; shift>=0; shift=shift-8) {
+      uint8_t ch = quad>>shift & 0xFF;
+      if (ch == 0) continue;
+      block[n++] = ch;
+      if (n == 64) { textinsert(i, block, n, record); n = 0; }
+    }
+  }
+  textinsert(i, block, n, record);
+}
+
+// Returns the offset of the start of a line, scanning from the cursor's line or the start, whichever is nearer
+uint32_t textfindline (int i, uint32_t line) {
+  uint32_t p = 0, l = 0, length = textlength(i);
+  if (line >= TextBuffer[i].line/2) { p = TextBuffer[i].linestart; l = TextBuffer[i].line; }
+  while (l > line) { p = textstartofline(i, p-1); l--; }
+  while (l < line && p < length) if (textchar(i, p++) == '\n') l++;
+  return p;
+}
+
+void textclose (int i) {
+  free(TextBuffer[i].data); free(TextBuffer[i].undo);
+  TextBuffer[i].data = NULL; TextBuffer[i].undo = NULL;
+  TextBuffer[i].open = false;
+}
+
+// Returns the index of the text buffer in a text stream, checking it's still open
+int checktext (object *arg) {
+  int address = isstream(arg);
+  int i = address & (TEXTBUFFERS-1);
+  if (address>>8 != TEXTSTREAM || !TextBuffer[i].open || TextBuffer[i].generation != (address & 0xFF)/TEXTBUFFERS)
+    error("not an open text buffer", arg);
+  return i;
+}
+
+/*
+  (text-open [source])
+  Returns a text stream on a new text buffer, with the cursor at the start. The buffer holds the file
+  named by source, read from the SD card without carriage returns, or the lines in source if it's a list.
+  Gives an error if all the buffers are open, since their edits may not have been saved.
+*/
+object *fn_textopen (object *args, object *env) {
+  (void) env;
+  object *source = (args != NULL) ? first(args) : NULL;
+  // Check the lines first, so an error can't leave the buffer open
+  if (!stringp(source)) {
+    for (object *lines = source; lines != NULL; lines = cdr(lines)) {
+      if (improperp(lines)) error(notproper, source);
+      checkstring(car(lines));
+    }
+  }
+  int i = 0;
+  while (i < TEXTBUFFERS && TextBuffer[i].open) i++;
+  if (i == TEXTBUFFERS) error2("all text buffers are open");
+  textclose(i); // Frees anything left by an open that ran out of memory
+  TextBuffer[i].data = NULL; TextBuffer[i].size = 0; TextBuffer[i].gap = 0; TextBuffer[i].gapend = 0;
+  TextBuffer[i].line = 0; TextBuffer[i].linestart = 0; TextBuffer[i].lines = 1;
+  TextBuffer[i].undolength = 0; TextBuffer[i].join = false;
+  TextBuffer[i].undo = (uint8_t *)malloc(UNDOSIZE);
+  if (TextBuffer[i].undo == NULL) error2("not enough memory for text");
+  TextBuffer[i].generation = (TextBuffer[i].generation + 1) % (256/TEXTBUFFERS);
+  if (stringp(source)) {
+    SDBegin();
+    char buffer[BUFFERSIZE*4];
+    File file = SD.open(MakeFilename(source, buffer));
+    if (!file || file.isDirectory()) {
+      file.close(); textclose(i);
+      error2("problem reading from SD card or invalid filename");
+    }
+    textreserve(i, file.size());
+    uint8_t block[512];
+    int n;
+    while ((n = file.read(block, 512)) > 0) {
+      int m = 0;
+      for (int k=0; k<n; k++) if (block[k] != '\r') block[m++] = block[k];
+      textinsert(i, block, m, false);
+    }
+    file.close();
+  } else {
+    for (object *lines = source; lines != NULL; lines = cdr(lines)) {
+      textinsertstring(i, car(lines), false);
+      if (cdr(lines) != NULL) textinsert(i, (const uint8_t *)"\n", 1, false);
+    }
+  }
+  textmovegap(i, 0);
+  TextBuffer[i].open = true;
+  return stream(TEXTSTREAM, TextBuffer[i].generation*TEXTBUFFERS + i);
+}
+
+/*
+  (text-insert stream text)
+  Inserts a character or string at the cursor of the text buffer, and moves the cursor past it.
+*/
+object *fn_textinsert (object *args, object *env) {
+  (void) env;
+  int i = checktext(first(args));
+  object *text = second(args);
+  if (characterp(text)) {
+    uint8_t ch = checkchar(text);
+    textinsert(i, &ch, 1, true);
+  } else textinsertstring(i, checkstring(text), true);
+  return nil;
+}
+
+/*
+  (text-delete stream [n])
+  Deletes n characters, default 1, before the cursor of the text buffer, or after it if n is negative.
+*/
+object *fn_textdelete (object *args, object *env) {
+  (void) env;
+  int i = checktext(first(args));
+  int n = (cdr(args) != NULL) ? checkinteger(second(args)) : 1;
+  textdelete(i, n, true);
+  return nil;
+}
+
+/*
+  (text-move stream n)
+  Moves the cursor of the text buffer n characters forwards, or backwards if n is negative,
+  where the end of a line counts as a character.
+*/
+object *fn_textmove (object *args, object *env) {
+  (void) env;
+  int i = checktext(first(args));
+  int n = checkinteger(second(args));
+  int32_t p = TextBuffer[i].gap + n;
+  if (p < 0) p = 0;
+  if ((uint32_t)p > textlength(i)) p = textlength(i);
+  textmovegap(i, p);
+  TextBuffer[i].join = false;
+  return nil;
+}
+
+/*
+  (text-goto stream line [column])
+  Moves the cursor of the text buffer to a column, default 0, of a line,
+  or to the nearest place if the line or column is past the end.
+*/
+object *fn_textgoto (object *args, object *env) {
+  (void) env;
+  int i = checktext(first(args));
+  int line = checkinteger(second(args));
+  int column = (cddr(args) != NULL) ? checkinteger(third(args)) : 0;
+  if (line < 0) error(indexnegative, second(args));
+  if (column < 0) error(indexnegative, third(args));
+  if ((uint32_t)line >= TextBuffer[i].lines) line = TextBuffer[i].lines - 1;
+  uint32_t p = textfindline(i, line), length = textlength(i);
+  while (column-- > 0 && p < length && textchar(i, p) != '\n') p++;
+  textmovegap(i, p);
+  TextBuffer[i].join = false;
+  return nil;
+}
+
+/*
+  (text-cursor stream)
+  Returns the line and column of the cursor in the text buffer as a list.
+*/
+object *fn_textcursor (object *args, object *env) {
+  (void) env;
+  int i = checktext(first(args));
+  return cons(number(TextBuffer[i].line), cons(number(TextBuffer[i].gap - TextBuffer[i].linestart), NULL));
+}
+
+/*
+  (text-length stream)
+  Returns the number of lines in the text buffer.
+*/
+object *fn_textlength (object *args, object *env) {
+  (void) env;
+  return number(TextBuffer[checktext(first(args))].lines);
+}
+
+/*
+  (text-lines stream line [n column width])
+  Returns a list of up to n lines, default 1, of the text buffer starting at line, each as a string
+  of up to width characters starting at column. The list is shorter, or empty, at the end of the text.
+*/
+object *fn_textlines (object *args, object *env) {
+  (void) env;
+  int i = checktext(first(args));
+  int line = checkinteger(second(args));
+  if (line < 0) error(indexnegative, second(args));
+  args = cddr(args);
+  int n = 1, column = 0, width = INT_MAX;
+  if (args != NULL) { n = checkinteger(first(args)); args = cdr(args); }
+  if (args != NULL) { column = checkinteger(first(args)); args = cdr(args); }
+  if (args != NULL) width = checkinteger(first(args));
+  if (column < 0 || width < 0) error2(indexnegative);
+  object *result = cons(NULL, NULL);
+  protect(result);
+  object *ptr = result;
+  uint32_t length = textlength(i), p = ((uint32_t)line < TextBuffer[i].lines) ? textfindline(i, line) : length;
+  uint8_t block[64];
+  while (n-- > 0 && (uint32_t)line++ < TextBuffer[i].lines) {
+    object *string = newstring(), *tail = string;
+    cdr(ptr) = cons(string, NULL);
+    ptr = cdr(ptr);
+    int x = 0, m = 0;
+    for (; p < length; p++) {
+      uint8_t ch = textchar(i, p);
+      if (ch == '\n') break;
+      if (x >= column && x - column < width) {
+        block[m++] = ch;
+        if (m == 64) { buildchars(block, m, &tail); m = 0; }
+      }
+      x++;
+    }
+    buildchars(block, m, &tail);
+    p++;
+  }
+  unprotect();
+  return cdr(result);
+}
+
+/*
+  (text-undo stream)
+  Undoes the last change to the text buffer, moving the cursor to it; returns nil if there's nothing to undo.
+  Typing or deleting a run of characters is undone in one step.
+*/
+object *fn_textundo (object *args, object *env) {
+  (void) env;
+  int i = checktext(first(args));
+  int length = TextBuffer[i].undolength;
+  if (length == 0) return nil;
+  undorecord_t record;
+  memcpy(&record, TextBuffer[i].undo + length - sizeof(undorecord_t), sizeof(undorecord_t));
+  uint8_t *bytes = TextBuffer[i].undo + length - sizeof(undorecord_t) - record.length;
+  if (record.kind == UNDOINSERT) {
+    textmovegap(i, record.pos + record.length);
+    textdelete(i, record.length, false);
+  } else {
+    textmovegap(i, record.pos);
+    textinsert(i, bytes, record.length, false);
+  }
+  TextBuffer[i].undolength = bytes - TextBuffer[i].undo;
+  TextBuffer[i].join = false;
+  return tee;
+}
+
+/*
+  (text-save stream filename)
+  Writes the text in the text buffer to a file on the SD card.
+*/
+object *fn_textsave (object *args, object *env) {
+  (void) env;
+  int i = checktext(first(args));
+  SDBegin();
+  char buffer[BUFFERSIZE*4];
+  File file = SD.open(MakeFilename(checkstring(second(args)), buffer), FILE_WRITE);
+  if (!file) error2("problem writing to SD card or invalid filename");
+  file.write(TextBuffer[i].data, TextBuffer[i].gap);
+  file.write(TextBuffer[i].data + TextBuffer[i].gapend, TextBuffer[i].size - TextBuffer[i].gapend);
+  file.close();
+  dircacheclear();
+  return nil;
+}
+
+/*
+  (text-close stream)
+  Closes the text buffer and frees its memory.
+*/
+object *fn_textclose (object *args, object *env) {
+  (void) env;
+  textclose(checktext(first(args)));
+  return nil;
+}
+
+// Directory cursors - read a directory a page at a time, optionally from a cached listing
+
+#define DIRCURSORS 4
+#define DIRCACHES 4
+#define DIRPATH 96
+
+// A cached listing holds, for each entry, a directory flag byte, a four-byte size, and the name with a terminating zero
+struct {
+  char path[DIRPATH];
+  uint32_t mtime, used;
+  int count;
+  uint8_t *data;
+  uint32_t *offsets;
+} DirCache[DIRCACHES];
+
+// A cursor reads entries from its cache if it has one, or from the open directory otherwise
+struct {
+  char path[DIRPATH];
+  File dir;
+  int cache, position;
+  uint8_t generation;
+  bool open;
+  uint32_t used;
+} DirCursor[DIRCURSORS];
+
+uint32_t DirTick = 0;
+
+void dircachefree (int c) {
+  free(DirCache[c].data); free(DirCache[c].offsets);
+  DirCache[c].data = NULL; DirCache[c].offsets = NULL;
+  DirCache[c].path[0] = 0; DirCache[c].count = 0;
+}
+
+// Returns true if an open cursor is reading from the cache
+bool dircacheheld (int c) {
+  for (int i=0; i<DIRCURSORS; i++) if (DirCursor[i].open && DirCursor[i].cache == c) return true;
+  return false;
+}
+
+// Reads the whole of the cursor's open directory into a cache, returning its index or -1 if there isn't room;
+// it replaces the least recently used cache that no open cursor is reading from
+int dircachebuild (int i, uint32_t mtime) {
+  int c = -1;
+  for (int j=0; j<DIRCACHES; j++) {
+    if (!dircacheheld(j) && (c < 0 || DirCache[j].used < DirCache[c].used)) c = j;
+  }
+  if (c < 0) return -1;
+  dircachefree(c);
+  int size = 0, capacity = 1024, count = 0, slots = 64;
+  uint8_t *data = (uint8_t *)malloc(capacity);
+  uint32_t *offsets = (uint32_t *)malloc(slots*4);
+  File *dir = &DirCursor[i].dir;
+  dir->rewindDirectory();
+  while (data != NULL && offsets != NULL) {
+    File entry = dir->openNextFile();
+    if (!entry) break;
+    const char *name = entry.name();
+    int length = strlen(name) + 6;
+    if (size + length > capacity) {
+      capacity = capacity*2 + length;
+      uint8_t *more = (uint8_t *)realloc(data, capacity);
+      if (more == NULL) free(data);
+      data = more;
+    }
+    if (count == slots) {
+      slots = slots*2;
+      uint32_t *more = (uint32_t *)realloc(offsets, slots*4);
+      if (more == NULL) free(offsets);
+      offsets = more;
+    }
+    if (data != NULL && offsets != NULL) {
+      uint8_t *p = data + size;
+      uint32_t bytes = entry.isDirectory() ? 0 : entry.size();
+      p[0] = entry.isDirectory();
+      memcpy(p + 1, &bytes, 4);
+      strcpy((char *)p + 5, name);
+      offsets[count++] = size;
+      size = size + length;
+    }
+    entry.close();
+  }
+  if (data == NULL || offsets == NULL) { free(data); free(offsets); return -1; }
+  DirCache[c].data = data; DirCache[c].offsets = offsets; DirCache[c].count = count;
+  DirCache[c].mtime = mtime; DirCache[c].used = ++DirTick;
+  strcpy(DirCache[c].path, DirCursor[i].path);
+  return c;
+}
+
+// Moves the cursor to entry n, or to the end if there are fewer; without a cache this rereads the directory
+void dirseek (int i, int n) {
+  int c = DirCursor[i].cache;
+  if (c >= 0) { DirCursor[i].position = min(n, DirCache[c].count); return; }
+  File *dir = &DirCursor[i].dir;
+  if (n < DirCursor[i].position) { dir->rewindDirectory(); DirCursor[i].position = 0; }
+  while (DirCursor[i].position < n) {
+    File entry = dir->openNextFile();
+    if (!entry) break;
+    entry.close();
+    DirCursor[i].position++;
+  }
+}
+
+// Called after anything that changes the card, since directory times on FAT don't reliably change with their contents;
+// file views are reindexed the next time they're read
+void dircacheclear () {
+  for (int i=0; i<FILEVIEWS; i++) FileView[i].stale = true;
+  for (int i=0; i<DIRCURSORS; i++) {
+    if (DirCursor[i].open && DirCursor[i].cache >= 0) {
+      int position = DirCursor[i].position;
+      DirCursor[i].cache = -1; DirCursor[i].position = 0;
+      DirCursor[i].dir = SD.open(DirCursor[i].path);
+      dirseek(i, position);
+    }
+  }
+  for (int c=0; c<DIRCACHES; c++) dircachefree(c);
+}
+
+void dirclose (int i) {
+  if (DirCursor[i].cache < 0) DirCursor[i].dir.close();
+  DirCursor[i].open = false;
+}
+
+// Returns the index of the directory cursor in a dir stream, checking it's still open
+int checkdir (object *arg) {
+  int address = isstream(arg);
+  int i = address & (DIRCURSORS-1);
+  if (address>>8 != DIRSTREAM || !DirCursor[i].open || DirCursor[i].generation != (address & 0xFF)/DIRCURSORS)
+    error("not an open directory", arg);
+  DirCursor[i].used = ++DirTick;
+  if (DirCursor[i].cache >= 0) DirCache[DirCursor[i].cache].used = DirTick;
+  return i;
+}
+
+// Returns the entry at the cursor as (name . size) for a file or (name) for a directory, and advances it
+object *direntry (int i) {
+  char name[256];
+  uint8_t isdir;
+  uint32_t size;
+  int c = DirCursor[i].cache;
+  if (c >= 0) {
+    if (DirCursor[i].position >= DirCache[c].count) return NULL;
+    uint8_t *p = DirCache[c].data + DirCache[c].offsets[DirCursor[i].position];
+    isdir = p[0];
+    memcpy(&size, p + 1, 4);
+    strcpy(name, (char *)p + 5);
+  } else {
+    File entry = DirCursor[i].dir.openNextFile();
+    if (!entry) return NULL;
+    isdir = entry.isDirectory(); size = entry.size();
+    strncpy(name, entry.name(), 255); name[255] = 0;
+    entry.close();
+  }
+  DirCursor[i].position++;
+  object *string = newstring(), *tail = string;
+  buildchars((uint8_t *)name, strlen(name), &tail);
+  return cons(string, isdir ? nil : number(size));
+}
+
+/*
+  (dir-open [directory cache])
+  Opens the directory, or the root, and returns a directory stream positioned at its first entry.
+  If cache is true the listing is read once and kept, and reused while the directory's time is unchanged.
+*/
+object *fn_diropen (object *args, object *env) {
+  (void) env;
+  SDBegin();
+  int i = 0;
+  for (int j=0; j<DIRCURSORS; j++) {
+    if (!DirCursor[j].open) { i = j; break; }
+    if (DirCursor[j].used < DirCursor[i].used) i = j;
+  }
+  // Reuse the least recently used cursor if they're all open; its stream stops working
+  if (DirCursor[i].open) dirclose(i);
+  char *path = DirCursor[i].path;
+  path[0] = '/';
+  if (args != NULL && first(args) != NULL) cstring(first(args), path + 1, DIRPATH - 1); else path[1] = 0;
+  DirCursor[i].dir = SD.open(path);
+  if (!DirCursor[i].dir || !DirCursor[i].dir.isDirectory()) {
+    DirCursor[i].dir.close();
+    error2("can't open directory");
+  }
+  DirCursor[i].cache = -1; DirCursor[i].position = 0;
+  if (args != NULL && cdr(args) != NULL && second(args) != NULL) {
+    uint32_t mtime = DirCursor[i].dir.getLastWrite();
+    int c = -1;
+    for (int j=0; j<DIRCACHES; j++) {
+      if (DirCache[j].data != NULL && DirCache[j].mtime == mtime && strcmp(DirCache[j].path, path) == 0) c = j;
+    }
+    if (c >= 0) DirCache[c].used = ++DirTick; else c = dircachebuild(i, mtime);
+    if (c >= 0) { DirCursor[i].dir.close(); DirCursor[i].cache = c; }
+  }
+  DirCursor[i].open = true;
+  DirCursor[i].generation = (DirCursor[i].generation + 1) % (256/DIRCURSORS);
+  DirCursor[i].used = ++DirTick;
+  return stream(DIRSTREAM, DirCursor[i].generation*DIRCURSORS + i);
+}
+
+/*
+  (dir-next stream [n])
+  Returns a list of up to n entries, default 1, from the directory stream, and advances past them.
+  Each entry is (name . size) for a file or (name) for a directory; the list is empty at the end.
+*/
+object *fn_dirnext (object *args, object *env) {
+  (void) env;
+  int i = checkdir(first(args));
+  int n = (cdr(args) != NULL) ? checkinteger(second(args)) : 1;
+  object *result = cons(NULL, NULL);
+  protect(result);
+  object *ptr = result;
+  while (n-- > 0) {
+    object *entry = direntry(i);
+    if (entry == NULL) break;
+    cdr(ptr) = cons(entry, NULL);
+    ptr = cdr(ptr);
+  }
+  unprotect();
+  return cdr(result);
+}
+
+/*
+  (dir-seek stream index)
+  Moves the directory stream to the entry with the given index, and returns the index it reached,
+  which is the number of entries if there are fewer.
+*/
+object *fn_dirseek (object *args, object *env) {
+  (void) env;
+  int i = checkdir(first(args));
+  int n = checkinteger(second(args));
+  if (n < 0) error(indexnegative, second(args));
+  dirseek(i, n);
+  return number(DirCursor[i].position);
+}
+
+/*
+  (dir-close stream)
+  Closes the directory stream.
+*/
+object *fn_dirclose (object *args, object *env) {
+  (void) env;
+  dirclose(checkdir(first(args)));
+  return nil;
+}
+
 //from https://github.com/nanomonkey/ulisp-tdeck/blob/edits/ulisp-extensions.ino
 object *fn_rename_file(object *args, object *env) {
   (void) env;
@@ -452,6 +1932,7 @@ object *fn_rename_file(object *args, object *env) {
   char buffer1[BUFFERSIZE];
   char buffer2[BUFFERSIZE];
   if (SD.rename(MakeFilename(path1, buffer1), MakeFilename(path2, buffer2))) {
+    dircacheclear();
     return path2;
   }
   else { 
@@ -460,6 +1941,37 @@ object *fn_rename_file(object *args, object *env) {
   }
 }
 
+/*
+  (gfx-save-ppm filename)
+  Writes the framebuffer to filename on the SD card as a binary PPM image.
+*/
+object *fn_gfxsaveppm (object *args, object *env) {
+  (void) env;
+  #if defined(gfxsupport)
+  if (Gfx != &Frame) error2("framebuffer not enabled");
+  SDBegin();
+  char buffer[BUFFERSIZE];
+  File file = SD.open(MakeFilename(checkstring(first(args)), buffer), FILE_WRITE);
+  if (!file) error2("problem saving to SD card");
+  const char *header = "P6\n320 240\n255\n";
+  file.write((const uint8_t *)header, strlen(header));
+  uint8_t line[320*3];
+  for (int y=0; y<240; y++) {
+    for (int x=0; x<320; x++) {
+      uint16_t c = Frame.readPixel(x, y);
+      line[x*3] = (c>>8 & 0xF8) | c>>13;
+      line[x*3+1] = (c>>3 & 0xFC) | (c>>9 & 0x03);
+      line[x*3+2] = (c<<3 & 0xF8) | (c>>2 & 0x07);
+    }
+    file.write(line, 320*3);
+  }
+  file.close();
+  #else
+  (void) args;
+  #endif
+  return nil;
+}
+
 #endif
 
 
@@ -471,8 +1983,30 @@ void SDWriteTwo (File file, uint16_t word) {
 const char string_gettouchpoints[] PROGMEM = "get-touch-points";
 const char stringKeyboardGetKey[] PROGMEM = "keyboard-get-key";
 const char stringKeyboardFlush[] PROGMEM = "keyboard-flush";
+const char stringnextevent[] PROGMEM = "next-event";
+const char stringpostevent[] PROGMEM = "post-event";
 const char stringSearchStr[] PROGMEM = "search-str";
 const char stringsearchn[] PROGMEM = "searchn";
+const char stringgcpauses[] PROGMEM = "gc-pauses";
+const char stringcompile[] PROGMEM = "compile";
+const char stringmakehashtable[] PROGMEM = "make-hash-table";
+const char stringgethash[] PROGMEM = "gethash";
+const char stringremhash[] PROGMEM = "remhash";
+const char stringmaphash[] PROGMEM = "maphash";
+const char stringhashtablecount[] PROGMEM = "hash-table-count";
+const char stringdefstruct[] PROGMEM = "defstruct";
+const char stringfill[] PROGMEM = "fill";
+const char stringreplace[] PROGMEM = "replace";
+const char stringmapinto[] PROGMEM = "map-into";
+const char stringarraysum[] PROGMEM = "array-sum";
+const char stringarraymin[] PROGMEM = "array-min";
+const char stringarraymax[] PROGMEM = "array-max";
+const char stringreadsequence[] PROGMEM = "read-sequence";
+const char stringwritesequence[] PROGMEM = "write-sequence";
+const char stringdrawimage[] PROGMEM = "draw-image";
+const char stringdrawtextrun[] PROGMEM = "draw-text-run";
+const char stringgfxframebuffer[] PROGMEM = "gfx-framebuffer";
+const char stringgfxflush[] PROGMEM = "gfx-flush";
 
 #if defined sdcardsupport
 const char stringSDFileExists[] PROGMEM = "sd-file-exists";
@@ -482,6 +2016,26 @@ const char string_rename_file[] PROGMEM = "rename-file";
 const char stringDir2[] PROGMEM = "dir2";
 const char stringmkdir[] PROGMEM = "mkdir";
 const char stringrmdir[] PROGMEM = "rmdir";
+const char stringdiropen[] PROGMEM = "dir-open";
+const char stringdirnext[] PROGMEM = "dir-next";
+const char stringdirseek[] PROGMEM = "dir-seek";
+const char stringdirclose[] PROGMEM = "dir-close";
+const char stringgfxsaveppm[] PROGMEM = "gfx-save-ppm";
+const char stringviewopen[] PROGMEM = "view-open";
+const char stringviewlines[] PROGMEM = "view-lines";
+const char stringviewlength[] PROGMEM = "view-length";
+const char stringviewclose[] PROGMEM = "view-close";
+const char stringtextopen[] PROGMEM = "text-open";
+const char stringtextinsert[] PROGMEM = "text-insert";
+const char stringtextdelete[] PROGMEM = "text-delete";
+const char stringtextmove[] PROGMEM = "text-move";
+const char stringtextgoto[] PROGMEM = "text-goto";
+const char stringtextcursor[] PROGMEM = "text-cursor";
+const char stringtextlength[] PROGMEM = "text-length";
+const char stringtextlines[] PROGMEM = "text-lines";
+const char stringtextundo[] PROGMEM = "text-undo";
+const char stringtextsave[] PROGMEM = "text-save";
+const char stringtextclose[] PROGMEM = "text-close";
 #endif
 
 
@@ -492,7 +2046,14 @@ const char doc_gettouchpoints[] PROGMEM = "(get-touch-points)\n"
 const char docKeyboardGetKey[] PROGMEM = "(keyboard-get-key [pressed])\n"
 "Get key last recognized - default: when released, if [pressed] is t: when pressed).";
 const char docKeyboardFlush[] PROGMEM = "(keyboard-flush)\n"
-"Discard missing key up/down events.";
+"Discards any queued input events.";
+const char docnextevent[] PROGMEM = "(next-event [timeout])\n"
+"Waits up to timeout milliseconds, or indefinitely if it's omitted or nil, for the next input event.\n"
+"Returns (key code time) for a key or trackball movement, (touch x y time) for a touch, or nil on timeout.";
+const char docpostevent[] PROGMEM = "(post-event code)\n"
+"(post-event x y)\n"
+"Queues a key event, or a touch event at x, y, as if it came from the hardware.\n"
+"Returns t, or nil if the queue is full and the event was dropped.";
 
 const char docSearchStr[] PROGMEM = "(search-str pattern target [startpos])\n"
 "Returns the index of the first occurrence of pattern in target, or nil if it's not found\n"
@@ -503,6 +2064,63 @@ const char docsearchn[] PROGMEM = "(searchn pattern target [n])\n"
 "which can be lists or strings, or nil if it's not found.\n"
 "if the pattern occured more than once but less than n times, it returns the last occuring index";
 
+const char docgcpauses[] PROGMEM = "(gc-pauses [clear])\n"
+"Returns a list of how many garbage collector pauses fell into each bucket:\n"
+"under 16 us, under 32 us, and so on doubling, with the last bucket open ended.\n"
+"The mark phase and each lazy sweep step count as one pause. If clear is t, resets the counts.";
+const char doccompile[] PROGMEM = "(compile symbol [function])\n"
+"Compiles the function defined by symbol to bytecode, replacing its definition, and returns symbol.\n"
+"If function is given, compiles that and defines symbol as it, or returns it if symbol is nil.\n"
+"Compiled and interpreted functions can call each other; functions containing lambda can't be compiled.";
+const char docmakehashtable[] PROGMEM = "(make-hash-table [:test test])\n"
+"Returns a new empty hash table. Keys are compared with eq, or with equal if test is equal or string=.";
+const char docgethash[] PROGMEM = "(gethash key hash-table [default])\n"
+"Returns the value stored under key in hash-table, or default if there isn't one.\n"
+"Can be used as a place with setf, incf, and push to add or change an entry.";
+const char docremhash[] PROGMEM = "(remhash key hash-table)\n"
+"Removes the entry for key from hash-table, and returns t if there was one or nil otherwise.";
+const char docmaphash[] PROGMEM = "(maphash function hash-table)\n"
+"Calls function with the key and value of each entry in hash-table, and returns nil.";
+const char dochashtablecount[] PROGMEM = "(hash-table-count hash-table)\n"
+"Returns the number of entries in hash-table.";
+const char docdefstruct[] PROGMEM = "(defstruct name slot*)\n"
+"Defines a structure type with the given slots, each a symbol or a list of a symbol and a default form.\n"
+"Defines the constructor make-name, which takes a keyword and value for each slot it sets,\n"
+"the predicate name-p, and an accessor name-slot for each slot, which can be used as a place with setf.";
+const char docfill[] PROGMEM = "(fill array value [start end])\n"
+"Sets the elements of the typed array from start below end to value, and returns the array.";
+const char docreplace[] PROGMEM = "(replace array1 array2 [start1 start2])\n"
+"Copies elements of the typed array array2 from start2 into array1 from start1,\n"
+"as many as fit in both, and returns array1.";
+const char docmapinto[] PROGMEM = "(map-into array function array*)\n"
+"Sets each element of the typed array to function applied to the corresponding elements of the other arrays,\n"
+"and returns array. +, -, *, max, and min on two arrays of the same type run without calling the function.";
+const char docarraysum[] PROGMEM = "(array-sum array [start end])\n"
+"Returns the sum of the elements of the typed array from start below end.";
+const char docarraymin[] PROGMEM = "(array-min array [start end])\n"
+"Returns the smallest element of the typed array from start below end, or nil if there are none.";
+const char docarraymax[] PROGMEM = "(array-max array [start end])\n"
+"Returns the largest element of the typed array from start below end, or nil if there are none.";
+const char docreadsequence[] PROGMEM = "(read-sequence sequence stream [start end])\n"
+"Reads bytes from stream into the string or (unsigned-byte 8) array from start below end,\n"
+"and returns the index of the first element it didn't fill, which is less than end at the end of the file.";
+const char docwritesequence[] PROGMEM = "(write-sequence sequence [stream start end])\n"
+"Writes the characters of the string, or bytes of the (unsigned-byte 8) array, from start below end to stream,\n"
+"and returns the sequence.";
+const char docdrawimage[] PROGMEM = "(draw-image x y width array [palette])\n"
+"Draws the typed array as rows of width pixels with the top left at x, y. An (unsigned-byte 16) array\n"
+"holds colours, and an (unsigned-byte 8) array holds indexes into an (unsigned-byte 16) palette.";
+const char docdrawtextrun[] PROGMEM = "(draw-text-run x y string [fg bg hilite start end])\n"
+"Draws the characters of string from start below end on one line with the top left at x, y, and returns the x after them.\n"
+"STX and ETX switch to and from the hilite background, and characters with the top bit set draw as a hilited space.\n"
+"Without hilite, hilited characters are drawn with fg and bg swapped.";
+const char docgfxframebuffer[] PROGMEM = "(gfx-framebuffer on)\n"
+"If on is true, graphics and the terminal draw into an off-screen framebuffer that gfx-flush copies to the display.\n"
+"Returns nil if there isn't enough memory for the framebuffer. If on is nil, flushes and draws to the display again.";
+const char docgfxflush[] PROGMEM = "(gfx-flush)\n"
+"Copies the parts of the framebuffer drawn since the last flush to the display.\n"
+"The REPL flushes automatically while it waits for a key.";
+
 
 #if defined sdcardsupport
 const char docSDFileExists[] PROGMEM = "(sd-file-exists filename)\n"
@@ -520,6 +2138,58 @@ const char docmkdir[] PROGMEM = "(mkdir directory)\n"
 
 const char docrmdir[] PROGMEM = "(rmdir directory)\n"
 "Delete specified directory. Returns t if successful, otherwise nil.";
+
+const char docdiropen[] PROGMEM = "(dir-open [directory cache])\n"
+"Opens the directory, or the root, and returns a directory stream positioned at its first entry.\n"
+"If cache is true the listing is read once and kept, and reused while the directory's time is unchanged.";
+const char docdirnext[] PROGMEM = "(dir-next stream [n])\n"
+"Returns a list of up to n entries, default 1, from the directory stream, and advances past them.\n"
+"Each entry is (name . size) for a file or (name) for a directory; the list is empty at the end.";
+const char docdirseek[] PROGMEM = "(dir-seek stream index)\n"
+"Moves the directory stream to the entry with the given index, and returns the index it reached,\n"
+"which is the number of entries if there are fewer.";
+const char docdirclose[] PROGMEM = "(dir-close stream)\n"
+"Closes the directory stream.";
+const char docgfxsaveppm[] PROGMEM = "(gfx-save-ppm filename)\n"
+"Writes the framebuffer to filename on the SD card as a binary PPM image.";
+const char docviewopen[] PROGMEM = "(view-open filename [width])\n"
+"Opens a text file on the SD card and returns a view stream for reading its rows by number.\n"
+"Lines longer than width, or 255, are split into several rows.";
+const char docviewlines[] PROGMEM = "(view-lines stream start [n])\n"
+"Returns a list of up to n rows, default 1, from the file view starting at row start.\n"
+"The list is shorter, or empty, at the end of the file.";
+const char docviewlength[] PROGMEM = "(view-length stream)\n"
+"Returns the number of rows in the file view, reading to the end of the file the first time.";
+const char docviewclose[] PROGMEM = "(view-close stream)\n"
+"Closes the file view.";
+const char doctextopen[] PROGMEM = "(text-open [source])\n"
+"Returns a text stream on a new text buffer, with the cursor at the start. The buffer holds the file\n"
+"named by source, read from the SD card without carriage returns, or the lines in source if it's a list.\n"
+"Gives an error if all the buffers are open, since their edits may not have been saved.";
+const char doctextinsert[] PROGMEM = "(text-insert stream text)\n"
+"Inserts a character or string at the cursor of the text buffer, and moves the cursor past it.";
+const char doctextdelete[] PROGMEM = "(text-delete stream [n])\n"
+"Deletes n characters, default 1, before the cursor of the text buffer, or after it if n is negative.";
+const char doctextmove[] PROGMEM = "(text-move stream n)\n"
+"Moves the cursor of the text buffer n characters forwards, or backwards if n is negative,\n"
+"where the end of a line counts as a character.";
+const char doctextgoto[] PROGMEM = "(text-goto stream line [column])\n"
+"Moves the cursor of the text buffer to a column, default 0, of a line,\n"
+"or to the nearest place if the line or column is past the end.";
+const char doctextcursor[] PROGMEM = "(text-cursor stream)\n"
+"Returns the line and column of the cursor in the text buffer as a list.";
+const char doctextlength[] PROGMEM = "(text-length stream)\n"
+"Returns the number of lines in the text buffer.";
+const char doctextlines[] PROGMEM = "(text-lines stream line [n column width])\n"
+"Returns a list of up to n lines, default 1, of the text buffer starting at line, each as a string\n"
+"of up to width characters starting at column. The list is shorter, or empty, at the end of the text.";
+const char doctextundo[] PROGMEM = "(text-undo stream)\n"
+"Undoes the last change to the text buffer, moving the cursor to it; returns nil if there's nothing to undo.\n"
+"Typing or deleting a run of characters is undone in one step.";
+const char doctextsave[] PROGMEM = "(text-save stream filename)\n"
+"Writes the text in the text buffer to a file on the SD card.";
+const char doctextclose[] PROGMEM = "(text-close stream)\n"
+"Closes the text buffer and frees its memory.";
 #endif
 
 
@@ -530,9 +2200,31 @@ const tbl_entry_t lookup_table2[] PROGMEM = {
 
   { stringKeyboardGetKey, fn_KeyboardGetKey, 0201, docKeyboardGetKey },
   { stringKeyboardFlush, fn_KeyboardFlush, 0200, docKeyboardFlush },
+  { stringnextevent, fn_nextevent, 0201, docnextevent },
+  { stringpostevent, fn_postevent, 0212, docpostevent },
   { stringSearchStr, fn_searchstr, 0224, docSearchStr },
 
   { stringsearchn, fn_searchn, 0223, docsearchn },
+  { stringgcpauses, fn_gcpauses, 0201, docgcpauses },
+  { stringcompile, fn_compile, 0212, doccompile },
+  { stringmakehashtable, fn_makehashtable, 0202, docmakehashtable },
+  { stringgethash, fn_gethash, 0223, docgethash },
+  { stringremhash, fn_remhash, 0222, docremhash },
+  { stringmaphash, fn_maphash, 0222, docmaphash },
+  { stringhashtablecount, fn_hashtablecount, 0211, dochashtablecount },
+  { stringdefstruct, sp_defstruct, 0317, docdefstruct },
+  { stringfill, fn_fill, 0224, docfill },
+  { stringreplace, fn_replace, 0224, docreplace },
+  { stringmapinto, fn_mapinto, 0227, docmapinto },
+  { stringarraysum, fn_arraysum, 0213, docarraysum },
+  { stringarraymin, fn_arraymin, 0213, docarraymin },
+  { stringarraymax, fn_arraymax, 0213, docarraymax },
+  { stringreadsequence, fn_readsequence, 0224, docreadsequence },
+  { stringwritesequence, fn_writesequence, 0214, docwritesequence },
+  { stringdrawimage, fn_drawimage, 0245, docdrawimage },
+  { stringdrawtextrun, fn_drawtextrun, 0237, docdrawtextrun },
+  { stringgfxframebuffer, fn_gfxframebuffer, 0211, docgfxframebuffer },
+  { stringgfxflush, fn_gfxflush, 0200, docgfxflush },
 
 #if defined sdcardsupport
   { stringSDFileExists, fn_SDFileExists, 0211, docSDFileExists },
@@ -542,6 +2234,26 @@ const tbl_entry_t lookup_table2[] PROGMEM = {
   { stringDir2, fn_directory2, 0201, docDir2 },
   { stringmkdir, fn_SDmkdir, 0211, docmkdir },
   { stringrmdir, fn_SDrmdir, 0211, docrmdir },
+  { stringgfxsaveppm, fn_gfxsaveppm, 0211, docgfxsaveppm },
+  { stringdiropen, fn_diropen, 0202, docdiropen },
+  { stringdirnext, fn_dirnext, 0212, docdirnext },
+  { stringdirseek, fn_dirseek, 0222, docdirseek },
+  { stringdirclose, fn_dirclose, 0211, docdirclose },
+  { stringviewopen, fn_viewopen, 0212, docviewopen },
+  { stringviewlines, fn_viewlines, 0223, docviewlines },
+  { stringviewlength, fn_viewlength, 0211, docviewlength },
+  { stringviewclose, fn_viewclose, 0211, docviewclose },
+  { stringtextopen, fn_textopen, 0201, doctextopen },
+  { stringtextinsert, fn_textinsert, 0222, doctextinsert },
+  { stringtextdelete, fn_textdelete, 0212, doctextdelete },
+  { stringtextmove, fn_textmove, 0222, doctextmove },
+  { stringtextgoto, fn_textgoto, 0223, doctextgoto },
+  { stringtextcursor, fn_textcursor, 0211, doctextcursor },
+  { stringtextlength, fn_textlength, 0211, doctextlength },
+  { stringtextlines, fn_textlines, 0225, doctextlines },
+  { stringtextundo, fn_textundo, 0211, doctextundo },
+  { stringtextsave, fn_textsave, 0222, doctextsave },
+  { stringtextclose, fn_textclose, 0211, doctextclose },
 #endif
 
 };
@@ -51,6 +51,15 @@
 
 TFT_eSPI tft;
 
+// Off-screen framebuffer; Gfx is the current drawing target, either tft or Frame
+TFT_eSprite Frame = TFT_eSprite(&tft);
+TFT_eSPI *Gfx = &tft;
+
+#define DIRTYRECTS 8
+typedef struct { int16_t x0, y0, x1, y1; } dirtyrect_t;
+dirtyrect_t Dirty[DIRTYRECTS];
+uint8_t Dirtyrects = 0, Textsize = 1;
+
 #if defined(sdcardsupport)
   #include <SD.h>
 #endif
@@ -67,6 +76,7 @@ TFT_eSPI tft;
   #define WORKSPACESIZE 25000          /* Cells (8*bytes) */
   #endif
   #define MAX_STACK 6500
+  #define SWEEPCHUNK 1024              /* Cells swept per allocation step */
   #define LITTLEFS
   #include <LittleFS.h>
 #else
@@ -91,18 +101,34 @@ TFT_eSPI tft;
 #define protect(y)         push((y), GCStack)
 #define unprotect()        pop(GCStack)
 
-#define integerp(x)        ((x) != NULL && (x)->type == NUMBER)
-#define floatp(x)          ((x) != NULL && (x)->type == FLOAT)
-#define symbolp(x)         ((x) != NULL && (x)->type == SYMBOL)
-#define stringp(x)         ((x) != NULL && (x)->type == STRING)
-#define characterp(x)      ((x) != NULL && (x)->type == CHARACTER)
-#define arrayp(x)          ((x) != NULL && (x)->type == ARRAY)
-#define streamp(x)         ((x) != NULL && (x)->type == STREAM)
-
-#define mark(x)            (car(x) = (object *)(((uintptr_t)(car(x))) | MARKBIT))
-#define unmark(x)          (car(x) = (object *)(((uintptr_t)(car(x))) & ~MARKBIT))
-#define marked(x)          ((((uintptr_t)(car(x))) & MARKBIT) != 0)
-#define MARKBIT            1
+// Small integers and characters are immediate, tagged in the low bits that cell pointers leave clear
+#define immediatep(x)      (((uintptr_t)(x) & 1) != 0)
+#define fixnump(x)         (((uintptr_t)(x) & 3) == 1)
+#define fixnum(n)          ((object *)((uintptr_t)(n)<<2 | 1))
+#define fixnumvalue(x)     ((int)(intptr_t)(x)>>2)
+#define immchar(c)         ((object *)((uintptr_t)(c)<<2 | 3))
+#define intval(x)          (fixnump(x) ? fixnumvalue(x) : (x)->integer)
+#define charval(x)         ((int)((uintptr_t)(x)>>2))
+#define celltype(x, t)     ((x) != NULL && !immediatep(x) && (x)->type == (t))
+
+#define integerp(x)        (fixnump(x) || celltype(x, NUMBER))
+#define floatp(x)          celltype(x, FLOAT)
+#define symbolp(x)         celltype(x, SYMBOL)
+#define stringp(x)         celltype(x, STRING)
+#define characterp(x)      (((uintptr_t)(x) & 3) == 3)
+#define arrayp(x)          celltype(x, ARRAY)
+#define bytecodep(x)       celltype(x, BYTECODE)
+#define hashtablep(x)      celltype(x, HASHTABLE)
+#define recordp(x)         celltype(x, RECORD)
+#define typedarrayp(x)     celltype(x, TYPEDARRAY)
+#define streamp(x)         celltype(x, STREAM)
+#define codep(x)           celltype(x, CODE)
+#define pairtype(t)        ((t) >= PAIR || (t) == ZZERO || ((t) & 1))  // A cons has a pointer or immediate in its car
+
+#define cellindex(x)       ((uintptr_t)((object *)(x) - Workspace))
+#define mark(x)            (Markbits[cellindex(x)>>5] |= (uint32_t)1<<(cellindex(x) & 31))
+#define unmark(x)          (Markbits[cellindex(x)>>5] &= ~((uint32_t)1<<(cellindex(x) & 31)))
+#define marked(x)          ((Markbits[cellindex(x)>>5] & (uint32_t)1<<(cellindex(x) & 31)) != 0)
 
 #define setflag(x)         (Flags = Flags | 1<<(x))
 #define clrflag(x)         (Flags = Flags & ~(1<<(x)))
@@ -118,6 +144,8 @@ TFT_eSPI tft;
 #define arraysize(x)       (sizeof(x) / sizeof(x[0]))
 #define stringifyX(x)      #x
 #define stringify(x)       stringifyX(x)
+#define FIXNUMMAX          0x1FFFFFFF
+#define FIXNUMMIN          (-FIXNUMMAX-1)
 #define PACKEDS            0x43238000
 #define BUILTINS           0xF4240000
 #define ENDFUNCTIONS       0x0BDC0000
@@ -125,10 +153,31 @@ TFT_eSPI tft;
 // Constants
 
 #define TRACEMAX 3  // Maximum number of traced functions
-enum type { ZZERO=0, SYMBOL=2, CODE=4, NUMBER=6, STREAM=8, CHARACTER=10, FLOAT=12, ARRAY=14, STRING=16, PAIR=18 };  // ARRAY STRING and PAIR must be last
-enum token { UNUSED, BRA, KET, QUO, DOT };
-enum stream { SERIALSTREAM, I2CSTREAM, SPISTREAM, SDSTREAM, WIFISTREAM, STRINGSTREAM, GFXSTREAM };
+#define SYMBOLTABLESIZE 1024  // Initial symbol table slots, a power of 2
+#define BUILTINSLOTS 1024  // Builtin name index slots, a power of 2
+#define MARKWORDS ((WORKSPACESIZE+31)/32)
+#define MARKSTACKSIZE 256  // Deeper structures are found by rescanning
+#define PAUSEBUCKETS 16  // GC pause histogram buckets, doubling from 16 us
+#define IMAGEMAGIC 0x6D694C75  // "uLim"
+#define IMAGEVERSION 8
+#define IMAGEBLOCK 4096  // Bytes per image file read or write
+#define VMSTACKSIZE 1024  // Bytecode value stack slots
+#define CALLSITES 256  // Interpreter call-site cache entries, a power of 2
+#define HASHSLOTS 8  // Initial hash table slots, a power of 2
+#define HASHEQUAL 1  // Hash table info bits, below the log2 of the slots
+#define HASHSTALE 2
+#define HASHDEPTH 4  // Levels of a list key that equal hashing looks at
+#define TOMBSTONE fixnum(0)  // A removed hash table entry
+#define TYPEDPLACE 32  // place() returns an element of a typed array as a bit number from here up
+enum type { ZZERO=0, SYMBOL=2, CODE=4, NUMBER=6, STREAM=8, HASHTABLE=10, FLOAT=12, BYTECODE=14, RECORD=16, TYPEDARRAY=18, ARRAY=20, STRING=22, PAIR=24 };  // ARRAY STRING and PAIR must be last
+enum elementtype { UBYTE8, SBYTE16, UBYTE16, SBYTE32, SINGLEFLOAT };
+enum token { UNUSED, BRA=2, KET=4, QUO=6, DOT=10 };  // Neither immediates nor cell pointers
+enum stream { SERIALSTREAM, I2CSTREAM, SPISTREAM, SDSTREAM, WIFISTREAM, STRINGSTREAM, GFXSTREAM, DIRSTREAM, VIEWSTREAM, TEXTSTREAM };
 enum fntypes_t { OTHER_FORMS, TAIL_FORMS, FUNCTIONS, SPECIAL_FORMS };
+enum opcode { OPENTRY, OPCONST, OPLOCAL, OPSETLOCAL, OPGLOBAL, OPSETGLOBAL, OPPOP, OPSLIDE, OPJUMP, OPLOOP, OPJUMPNIL,
+OPANDJUMP, OPORJUMP, OPOPTIONAL, OPCALL, OPCALLVALUE, OPCALLBUILTIN, OPSHADOWED, OPSELFTAIL, OPRETURN, OPRETURNFLAG, OPCHECKEXIT,
+OPCHECKRETURN, OPEVALFORM, OPBOX, OPBOXREF, OPSETBOX, OPCLOSURE, OPMATCH, OPSLOT, OPRECORD, OPRECORDP, OPADD, OPSUBTRACT, OPLESS, OPGREATER, OPLESSEQ, OPGREATEREQ, OPNUMEQ, OPONEPLUS, OPONEMINUS,
+OPCAR, OPCDR, OPCONS, OPZEROP, OPEQ, OPNOT };  // Operations from OPADD to OPZEROP fall back to a builtin
 
 // Stream names used by printobject
 const char serialstream[] = "serial";
@@ -138,7 +187,10 @@ const char sdstream[] = "sd";
 const char wifistream[] = "wifi";
 const char stringstream[] = "string";
 const char gfxstream[] = "gfx";
-const char *const streamname[] = {serialstream, i2cstream, spistream, sdstream, wifistream, stringstream, gfxstream};
+const char dirstream[] = "dir";
+const char viewstream[] = "view";
+const char textstream[] = "text";
+const char *const streamname[] = {serialstream, i2cstream, spistream, sdstream, wifistream, stringstream, gfxstream, dirstream, viewstream, textstream};
 
 // Typedefs
 
@@ -167,6 +219,16 @@ typedef struct sobject {
 typedef object *(*fn_ptr_type)(object *, object *);
 typedef void (*mapfun_t)(object *, object **);
 
+typedef struct {
+  object *site; // The call form
+  symbol_t name;
+  uint32_t epoch;
+  object *pair; // Global binding, or NULL
+  fn_ptr_type fptr; // Builtin function, or NULL
+  builtin_t builtin;
+  uint8_t minmax;
+} callsite_t;
+
 typedef const struct {
   const char *string;
   fn_ptr_type fptr;
@@ -174,6 +236,18 @@ typedef const struct {
   const char *doc;
 } tbl_entry_t;
 
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uintptr_t autorun;
+  uint32_t imagesize;
+  uintptr_t globalenv;
+  uintptr_t gcstack;
+  uintptr_t base; // Workspace address when saved
+  uint32_t library; // Lisp Library the image was built from, or 0
+  uint32_t crc; // CRC-32 of the cells
+} image_t;
+
 typedef int (*gfun_t)();
 typedef void (*pfun_t)(char);
 
@@ -186,14 +260,21 @@ FIRST, CDR, REST, NTH, AREF, CHAR, STRINGFN, PINMODE, DIGITALWRITE, ANALOGREAD,
 
 #if defined(BOARD_HAS_PSRAM)
 object *Workspace WORDALIGNED;
+uint32_t *Markbits;
 #else
 object Workspace[WORKSPACESIZE] WORDALIGNED;
+uint32_t Markbits[MARKWORDS];
 #endif
 
 jmp_buf toplevel_handler;
 jmp_buf *handler = &toplevel_handler;
 unsigned int Freespace = 0;
 object *Freelist;
+unsigned int Marked = 0;
+unsigned int SweepNext = MARKWORDS;
+object *MarkStack[MARKSTACKSIZE];
+bool MarkOverflow = false, MarkTagging = false;
+unsigned int PauseCounts[PAUSEBUCKETS];
 unsigned int I2Ccount;
 unsigned int TraceFn[TRACEMAX];
 unsigned int TraceDepth[TRACEMAX];
@@ -204,9 +285,28 @@ symbol_t Backtrace[BACKTRACESIZE];
 
 object *GlobalEnv;
 object *GCStack = NULL;
+object **SymbolTable = NULL;
+unsigned int SymbolSlots = 0, SymbolCount = 0;
+object **GlobalTable = NULL;
+unsigned int GlobalSlots = 0, GlobalCount = 0, GlobalShadows = 0;  // GlobalShadows counts globals named like a builtin
+uint32_t GlobalEpoch = 0;
+callsite_t CallSites[CALLSITES];
+object *VMStack[VMSTACKSIZE];
+int VMTop = 0;
+object *CompileTail, *CompileScope, *CompileFixups, *CompileName, *CompileExit;
+int CompileDepth, CompileMax, CompileExitDepth, CompileSimple;
 object *GlobalString;
 object *GlobalStringTail;
 int GlobalStringIndex = 0;
+object *CursorString[2] = { NULL, NULL };
+object **CursorPlace[2];
+int CursorCell[2];
+uint8_t CursorNext = 0;
+object *LengthString[2] = { NULL, NULL };
+object *Placearray;
+object *LengthCell[2];
+int LengthChars[2];
+uint8_t LengthNext = 0;
 uint8_t PrintCount = 0;
 uint8_t BreakLevel = 0;
 char LastChar = 0;
@@ -316,6 +416,8 @@ const char unknownstreamtype[] = "unknown stream type";
 
 void initworkspace () {
   Freelist = NULL;
+  Freespace = 0;
+  SweepNext = MARKWORDS;
   for (int i=WORKSPACESIZE-1; i>=0; i--) {
     object *obj = &Workspace[i];
     car(obj) = NULL;
@@ -327,22 +429,17 @@ void initworkspace () {
 
 object *myalloc () {
   if (Freespace == 0) { Context = NIL; error2("no room"); }
+  if (Freelist == NULL) sweepstep();
   object *temp = Freelist;
   Freelist = cdr(Freelist);
   Freespace--;
   return temp;
 }
 
-inline void myfree (object *obj) {
-  car(obj) = NULL;
-  cdr(obj) = Freelist;
-  Freelist = obj;
-  Freespace++;
-}
-
 // Make each type of object
 
 object *number (int n) {
+  if (n >= FIXNUMMIN && n <= FIXNUMMAX) return fixnum(n);
   object *ptr = myalloc();
   ptr->type = NUMBER;
   ptr->integer = n;
@@ -357,10 +454,7 @@ object *makefloat (float f) {
 }
 
 object *character (uint8_t c) {
-  object *ptr = myalloc();
-  ptr->type = CHARACTER;
-  ptr->chars = c;
-  return ptr;
+  return immchar(c);
 }
 
 object *cons (object *arg1, object *arg2) {
@@ -381,14 +475,105 @@ inline object *bsymbol (builtin_t name) {
   return intern(twist(name+BUILTINS));
 }
 
-object *intern (symbol_t name) {
-  #if !defined(BOARD_HAS_PSRAM)
-  for (int i=0; i<WORKSPACESIZE; i++) {
+// Symbol table
+
+inline uint32_t hashword (uint32_t hash, uint32_t word) {
+  return (hash ^ word) * 0x01000193;
+}
+
+unsigned int hashslot (uint32_t hash, unsigned int slots) {
+  return (hash ^ hash>>16) & (slots-1);
+}
+
+uint32_t symbolhash (object *obj) {
+  if (!longsymbolp(obj)) return hashword(0, obj->name);
+  uint32_t hash = 0;
+  for (object *arg = cdr(obj); arg != NULL; arg = car(arg)) hash = hashword(hash, arg->chars);
+  return hash;
+}
+
+uint32_t bufferhash (char *buffer) {
+  uint32_t hash = 0;
+  int i = 0;
+  while (buffer[i] != 0) {
+    chars_t test = 0; int shift = 24;
+    for (int j=0; j<4; j++, i++) {
+      if (buffer[i] == 0) break;
+      test = test | buffer[i]<<shift;
+      shift = shift - 8;
+    }
+    hash = hashword(hash, test);
+  }
+  return hash;
+}
+
+void insertsymbol (object *obj) {
+  unsigned int i = hashslot(symbolhash(obj), SymbolSlots);
+  while (SymbolTable[i] != NULL) {
+    if (SymbolTable[i]->name == obj->name) return;
+    i = (i+1) & (SymbolSlots-1);
+  }
+  SymbolTable[i] = obj;
+  SymbolCount++;
+}
+
+void growsymbols () {
+  if (SymbolCount*4 < SymbolSlots*3) return;
+  unsigned int oldslots = SymbolSlots;
+  unsigned int slots = (oldslots == 0) ? SYMBOLTABLESIZE : oldslots*2;
+  object **table = (object **)calloc(slots, sizeof(object *));
+  if (table == NULL) { Context = NIL; error2("no room for symbol table"); }
+  object **oldtable = SymbolTable;
+  SymbolTable = table; SymbolSlots = slots; SymbolCount = 0;
+  for (unsigned int i=0; i<oldslots; i++) if (oldtable[i] != NULL) insertsymbol(oldtable[i]);
+  free(oldtable);
+}
+
+// The table is weak: after marking, symbols nothing refers to are dropped before their cells are swept
+void sweepsymbols () {
+  bool dropped = false;
+  for (unsigned int i=0; i<SymbolSlots; i++) {
+    if (SymbolTable[i] != NULL && !marked(SymbolTable[i])) { SymbolTable[i] = NULL; SymbolCount--; dropped = true; }
+  }
+  if (!dropped) return;
+  // Reinsert the rest, starting after an empty slot, so no symbol is left beyond a gap in its probe sequence
+  unsigned int start = 0;
+  while (SymbolTable[start] != NULL) start++;
+  for (unsigned int n=1; n<=SymbolSlots; n++) {
+    unsigned int i = (start+n) & (SymbolSlots-1);
+    object *obj = SymbolTable[i];
+    if (obj == NULL) continue;
+    SymbolTable[i] = NULL; SymbolCount--;
+    insertsymbol(obj);
+  }
+}
+
+void resetsymbols () {
+  for (unsigned int i=0; i<SymbolSlots; i++) SymbolTable[i] = NULL;
+  SymbolCount = 0;
+}
+
+// Rebuilds the table from a compacted workspace, where the live cells are the first ones
+void rehashsymbols (unsigned int cells) {
+  resetsymbols();
+  for (unsigned int i=0; i<cells; i++) {
     object *obj = &Workspace[i];
-    if (obj->type == SYMBOL && obj->name == name) return obj;
+    i = i + rawcells(obj);
+    if (obj->type == SYMBOL) { growsymbols(); insertsymbol(obj); }
   }
-  #endif
-  return symbol(name);
+}
+
+object *intern (symbol_t name) {
+  growsymbols();
+  unsigned int i = hashslot(hashword(0, name), SymbolSlots);
+  object *obj;
+  while ((obj = SymbolTable[i]) != NULL) {
+    if (obj->name == name) return obj;
+    i = (i+1) & (SymbolSlots-1);
+  }
+  obj = symbol(name);
+  SymbolTable[i] = obj; SymbolCount++;
+  return obj;
 }
 
 bool eqsymbols (object *obj, char *buffer) {
@@ -409,17 +594,104 @@ bool eqsymbols (object *obj, char *buffer) {
 }
 
 object *internlong (char *buffer) {
-  #if !defined(BOARD_HAS_PSRAM)
-  for (int i=0; i<WORKSPACESIZE; i++) {
-    object *obj = &Workspace[i];
-    if (obj->type == SYMBOL && longsymbolp(obj) && eqsymbols(obj, buffer)) return obj;
+  growsymbols();
+  unsigned int i = hashslot(bufferhash(buffer), SymbolSlots);
+  object *obj;
+  while ((obj = SymbolTable[i]) != NULL) {
+    if (longsymbolp(obj) && eqsymbols(obj, buffer)) return obj;
+    i = (i+1) & (SymbolSlots-1);
   }
-  #endif
-  object *obj = lispstring(buffer);
+  obj = lispstring(buffer);
   obj->type = SYMBOL;
+  SymbolTable[i] = obj; SymbolCount++;
   return obj;
 }
 
+// Returns the symbol named by buffer, as the reader would
+object *bufsymbol (char *buffer) {
+  builtin_t x = lookupbuiltin(buffer);
+  if (x == NIL) return nil;
+  if (x != ENDFUNCTIONS) return bsymbol(x);
+  if (strlen(buffer) <= 6 && valid40(buffer)) return intern(twist(pack40(buffer)));
+  return internlong(buffer);
+}
+
+// Global index - maps each name to its pair in GlobalEnv
+
+object *globalpair (symbol_t name) {
+  if (GlobalSlots == 0) return nil;
+  unsigned int i = hashslot(hashword(0, name), GlobalSlots);
+  object *pair;
+  while ((pair = GlobalTable[i]) != NULL) {
+    if (car(pair)->name == name) return pair;
+    i = (i+1) & (GlobalSlots-1);
+  }
+  return nil;
+}
+
+// Any change to which names have global pairs invalidates the call-site cache
+void newepoch () {
+  GlobalEpoch++;
+  if (GlobalEpoch == 0) memset(CallSites, 0, sizeof(CallSites));
+}
+
+void insertglobal (object *pair) {
+  symbol_t name = car(pair)->name;
+  unsigned int i = hashslot(hashword(0, name), GlobalSlots);
+  while (GlobalTable[i] != NULL) {
+    if (car(GlobalTable[i])->name == name) return;
+    i = (i+1) & (GlobalSlots-1);
+  }
+  GlobalTable[i] = pair;
+  GlobalCount++;
+  if (builtinp(name)) GlobalShadows++;
+  newepoch();
+}
+
+void addglobal (object *pair) {
+  if (GlobalCount*4 >= GlobalSlots*3) {
+    unsigned int oldslots = GlobalSlots;
+    unsigned int slots = (oldslots == 0) ? SYMBOLTABLESIZE : oldslots*2;
+    object **table = (object **)calloc(slots, sizeof(object *));
+    if (table == NULL) { Context = NIL; error2("no room for global index"); }
+    object **oldtable = GlobalTable;
+    GlobalTable = table; GlobalSlots = slots; GlobalCount = 0; GlobalShadows = 0;
+    for (unsigned int i=0; i<oldslots; i++) if (oldtable[i] != NULL) insertglobal(oldtable[i]);
+    free(oldtable);
+  }
+  insertglobal(pair);
+}
+
+void removeglobal (symbol_t name) {
+  if (GlobalSlots == 0) return;
+  unsigned int i = hashslot(hashword(0, name), GlobalSlots);
+  while (GlobalTable[i] != NULL) {
+    if (car(GlobalTable[i])->name == name) {
+      GlobalTable[i] = NULL; GlobalCount--;
+      if (builtinp(name)) GlobalShadows--;
+      newepoch();
+      // Reinsert the rest of the cluster
+      i = (i+1) & (GlobalSlots-1);
+      while (GlobalTable[i] != NULL) {
+        object *pair = GlobalTable[i];
+        GlobalTable[i] = NULL; GlobalCount--;
+        if (builtinp(car(pair)->name)) GlobalShadows--;
+        insertglobal(pair);
+        i = (i+1) & (GlobalSlots-1);
+      }
+      return;
+    }
+    i = (i+1) & (GlobalSlots-1);
+  }
+}
+
+void rehashglobals () {
+  for (unsigned int i=0; i<GlobalSlots; i++) GlobalTable[i] = NULL;
+  GlobalCount = 0; GlobalShadows = 0;
+  newepoch();
+  for (object *env = GlobalEnv; env != NULL; env = cdr(env)) addglobal(car(env));
+}
+
 object *stream (uint8_t streamtype, uint8_t address) {
   object *ptr = myalloc();
   ptr->type = STREAM;
@@ -472,111 +744,306 @@ object *features () {
 
 // Garbage collection
 
+void recordpause (unsigned long us) {
+  int b = 0;
+  while (b < PAUSEBUCKETS-1 && us >= (16UL<<b)) b++;
+  PauseCounts[b]++;
+}
+
+void clearmarks () {
+  for (int i=0; i<MARKWORDS; i++) Markbits[i] = 0;
+  // Cells past the end of the workspace look live
+  if (WORKSPACESIZE & 31) Markbits[MARKWORDS-1] = ~(uint32_t)0<<(WORKSPACESIZE & 31);
+  Marked = 0;
+}
+
+// A cell pointer is valid if it is aligned and inside the workspace
+bool validcell (object *obj) {
+  uintptr_t offset = (uintptr_t)obj - (uintptr_t)Workspace;
+  return offset < WORKSPACESIZE*sizeof(object) && (offset & (sizeof(object)-1)) == 0;
+}
+
 void markobject (object *obj) {
-  MARK:
-  if (obj == NULL) return;
-  if (marked(obj)) return;
+  int sp = 0;
+  for (;;) {
+    if (obj != NULL && validcell(obj) && !marked(obj)) {
+      object* arg = car(obj);
+      unsigned int type = obj->type;
+      mark(obj); Marked++;
+
+      if (pairtype(type)) { // cons - follow car, stack cdr
+        object *next = cdr(obj);
+        if (next != NULL && validcell(next) && !marked(next)) {
+          if (sp < MARKSTACKSIZE) MarkStack[sp++] = next; else MarkOverflow = true;
+        }
+        obj = arg;
+        continue;
+      }
 
-  object* arg = car(obj);
-  unsigned int type = obj->type;
-  mark(obj);
+      if (type == ARRAY || type == BYTECODE || type == HASHTABLE || type == RECORD) {
+        obj = cdr(obj);
+        continue;
+      }
 
-  if (type >= PAIR || type == ZZERO) { // cons
-    markobject(arg);
-    obj = cdr(obj);
-    goto MARK;
-  }
+      if (type == TYPEDARRAY) {
+        for (unsigned int i=rawcells(obj); i>0; i--) { mark(obj+i); Marked++; }
+      }
 
-  if (type == ARRAY) {
-    obj = cdr(obj);
-    goto MARK;
+      if ((type == STRING) || (type == SYMBOL && longsymbolp(obj))) {
+        obj = cdr(obj);
+        while (obj != NULL && validcell(obj) && !marked(obj)) {
+          arg = car(obj);
+          mark(obj); Marked++;
+          if (MarkTagging) car(obj) = chaintag(arg);
+          obj = arg;
+        }
+      }
+    }
+    if (sp == 0) return;
+    obj = MarkStack[--sp];
   }
+}
 
-  if ((type == STRING) || (type == SYMBOL && longsymbolp(obj))) {
-    obj = cdr(obj);
-    while (obj != NULL) {
-      arg = car(obj);
-      mark(obj);
-      obj = arg;
+void markvmstack () {
+  for (int i=0; i<VMTop; i++) markobject(VMStack[i]);
+}
+
+// After a mark stack overflow, mark from every marked cell whose children may have been dropped.
+// String and long symbol chain cells are tagged while this runs, as when compacting, so their
+// packed characters aren't followed as if they were the cdr of a cons
+void markoverflow () {
+  if (!MarkOverflow) return;
+  for (int i=0; i<WORKSPACESIZE; i++) {
+    object *obj = &Workspace[i];
+    if (!marked(obj)) continue;
+    i = i + rawcells(obj);
+    if (obj->type == STRING || (obj->type == SYMBOL && longsymbolp(obj))) {
+      object *chain = cdr(obj);
+      while (chain != NULL && !chaintagged((uintptr_t)car(chain))) {
+        object *next = car(chain);
+        car(chain) = chaintag(next);
+        chain = next;
+      }
+    }
+  }
+  MarkTagging = true;
+  while (MarkOverflow) {
+    MarkOverflow = false;
+    for (int i=0; i<WORKSPACESIZE; i++) {
+      if ((Markbits[i>>5] & (uint32_t)1<<(i & 31)) == 0) continue;
+      object *obj = &Workspace[i];
+      uintptr_t type = (uintptr_t)car(obj);
+      if (chaintagged(type)) continue;
+      i = i + rawcells(obj);
+      if (pairtype(type)) { markobject(car(obj)); markobject(cdr(obj)); }
+      else if (type == ARRAY || type == BYTECODE || type == HASHTABLE || type == RECORD) markobject(cdr(obj));
+    }
+  }
+  MarkTagging = false;
+  for (int i=0; i<WORKSPACESIZE; i++) {
+    object *obj = &Workspace[i];
+    if (!marked(obj)) continue;
+    uintptr_t type = (uintptr_t)car(obj);
+    if (chaintagged(type)) car(obj) = chainuntag(type); else i = i + rawcells(obj);
+  }
+}
+
+// Lazy sweep - the free cells are threaded onto Freelist a word of mark bits at a time by myalloc()
+
+void sweepwords (unsigned int count) {
+  unsigned int start = SweepNext;
+  unsigned int end = (count < MARKWORDS - start) ? start + count : MARKWORDS;
+  for (int w=end-1; w>=(int)start; w--) {
+    uint32_t bits = ~Markbits[w]; // Free cells, skip fully live words
+    while (bits != 0) {
+      int b = 31 - __builtin_clz(bits);
+      bits = bits & ~((uint32_t)1<<b);
+      object *obj = &Workspace[w<<5 | b];
+      car(obj) = NULL;
+      cdr(obj) = Freelist;
+      Freelist = obj;
     }
   }
+  SweepNext = end;
+}
+
+void sweepstep () {
+  unsigned long start = micros();
+  while (Freelist == NULL && SweepNext < MARKWORDS) sweepwords(SWEEPCHUNK/32);
+  recordpause(micros() - start);
 }
 
 void sweep () {
+  clearcursors();
   Freelist = NULL;
-  Freespace = 0;
-  for (int i=WORKSPACESIZE-1; i>=0; i--) {
-    object *obj = &Workspace[i];
-    if (!marked(obj)) myfree(obj); else unmark(obj);
-  }
+  Freespace = WORKSPACESIZE - Marked;
+  SweepNext = 0;
+}
+
+void finishsweep () {
+  sweepwords(MARKWORDS);
+}
+
+// After compacting or loading an image the first cells are live and the rest are free
+void markcells (unsigned int cells) {
+  clearmarks();
+  for (unsigned int w=0; w<cells/32; w++) Markbits[w] = ~(uint32_t)0;
+  if (cells & 31) Markbits[cells/32] = Markbits[cells/32] | ~(~(uint32_t)0<<(cells & 31));
+  Marked = cells;
+  sweep();
 }
 
 void gc (object *form, object *env) {
   #if defined(printgcs)
   int start = Freespace;
   #endif
+  unsigned long pausestart = micros();
+  clearmarks();
   markobject(tee);
   markobject(GlobalEnv);
   markobject(GCStack);
+  markvmstack();
   markobject(form);
   markobject(env);
+  markoverflow();
+  sweepsymbols();
   sweep();
+  recordpause(micros() - pausestart);
   #if defined(printgcs)
   pfl(pserial); pserial('{'); pint(Freespace - start, pserial); pserial('}');
   #endif
 }
 
-// Compact image
+// Contiguous runs - n consecutive free cells threaded as a list, so any of them can be reached by indexing
 
-void movepointer (object *from, object *to) {
-   uintptr_t limit = ((uintptr_t)(from) - (uintptr_t)(Workspace))/sizeof(uintptr_t);
-   for (uintptr_t i=0; i<limit; i++) {
-    object *obj = &Workspace[i];
-    unsigned int type = (obj->type) & ~MARKBIT;
-    if (marked(obj) && (type >= ARRAY || type==ZZERO || (type == SYMBOL && longsymbolp(obj)))) {
-      if (car(obj) == (object *)((uintptr_t)from | MARKBIT))
-        car(obj) = (object *)((uintptr_t)to | MARKBIT);
-      if (cdr(obj) == from) cdr(obj) = to;
-    }
+// Returns the first cell of a run of n free cells in the unswept part of the workspace, or -1
+int findrun (unsigned int n) {
+  unsigned int i = SweepNext<<5, run = 0;
+  while (i < WORKSPACESIZE) {
+    uint32_t bits = Markbits[i>>5];
+    if ((i & 31) == 0 && bits == 0) { run = run + 32; i = i + 32; }
+    else if ((i & 31) == 0 && bits == ~(uint32_t)0) { run = 0; i = i + 32; }
+    else { run = (bits & (uint32_t)1<<(i & 31)) ? 0 : run + 1; i++; }
+    if (run >= n) return i - run;
   }
-  // Fix strings and long symbols
-  for (uintptr_t i=0; i<limit; i++) {
-    object *obj = &Workspace[i];
-    if (marked(obj)) {
-      unsigned int type = (obj->type) & ~MARKBIT;
-      if (type == STRING || (type == SYMBOL && longsymbolp(obj))) {
-        obj = cdr(obj);
-        while (obj != NULL) {
-          if (cdr(obj) == to) cdr(obj) = from;
-          obj = (object *)((uintptr_t)(car(obj)) & ~MARKBIT);
-        }
-      }
-    }
+  return -1;
+}
+
+// Marks the cells so the lazy sweep passes over them; a gc may be needed to find room
+object *makerun (unsigned int n, object *env) {
+  int start = (Freespace >= n) ? findrun(n) : -1;
+  if (start < 0) { gc(NULL, env); start = (Freespace >= n) ? findrun(n) : -1; }
+  if (start < 0) error2("no room");
+  object *run = &Workspace[start];
+  for (unsigned int i=0; i<n; i++) {
+    object *obj = &run[i];
+    mark(obj);
+    car(obj) = NULL;
+    cdr(obj) = (i == n-1) ? NULL : obj+1;
+  }
+  Freespace = Freespace - n;
+  return run;
+}
+
+// Compact image - sliding compaction, the new address of a live cell is the number of live cells below it
+
+uint32_t *Blockcounts; // Live cells below each block of 8 mark words
+
+object *forward (object *obj) {
+  if (obj == NULL || immediatep(obj)) return obj;
+  uintptr_t i = cellindex(obj);
+  unsigned int w = i>>5, block = w>>3;
+  uint32_t n = Blockcounts[block];
+  for (unsigned int k=block<<3; k<w; k++) n = n + __builtin_popcount(Markbits[k]);
+  n = n + __builtin_popcount(Markbits[w] & (((uint32_t)1<<(i & 31))-1));
+  return &Workspace[n];
+}
+
+// While compacting or relocating, string and long symbol chain cells are tagged so they aren't mistaken for conses
+object *chaintag (object *next) {
+  return (object *)((next == NULL) ? ~(uintptr_t)1 : (uintptr_t)next | 2);
+}
+
+bool chaintagged (uintptr_t type) {
+  return (type & 3) == 2 && type > PAIR;
+}
+
+object *chainuntag (uintptr_t type) {
+  return (type == ~(uintptr_t)1) ? NULL : (object *)(type & ~(uintptr_t)3);
+}
+
+void forwardcell (object *obj) {
+  uintptr_t type = (uintptr_t)car(obj);
+  if (chaintagged(type)) car(obj) = forward(chainuntag(type));
+  else if (pairtype(type)) {
+    car(obj) = forward(car(obj));
+    cdr(obj) = forward(cdr(obj));
+  } else if (type == ARRAY || type == BYTECODE || type == HASHTABLE || type == RECORD || type == STRING || (type == SYMBOL && longsymbolp(obj))) {
+    cdr(obj) = forward(cdr(obj));
   }
 }
 
 uintptr_t compactimage (object **arg) {
+  clearmarks();
   markobject(tee);
   markobject(GlobalEnv);
   markobject(GCStack);
+  markobject(*arg);
+  markvmstack();
+  markoverflow();
+  unsigned int blocks = (MARKWORDS+7)/8;
+  Blockcounts = (uint32_t *)malloc(blocks*sizeof(uint32_t));
+  if (Blockcounts == NULL) error2("no room to compact");
+  uint32_t n = 0;
+  for (int w=0; w<MARKWORDS; w++) {
+    if ((w & 7) == 0) Blockcounts[w>>3] = n;
+    n = n + __builtin_popcount(Markbits[w]);
+  }
+  // Tag string and long symbol chain cells
+  for (int i=0; i<WORKSPACESIZE; i++) {
+    object *obj = &Workspace[i];
+    if (!marked(obj)) continue;
+    i = i + rawcells(obj);
+    if (obj->type == STRING || (obj->type == SYMBOL && longsymbolp(obj))) {
+      object *chain = cdr(obj);
+      while (chain != NULL && !chaintagged((uintptr_t)car(chain))) {
+        object *next = car(chain);
+        car(chain) = chaintag(next);
+        chain = next;
+      }
+    }
+  }
+  // Update pointers, then slide the cells down
+  for (int i=0; i<WORKSPACESIZE; i++) {
+    object *obj = &Workspace[i];
+    if (marked(obj)) { forwardcell(obj); i = i + rawcells(obj); }
+  }
+  tee = forward(tee);
+  GlobalEnv = forward(GlobalEnv);
+  GCStack = forward(GCStack);
+  *arg = forward(*arg);
+  for (int i=0; i<VMTop; i++) VMStack[i] = forward(VMStack[i]);
   object *firstfree = Workspace;
-  while (marked(firstfree)) firstfree++;
-  object *obj = &Workspace[WORKSPACESIZE-1];
-  while (firstfree < obj) {
+  for (int i=0; i<WORKSPACESIZE; i++) {
+    object *obj = &Workspace[i];
     if (marked(obj)) {
       car(firstfree) = car(obj);
       cdr(firstfree) = cdr(obj);
-      unmark(obj);
-      movepointer(obj, firstfree);
-      if (GlobalEnv == obj) GlobalEnv = firstfree;
-      if (GCStack == obj) GCStack = firstfree;
-      if (*arg == obj) *arg = firstfree;
-      while (marked(firstfree)) firstfree++;
+      firstfree++;
     }
-    obj--;
   }
-  sweep();
-  return firstfree - Workspace;
+  free(Blockcounts);
+  unsigned int live = firstfree - Workspace;
+  // Cells have moved, so tables hashed on cell addresses must be rehashed
+  for (unsigned int i=0; i<live; i++) {
+    object *obj = &Workspace[i];
+    i = i + rawcells(obj);
+    if (obj->type == HASHTABLE) car(cdr(obj)) = fixnum(fixnumvalue(car(cdr(obj))) | HASHSTALE);
+  }
+  markcells(live);
+  rehashsymbols(live);
+  rehashglobals();
+  return live;
 }
 
 // Make SD card filename
@@ -603,28 +1070,111 @@ void SDBegin() {
   digitalWrite(TDECK_TFT_CS, HIGH);
   SD.begin(TDECK_SDCARD_CS, SPI, 800000U);
 }
+#endif
+
+#if defined(sdcardsupport) || defined(LITTLEFS)
+// Image files - a header, then the compacted workspace, read and written in blocks
 
-void SDWriteInt (File file, int data) {
-  file.write(data & 0xFF); file.write(data>>8 & 0xFF);
-  file.write(data>>16 & 0xFF); file.write(data>>24 & 0xFF);
+uint32_t crc32 (uint32_t crc, uint8_t *data, uint32_t n) {
+  static const uint32_t nibble[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C };
+  crc = ~crc;
+  while (n--) {
+    crc = crc ^ *data++;
+    crc = (crc >> 4) ^ nibble[crc & 0x0F];
+    crc = (crc >> 4) ^ nibble[crc & 0x0F];
+  }
+  return ~crc;
 }
 
-int SDReadInt (File file) {
-  uintptr_t b0 = file.read(); uintptr_t b1 = file.read();
-  uintptr_t b2 = file.read(); uintptr_t b3 = file.read();
-  return b0 | b1<<8 | b2<<16 | b3<<24;
+void writeimage (File file, object *arg, unsigned int imagesize, uint32_t library) {
+  image_t header;
+  header.magic = IMAGEMAGIC; header.version = IMAGEVERSION;
+  header.autorun = (uintptr_t)arg; header.imagesize = imagesize;
+  header.globalenv = (uintptr_t)GlobalEnv; header.gcstack = (uintptr_t)GCStack;
+  header.base = (uintptr_t)Workspace; header.library = library;
+  uint8_t *data = (uint8_t *)Workspace;
+  uint32_t bytes = imagesize*sizeof(object);
+  header.crc = crc32(0, data, bytes);
+  if (file.write((uint8_t *)&header, sizeof(image_t)) != sizeof(image_t)) error2("not enough room");
+  while (bytes > 0) {
+    uint32_t n = (bytes < IMAGEBLOCK) ? bytes : IMAGEBLOCK;
+    if (file.write(data, n) != n) error2("not enough room");
+    data = data + n; bytes = bytes - n;
+  }
 }
-#elif defined(LITTLEFS)
-void FSWrite32 (File file, uint32_t data) {
-  union { uint32_t data2; uint8_t u8[4]; };
-  data2 = data;
-  if (file.write(u8, 4) != 4) error2("not enough room");
+
+void readheader (File file, image_t *header) {
+  if (file.read((uint8_t *)header, sizeof(image_t)) != sizeof(image_t) || header->magic != IMAGEMAGIC)
+    error2("not a uLisp image");
+  if (header->version != IMAGEVERSION) error2("image version doesn't match");
+  if (header->imagesize > WORKSPACESIZE) error2("image too large");
 }
 
-uint32_t FSRead32 (File file) {
-  union { uint32_t data; uint8_t u8[4]; };
-  file.read(u8, 4);
-  return data;
+inline object *relocate (uintptr_t ptr, uintptr_t delta) {
+  return (ptr == 0 || (ptr & 1)) ? (object *)ptr : (object *)(ptr + delta);
+}
+
+void relocateimage (unsigned int imagesize, uintptr_t delta) {
+  // String and long symbol chains first, tagging the chain cells
+  for (unsigned int i=0; i<imagesize; i++) {
+    object *obj = &Workspace[i];
+    i = i + rawcells(obj);
+    if (obj->type == STRING || (obj->type == SYMBOL && longsymbolp(obj))) {
+      cdr(obj) = relocate((uintptr_t)cdr(obj), delta);
+      object *chain = cdr(obj);
+      while (chain != NULL && !chaintagged((uintptr_t)car(chain))) {
+        object *next = relocate((uintptr_t)car(chain), delta);
+        car(chain) = chaintag(next);
+        chain = next;
+      }
+    }
+  }
+  for (unsigned int i=0; i<imagesize; i++) {
+    object *obj = &Workspace[i];
+    uintptr_t type = (uintptr_t)car(obj);
+    i = i + rawcells(obj);
+    if (chaintagged(type)) car(obj) = chainuntag(type);
+    else if (pairtype(type)) {
+      car(obj) = relocate((uintptr_t)car(obj), delta);
+      cdr(obj) = relocate((uintptr_t)cdr(obj), delta);
+    } else if (type == ARRAY || type == BYTECODE || type == HASHTABLE || type == RECORD) cdr(obj) = relocate((uintptr_t)cdr(obj), delta);
+  }
+}
+
+// Reads the cells into the workspace and returns false if they fail the CRC check
+bool readcells (File file, image_t *header) {
+  uint8_t *data = (uint8_t *)Workspace;
+  uint32_t bytes = header->imagesize*sizeof(object);
+  while (bytes > 0) {
+    uint32_t n = (bytes < IMAGEBLOCK) ? bytes : IMAGEBLOCK;
+    if (file.read(data, n) != (int)n) return false;
+    data = data + n; bytes = bytes - n;
+  }
+  return crc32(0, (uint8_t *)Workspace, header->imagesize*sizeof(object)) == header->crc;
+}
+
+void restoreimage (image_t *header) {
+  uintptr_t delta = (uintptr_t)Workspace - header->base;
+  if (delta != 0) relocateimage(header->imagesize, delta);
+  GlobalEnv = relocate(header->globalenv, delta);
+  GCStack = relocate(header->gcstack, delta);
+  markcells(header->imagesize);
+  rehashsymbols(header->imagesize);
+  rehashglobals();
+}
+
+unsigned int readimage (File file) {
+  image_t header;
+  readheader(file, &header);
+  if (!readcells(file, &header)) {
+    // The workspace has been overwritten, so start again
+    initworkspace(); initenv(); clrflag(LIBRARYLOADED);
+    error2("image is corrupt");
+  }
+  restoreimage(&header);
+  return header.imagesize;
 }
 #else
 void EpromWriteInt(int *addr, uintptr_t data) {
@@ -653,21 +1203,13 @@ unsigned int saveimage (object *arg) {
     file = SD.open("/ULISP.IMG", FILE_WRITE);
     if (!file) error2("problem saving to SD card");
   } else error(invalidarg, arg);
-  SDWriteInt(file, (uintptr_t)arg);
-  SDWriteInt(file, imagesize);
-  SDWriteInt(file, (uintptr_t)GlobalEnv);
-  SDWriteInt(file, (uintptr_t)GCStack);
-  for (unsigned int i=0; i<imagesize; i++) {
-    object *obj = &Workspace[i];
-    SDWriteInt(file, (uintptr_t)car(obj));
-    SDWriteInt(file, (uintptr_t)cdr(obj));
-  }
+  writeimage(file, arg, imagesize, 0);
   file.close();
   return imagesize;
 #elif defined(LITTLEFS)
   unsigned int imagesize = compactimage(&arg);
   if (!LittleFS.begin(true)) error2("problem mounting LittleFS");
-  int bytesneeded = imagesize*8 + 36; int bytesavailable = LittleFS.totalBytes();
+  int bytesneeded = imagesize*8 + sizeof(image_t); int bytesavailable = LittleFS.totalBytes();
   if (bytesneeded > bytesavailable) error("image too large by", number(bytesneeded - bytesavailable));
   File file;
   if (stringp(arg)) {
@@ -679,15 +1221,7 @@ unsigned int saveimage (object *arg) {
     file = LittleFS.open("/ULISP.IMG", "w");
     if (!file) error2("problem saving to LittleFS");
   } else error(invalidarg, arg);
-  FSWrite32(file, (uintptr_t)arg);
-  FSWrite32(file, imagesize);
-  FSWrite32(file, (uintptr_t)GlobalEnv);
-  FSWrite32(file, (uintptr_t)GCStack);
-  for (unsigned int i=0; i<imagesize; i++) {
-    object *obj = &Workspace[i];
-    FSWrite32(file, (uintptr_t)car(obj));
-    FSWrite32(file, (uintptr_t)cdr(obj));
-  }
+  writeimage(file, arg, imagesize, 0);
   file.close();
   return imagesize;
 #elif defined(EEPROMSIZE)
@@ -727,17 +1261,8 @@ unsigned int loadimage (object *arg) {
     file = SD.open("/ULISP.IMG");
     if (!file) error2("problem loading from SD card");
   } else error(invalidarg, arg);
-  SDReadInt(file);
-  unsigned int imagesize = SDReadInt(file);
-  GlobalEnv = (object *)SDReadInt(file);
-  GCStack = (object *)SDReadInt(file);
-  for (unsigned int i=0; i<imagesize; i++) {
-    object *obj = &Workspace[i];
-    car(obj) = (object *)SDReadInt(file);
-    cdr(obj) = (object *)SDReadInt(file);
-  }
+  unsigned int imagesize = readimage(file);
   file.close();
-  gc(NULL, NULL);
   return imagesize;
 #elif defined(LITTLEFS)
   if (!LittleFS.begin()) error2("problem mounting LittleFS");
@@ -752,17 +1277,8 @@ unsigned int loadimage (object *arg) {
     if (!file) error2("problem loading from LittleFS");
   }
   else error(invalidarg, arg);
-  FSRead32(file);
-  unsigned int imagesize = FSRead32(file);
-  GlobalEnv = (object *)FSRead32(file);
-  GCStack = (object *)FSRead32(file);
-  for (unsigned int i=0; i<imagesize; i++) {
-    object *obj = &Workspace[i];
-    car(obj) = (object *)FSRead32(file);
-    cdr(obj) = (object *)FSRead32(file);
-  }
+  unsigned int imagesize = readimage(file);
   file.close();
-  gc(NULL, NULL);
   return imagesize;
 #elif defined(EEPROMSIZE)
   (void) arg;
@@ -778,7 +1294,9 @@ unsigned int loadimage (object *arg) {
     car(obj) = (object *)EpromReadInt(&addr);
     cdr(obj) = (object *)EpromReadInt(&addr);
   }
-  gc(NULL, NULL);
+  markcells(imagesize);
+  rehashsymbols(imagesize);
+  rehashglobals();
   return imagesize;
 #else
   (void) arg;
@@ -792,21 +1310,23 @@ void autorunimage () {
   SDBegin();
   File file = SD.open("/ULISP.IMG");
   if (!file) error2("problem autorunning from SD card");
-  object *autorun = (object *)SDReadInt(file);
+  image_t header;
+  readheader(file, &header);
   file.close();
-  if (autorun != NULL) {
+  if (header.autorun != 0) {
     loadimage(NULL);
-    apply(autorun, NULL, NULL);
+    apply(relocate(header.autorun, (uintptr_t)Workspace - header.base), NULL, NULL);
   }
 #elif defined(LITTLEFS)
   if (!LittleFS.begin()) error2("problem mounting LittleFS");
   File file = LittleFS.open("/ULISP.IMG", "r");
   if (!file) error2("problem autorunning from LittleFS");
-  object *autorun = (object *)FSRead32(file);
+  image_t header;
+  readheader(file, &header);
   file.close();
-  if (autorun != NULL) {
+  if (header.autorun != 0) {
     loadimage(NULL);
-    apply(autorun, NULL, NULL);
+    apply(relocate(header.autorun, (uintptr_t)Workspace - header.base), NULL, NULL);
   }
 #elif defined(EEPROMSIZE)
   EEPROM.begin(EEPROMSIZE);
@@ -821,6 +1341,46 @@ void autorunimage () {
 #endif
 }
 
+// Lisp Library image - a snapshot of the workspace after the Lisp Library has been loaded, kept in flash
+
+#if defined(lisplibrary) && defined(LITTLEFS)
+uint32_t libraryhash () {
+  uint32_t hash = crc32(0, (uint8_t *)LispLibrary, strlen(LispLibrary));
+  // Images refer to builtins by number, so include the builtin names
+  unsigned int entries = tablesize(0) + tablesize(1);
+  for (unsigned int i=0; i<entries; i++) {
+    const char *name = builtinname(i);
+    hash = crc32(hash, (uint8_t *)name, strlen(name)+1);
+  }
+  return hash | 1;
+}
+
+bool loadlibraryimage () {
+  if (!LittleFS.begin(true)) return false;
+  File file = LittleFS.open("/LIBRARY.IMG", "r");
+  if (!file) return false;
+  image_t header;
+  bool loaded = false;
+  if (file.read((uint8_t *)&header, sizeof(image_t)) == sizeof(image_t) && header.magic == IMAGEMAGIC &&
+    header.version == IMAGEVERSION && header.library == libraryhash() && header.imagesize <= WORKSPACESIZE) {
+    if (readcells(file, &header)) { restoreimage(&header); loaded = true; }
+    else { initworkspace(); initenv(); }
+  }
+  file.close();
+  return loaded;
+}
+
+void savelibraryimage () {
+  object *arg = NULL;
+  unsigned int imagesize = compactimage(&arg);
+  if (imagesize*sizeof(object) + sizeof(image_t) > LittleFS.totalBytes()) return;
+  File file = LittleFS.open("/LIBRARY.IMG", "w");
+  if (!file) return;
+  writeimage(file, NULL, imagesize, libraryhash());
+  file.close();
+}
+#endif
+
 // Tracing
 
 int tracing (symbol_t name) {
@@ -854,17 +1414,18 @@ void untrace (symbol_t name) {
 // Helper functions
 
 bool consp (object *x) {
-  if (x == NULL) return false;
+  if (x == NULL || immediatep(x)) return false;
   unsigned int type = x->type;
-  return type >= PAIR || type == ZZERO;
+  return pairtype(type);
 }
 
 #define atom(x) (!consp(x))
 
 bool listp (object *x) {
   if (x == NULL) return true;
+  if (immediatep(x)) return false;
   unsigned int type = x->type;
-  return type >= PAIR || type == ZZERO;
+  return pairtype(type);
 }
 
 #define improperp(x) (!listp(x))
@@ -927,25 +1488,25 @@ int8_t digitvalue (char d) {
 
 int checkinteger (object *obj) {
   if (!integerp(obj)) error(notaninteger, obj);
-  return obj->integer;
+  return intval(obj);
 }
 
 int checkbitvalue (object *obj) {
   if (!integerp(obj)) error(notaninteger, obj);
-  int n = obj->integer;
+  int n = intval(obj);
   if (n & ~1) error("argument is not a bit value", obj);
   return n;
 }
 
 float checkintfloat (object *obj) {
-  if (integerp(obj)) return (float)obj->integer;
+  if (integerp(obj)) return (float)intval(obj);
   if (!floatp(obj)) error(notanumber, obj);
   return obj->single_float;
 }
 
 int checkchar (object *obj) {
   if (!characterp(obj)) error("argument is not a character", obj);
-  return obj->chars;
+  return charval(obj);
 }
 
 object *checkstring (object *obj) {
@@ -979,35 +1540,14 @@ void checkargs (object *args) {
   checkminmax(Context, nargs);
 }
 
-bool eqlongsymbol (symbol_t sym1, symbol_t sym2) {
-  object *arg1 = (object *)sym1; object *arg2 = (object *)sym2;
-  while ((arg1 != NULL) || (arg2 != NULL)) {
-    if (arg1 == NULL || arg2 == NULL) return false;
-    if (arg1->chars != arg2->chars) return false;
-    arg1 = car(arg1); arg2 = car(arg2);
-  }
-  return true;
-}
-
-bool eqsymbol (symbol_t sym1, symbol_t sym2) {
-  if (!longnamep(sym1) && !longnamep(sym2)) return (sym1 == sym2);  // Same short symbol
-  if (longnamep(sym1) && longnamep(sym2)) return eqlongsymbol(sym1, sym2);  // Same long symbol
-  return false;
-}
-
 bool eq (object *arg1, object *arg2) {
   if (arg1 == arg2) return true;  // Same object
   if ((arg1 == nil) || (arg2 == nil)) return false;  // Not both values
-  #if !defined(BOARD_HAS_PSRAM)
+  if (immediatep(arg1) || immediatep(arg2)) return false;  // Immediates are only eq to themselves
   if (arg1->cdr != arg2->cdr) return false;  // Different values
   if (symbolp(arg1) && symbolp(arg2)) return true;  // Same symbol
-  #else
-  if (symbolp(arg1) && symbolp(arg2)) return eqsymbol(arg1->name, arg2->name);  // Same symbol?
-  if (arg1->cdr != arg2->cdr) return false;  // Different values
-  #endif
   if (integerp(arg1) && integerp(arg2)) return true;  // Same integer
   if (floatp(arg1) && floatp(arg2)) return true; // Same float
-  if (characterp(arg1) && characterp(arg2)) return true;  // Same character
   return false;
 }
 
@@ -1059,7 +1599,7 @@ object *subtract_floats (object *args, float fresult) {
 
 object *negate (object *arg) {
   if (integerp(arg)) {
-    int result = arg->integer;
+    int result = intval(arg);
     if (result == INT_MIN) return makefloat(-result);
     else return number(-result);
   } else if (floatp(arg)) return makefloat(-(arg->single_float));
@@ -1091,9 +1631,9 @@ object *remmod (object *args, bool mod) {
   object *arg1 = first(args);
   object *arg2 = second(args);
   if (integerp(arg1) && integerp(arg2)) {
-    int divisor = arg2->integer;
+    int divisor = intval(arg2);
     if (divisor == 0) error2(divisionbyzero);
-    int dividend = arg1->integer;
+    int dividend = intval(arg1);
     int remainder = dividend % divisor;
     if (mod && (dividend<0) != (divisor<0)) remainder = remainder + divisor;
     return number(remainder);
@@ -1113,9 +1653,9 @@ object *compare (object *args, bool lt, bool gt, bool eq) {
   while (args != NULL) {
     object *arg2 = first(args);
     if (integerp(arg1) && integerp(arg2)) {
-      if (!lt && ((arg1->integer) < (arg2->integer))) return nil;
-      if (!eq && ((arg1->integer) == (arg2->integer))) return nil;
-      if (!gt && ((arg1->integer) > (arg2->integer))) return nil;
+      if (!lt && (intval(arg1) < intval(arg2))) return nil;
+      if (!eq && (intval(arg1) == intval(arg2))) return nil;
+      if (!gt && (intval(arg1) > intval(arg2))) return nil;
     } else {
       if (!lt && (checkintfloat(arg1) < checkintfloat(arg2))) return nil;
       if (!eq && (checkintfloat(arg1) == checkintfloat(arg2))) return nil;
@@ -1165,6 +1705,206 @@ object *delassoc (object *key, object **alist) {
   return nil;
 }
 
+// Hash tables - a cell pointing to a run holding the info, the count, the slots in use, then the slots
+// Each slot is empty, a tombstone, or a (key . value) entry, found by linear probing
+
+// Keys are hashed on their contents or on their cell index, which compacting changes but relocating doesn't
+uint32_t hashobject (object *key, bool equalp, int depth) {
+  if (key == NULL) return 0;
+  if (immediatep(key)) return (uintptr_t)key;
+  unsigned int type = key->type;
+  if (type == SYMBOL) return symbolhash(key);
+  if (type == NUMBER || type == FLOAT) return key->integer;
+  if (equalp && type == STRING) {
+    uint32_t hash = 0;
+    for (object *chain = cdr(key); chain != NULL; chain = car(chain)) {
+      chars_t chars = chain->chars;
+      while (chars != 0) { hash = hashword(hash, chars>>((sizeof(chars_t)-1)*8)); chars = chars<<8; }
+    }
+    return hash;
+  }
+  if (equalp && pairtype(type)) {
+    uint32_t hash = 1;
+    for (int i=0; i<HASHDEPTH && consp(key); i++) {
+      if (depth > 0) hash = hashword(hash, hashobject(car(key), true, depth-1));
+      key = cdr(key);
+    }
+    return (depth > 0 && !consp(key)) ? hashword(hash, hashobject(key, true, 0)) : hash;
+  }
+  return cellindex(key);
+}
+
+object *makehashtable (bool equalp, object *env) {
+  object *run = makerun(HASHSLOTS+3, env);
+  car(run) = fixnum(equalp | (31 - __builtin_clz(HASHSLOTS))<<2);
+  car(run+1) = fixnum(0); car(run+2) = fixnum(0);
+  object *ptr = myalloc();
+  ptr->type = HASHTABLE;
+  cdr(ptr) = run;
+  return ptr;
+}
+
+// Returns the slot holding key, or else the slot to insert it in
+object **hashprobe (object *run, object *key) {
+  int info = fixnumvalue(car(run));
+  bool equalp = info & HASHEQUAL;
+  unsigned int slots = 1<<(info>>2);
+  object *cells = run+3, **free = NULL;
+  unsigned int i = hashslot(hashobject(key, equalp, HASHDEPTH), slots);
+  for (;;) {
+    object *entry = car(&cells[i]);
+    if (entry == NULL) return (free != NULL) ? free : &car(&cells[i]);
+    if (entry == TOMBSTONE) { if (free == NULL) free = &car(&cells[i]); }
+    else if (equalp ? equal(car(entry), key) : eq(car(entry), key)) return &car(&cells[i]);
+    i = (i+1) & (slots-1);
+  }
+}
+
+// Reinserts the entries in place, after a compaction has moved the keys
+void rehashtable (object *run) {
+  unsigned int slots = 1<<(fixnumvalue(car(run))>>2), count = fixnumvalue(car(run+1)), n = 0;
+  object **entries = (object **)malloc((count+1)*sizeof(object *));
+  if (entries == NULL) error2("no room to rehash");
+  for (unsigned int i=0; i<slots; i++) {
+    object *entry = car(run+3+i);
+    if (entry != NULL && entry != TOMBSTONE) entries[n++] = entry;
+    car(run+3+i) = NULL;
+  }
+  for (unsigned int i=0; i<n; i++) *hashprobe(run, car(entries[i])) = entries[i];
+  free(entries);
+  car(run) = fixnum(fixnumvalue(car(run)) & ~HASHSTALE);
+  car(run+2) = fixnum(n);
+}
+
+object *hashrun (object *table) {
+  if (!hashtablep(table)) error("argument is not a hash table", table);
+  object *run = cdr(table);
+  if (fixnumvalue(car(run)) & HASHSTALE) rehashtable(run);
+  return run;
+}
+
+object *hashentry (object *table, object *key) {
+  object *entry = *hashprobe(hashrun(table), key);
+  return (entry == TOMBSTONE) ? NULL : entry;
+}
+
+// Moves the entries to a new run, doubling the slots unless removals have made room
+void growtable (object *table, object *env) {
+  object *run = cdr(table);
+  int info = fixnumvalue(car(run));
+  unsigned int bits = info>>2, slots = 1<<bits, count = fixnumvalue(car(run+1));
+  if ((count+1)*2 > slots) bits++;
+  object *newrun = makerun((1<<bits)+3, env);
+  car(newrun) = fixnum((info & HASHEQUAL) | bits<<2);
+  car(newrun+1) = fixnum(count); car(newrun+2) = fixnum(count);
+  for (unsigned int i=0; i<slots; i++) {
+    object *entry = car(run+3+i);
+    if (entry != NULL && entry != TOMBSTONE) *hashprobe(newrun, car(entry)) = entry;
+  }
+  cdr(table) = newrun;
+}
+
+// Returns the entry for key, adding it with value if it's missing
+object *puthash (object *table, object *key, object *value, object *env) {
+  object *run = hashrun(table);
+  object **slot = hashprobe(run, key);
+  if (*slot != NULL && *slot != TOMBSTONE) return *slot;
+  if (*slot == NULL) {
+    unsigned int slots = 1<<(fixnumvalue(car(run))>>2), used = fixnumvalue(car(run+2));
+    if ((used+1)*4 > slots*3) {
+      protect(table); protect(key); protect(value);
+      growtable(table, env);
+      unprotect(); unprotect(); unprotect();
+      run = cdr(table);
+      slot = hashprobe(run, key);
+    }
+    if (*slot == NULL) car(run+2) = fixnum(fixnumvalue(car(run+2)) + 1);
+  }
+  object *entry = cons(key, value);
+  *slot = entry;
+  car(run+1) = fixnum(fixnumvalue(car(run+1)) + 1);
+  return entry;
+}
+
+bool remhash (object *table, object *key) {
+  object *run = hashrun(table);
+  object **slot = hashprobe(run, key);
+  if (*slot == NULL || *slot == TOMBSTONE) return false;
+  *slot = TOMBSTONE;
+  car(run+1) = fixnum(fixnumvalue(car(run+1)) - 1);
+  return true;
+}
+
+// Records - a cell pointing to a run holding the descriptor then the slots
+// The descriptor is (name (slot keyword . default) ...), shared by the constructor, predicate, and accessors
+
+object **recordslot (object *record, object *desc, int index) {
+  if (!recordp(record) || car(cdr(record)) != desc) errorsym(first(desc)->name, "argument is not this type of structure", record);
+  return &car(cdr(record)+1+index);
+}
+
+// Makes a record from a list of keywords and values, evaluating the defaults of the other slots;
+// env is the caller's environment, kept safe if allocating the slots needs a gc
+object *makerecord (object *desc, object *args, object *env) {
+  for (object *a = args; a != NULL; a = cddr(a)) {
+    if (cdr(a) == NULL) errorsym(first(desc)->name, oddargs, args);
+    object *slot = cdr(desc);
+    while (slot != NULL && !(symbolp(first(a)) && second(first(slot))->name == first(a)->name)) slot = cdr(slot);
+    if (slot == NULL) errorsym(first(desc)->name, invalidkey, first(a));
+  }
+  object *record = myalloc();
+  record->type = RECORD;
+  cdr(record) = NULL;
+  protect(record);
+  object *run = makerun(listlength(cdr(desc))+1, env);
+  car(run) = desc;
+  cdr(record) = run;
+  int i = 1;
+  for (object *slot = cdr(desc); slot != NULL; slot = cdr(slot), i++) {
+    object *a = args;
+    while (a != NULL && first(a)->name != second(first(slot))->name) a = cddr(a);
+    car(run+i) = (a != NULL) ? second(a) : eval(cddr(first(slot)), NULL);
+  }
+  unprotect();
+  return record;
+}
+
+// The constructor, predicate, and accessors are bytecode: (entry depth OPLOCAL (op operand) desc OPRETURN)
+object *recordfn (object *name, int op, int operand, object *desc, bool rest) {
+  object *code = cons(number(OPRETURN), NULL);
+  code = cons(desc, code);
+  code = cons(number(op | operand<<8), code);
+  code = cons(number(OPLOCAL), code);
+  code = cons(number(4), code);
+  code = cons(number(OPENTRY | (rest ? 1<<16 : 1)<<8), code);
+  object *ptr = myalloc();
+  ptr->type = BYTECODE;
+  cdr(ptr) = cons(code, cons(name, NULL));
+  return ptr;
+}
+
+// Returns the (OPSLOT index) cell if function is a record accessor, so callers can do the load themselves
+object *accessorcode (object *function) {
+  object *header = cdr(function);
+  if (bytecodep(car(header))) return NULL;
+  object *pc = cddr(car(header));
+  if (car(pc) != number(OPLOCAL)) return NULL;
+  pc = cdr(pc);
+  if ((intval(car(pc)) & 0xFF) != OPSLOT || third(pc) != number(OPRETURN)) return NULL;
+  return pc;
+}
+
+void printrecord (object *record, pfun_t pfun) {
+  object *run = cdr(record), *desc = car(run);
+  pfstring("#S(", pfun); printobject(first(desc), pfun);
+  int i = 1;
+  for (object *slot = cdr(desc); slot != NULL; slot = cdr(slot), i++) {
+    pfun(' '); printobject(second(first(slot)), pfun);
+    pfun(' '); printobject(car(run+i), pfun);
+  }
+  pfun(')');
+}
+
 // Array utilities
 
 int nextpower2 (int n) {
@@ -1187,7 +1927,7 @@ object *makearray (object *dims, object *def, bool bitp) {
   int size = 1;
   object *dimensions = dims;
   while (dims != NULL) {
-    int d = car(dims)->integer;
+    int d = checkinteger(car(dims));
     if (d < 0) error2("dimension can't be negative");
     size = size * d;
     dims = cdr(dims);
@@ -1195,7 +1935,7 @@ object *makearray (object *dims, object *def, bool bitp) {
   // Bit array identified by making first dimension negative
   if (bitp) {
     size = (size + sizeof(int)*8 - 1)/(sizeof(int)*8);
-    car(dimensions) = number(-(car(dimensions)->integer));
+    car(dimensions) = number(-intval(car(dimensions)));
   }
   object *ptr = myalloc();
   ptr->type = ARRAY;
@@ -1221,7 +1961,7 @@ object **getarray (object *array, object *subs, object *env, int *bit) {
   bool bitp = false;
   object *dims = cddr(array);
   while (dims != NULL && subs != NULL) {
-    int d = car(dims)->integer;
+    int d = intval(car(dims));
     if (d < 0) { d = -d; bitp = true; }
     if (env) s = checkinteger(eval(car(subs), env)); else s = checkinteger(car(subs));
     if (s < 0 || s >= d) error("subscript out of range", car(subs));
@@ -1240,7 +1980,7 @@ object **getarray (object *array, object *subs, object *env, int *bit) {
 }
 
 void rslice (object *array, int size, int slice, object *dims, object *args) {
-  int d = first(dims)->integer;
+  int d = intval(first(dims));
   for (int i = 0; i < d; i++) {
     int index = slice * d + i;
     if (!consp(args)) error2("initial contents don't match array type");
@@ -1289,7 +2029,7 @@ object *readbitarray (gfun_t gfun) {
   while (head != NULL) {
     object **loc = arrayref(array, index>>(sizeof(int)==4 ? 5 : 4), size);
     int bit = index & (sizeof(int)==4 ? 0x1F : 0x0F);
-    *loc = number((((*loc)->integer) & ~(1<<bit)) | (car(head)->integer)<<bit);
+    *loc = number((intval(*loc) & ~(1<<bit)) | intval(car(head))<<bit);
     index++;
     head = cdr(head);
   }
@@ -1299,13 +2039,13 @@ object *readbitarray (gfun_t gfun) {
 void pslice (object *array, int size, int slice, object *dims, pfun_t pfun, bool bitp) {
   bool spaces = true;
   if (slice == -1) { spaces = false; slice = 0; }
-  int d = first(dims)->integer;
+  int d = intval(first(dims));
   if (d < 0) d = -d;
   for (int i = 0; i < d; i++) {
     if (i && spaces) pfun(' ');
     int index = slice * d + i;
     if (cdr(dims) == NULL) {
-      if (bitp) pint(((*arrayref(array, index>>(sizeof(int)==4 ? 5 : 4), size))->integer)>>
+      if (bitp) pint(intval(*arrayref(array, index>>(sizeof(int)==4 ? 5 : 4), size))>>
         (index & (sizeof(int)==4 ? 0x1F : 0x0F)) & 1, pfun);
       else printobject(*arrayref(array, index, size), pfun);
     } else { pfun('('); pslice(array, size, index, cdr(dims), pfun, bitp); pfun(')'); }
@@ -1318,7 +2058,7 @@ void printarray (object *array, pfun_t pfun) {
   bool bitp = false;
   int size = 1, n = 0;
   while (dims != NULL) {
-    int d = car(dims)->integer;
+    int d = intval(car(dims));
     if (d < 0) { bitp = true; d = -d; }
     size = size * d;
     dims = cdr(dims); n++;
@@ -1332,6 +2072,188 @@ void printarray (object *array, pfun_t pfun) {
   }
 }
 
+// Typed arrays - a header cell holding the element type and length, then a run of cells holding the raw elements
+
+const uint8_t ElementSize[] = { 1, 2, 2, 4, 4 };
+
+int typedlength (object *array) {
+  return array->integer>>3;
+}
+
+int typedelement (object *array) {
+  return array->integer & 7;
+}
+
+void *typeddata (object *array) {
+  return (void *)(array+1);
+}
+
+// The raw cells after a typed array header, which scans over the workspace must skip
+unsigned int rawcells (object *obj) {
+  if (obj->type != TYPEDARRAY) return 0;
+  return (typedlength(obj)*ElementSize[typedelement(obj)] + sizeof(object)-1)/sizeof(object);
+}
+
+object *maketypedarray (int length, int etype, object *def, object *env) {
+  if (length < 0) error2("dimension can't be negative");
+  object *array = makerun((length*ElementSize[etype] + sizeof(object)-1)/sizeof(object) + 1, env);
+  array->type = TYPEDARRAY;
+  array->integer = etype | length<<3;
+  fillelements(array, 0, length, def);
+  return array;
+}
+
+// Parses an element type: (unsigned-byte 8), (signed-byte 16), (unsigned-byte 16), (signed-byte 32), or single-float
+int elementtype (object *type) {
+  if (symbolp(type) && type->name == bufsymbol((char *)"single-float")->name) return SINGLEFLOAT;
+  if (consp(type) && symbolp(first(type)) && cdr(type) != NULL && integerp(second(type))) {
+    bool sign = first(type)->name == bufsymbol((char *)"signed-byte")->name;
+    if (sign || first(type)->name == bufsymbol((char *)"unsigned-byte")->name) {
+      int bits = intval(second(type));
+      if (!sign && bits == 8) return UBYTE8;
+      if (bits == 16) return sign ? SBYTE16 : UBYTE16;
+      if (sign && bits == 32) return SBYTE32;
+    }
+  }
+  error("unsupported element type", type);
+  return 0;
+}
+
+// Checks that value fits an element of the type, and returns it as an integer
+int32_t elementvalue (int etype, object *value) {
+  static const int32_t Minimum[] = { 0, -32768, 0, INT_MIN }, Maximum[] = { 255, 32767, 65535, INT_MAX };
+  int n = checkinteger(value);
+  if (n < Minimum[etype] || n > Maximum[etype]) error("value doesn't fit array element type", value);
+  return n;
+}
+
+object *typedref (object *array, int index) {
+  void *data = typeddata(array);
+  switch (typedelement(array)) {
+    case UBYTE8: return number(((uint8_t *)data)[index]);
+    case SBYTE16: return number(((int16_t *)data)[index]);
+    case UBYTE16: return number(((uint16_t *)data)[index]);
+    case SBYTE32: return number(((int32_t *)data)[index]);
+    default: return makefloat(((float *)data)[index]);
+  }
+}
+
+void settypedref (object *array, int index, object *value) {
+  void *data = typeddata(array);
+  int etype = typedelement(array);
+  if (etype == SINGLEFLOAT) { ((float *)data)[index] = checkintfloat(value); return; }
+  int32_t n = elementvalue(etype, value);
+  switch (etype) {
+    case UBYTE8: ((uint8_t *)data)[index] = n; break;
+    case SBYTE16: ((int16_t *)data)[index] = n; break;
+    case UBYTE16: ((uint16_t *)data)[index] = n; break;
+    default: ((int32_t *)data)[index] = n;
+  }
+}
+
+// Sets the elements from start below end to value, converting it once
+void fillelements (object *array, int start, int end, object *value) {
+  void *data = typeddata(array);
+  int etype = typedelement(array);
+  if (etype == SINGLEFLOAT) {
+    float f = checkintfloat(value);
+    float *p = (float *)data;
+    for (int i=start; i<end; i++) p[i] = f;
+    return;
+  }
+  int32_t n = elementvalue(etype, value);
+  if (etype == UBYTE8) memset((uint8_t *)data + start, n, end - start);
+  else if (etype == SBYTE32) { int32_t *p = (int32_t *)data; for (int i=start; i<end; i++) p[i] = n; }
+  else { int16_t *p = (int16_t *)data; for (int i=start; i<end; i++) p[i] = n; }
+}
+
+// Evaluates the single subscript of a typed array if env is not NULL, and checks it
+int typedindex (object *array, object *subs, object *env) {
+  if (subs == NULL) error2("too few subscripts");
+  if (cdr(subs) != NULL) error2("too many subscripts");
+  int index = checkinteger(env ? eval(car(subs), env) : car(subs));
+  if (index < 0 || index >= typedlength(array)) error("subscript out of range", car(subs));
+  return index;
+}
+
+void printtypedarray (object *array, pfun_t pfun) {
+  pfstring("#(", pfun);
+  int length = typedlength(array);
+  for (int i=0; i<length; i++) {
+    if (i) pfun(' ');
+    if (typedelement(array) == SINGLEFLOAT) pfloat(((float *)typeddata(array))[i], pfun);
+    else pint(intval(typedref(array, i)), pfun);
+  }
+  pfun(')');
+}
+
+// Sorting - a stable merge sort of an array of the list's cells, so the list stays intact while the predicate runs
+
+// Returns the index of a builtin predicate sort can call without apply, or -1
+int sortpredicate (object *predicate) {
+  if (!symbolp(predicate) || !builtinp(predicate->name)) return -1;
+  const intptr_t fns[] = { (intptr_t)fn_less, (intptr_t)fn_lesseq, (intptr_t)fn_greater, (intptr_t)fn_greatereq,
+    (intptr_t)fn_stringless, (intptr_t)fn_stringlesseq, (intptr_t)fn_stringgreater, (intptr_t)fn_stringgreatereq };
+  intptr_t fn = lookupfn(builtin(predicate->name));
+  for (int i=0; i<8; i++) if (fn == fns[i]) return i;
+  return -1;
+}
+
+// Does the item or key in the car of x go before the one in y; args is a two-element list to pass to the predicate
+bool sortbefore (object *x, object *y, object *predicate, int kind, object *args, object *env) {
+  car(args) = car(x);
+  car(cdr(args)) = car(y);
+  if (kind < 0) return apply(predicate, args, env) != nil;
+  bool lt = (kind & 2) == 0, eq = kind & 1;
+  if (kind < 4) return compare(args, lt, !lt, eq) != nil;
+  return stringcompare(args, lt, !lt, eq) != -1;
+}
+
+object *sortlist (object *list, object *predicate, object *key, object *env) {
+  int n = listlength(list);
+  if (n < 2) return list;
+  // The cell array lives in a typed array, so it's reclaimed if the predicate gives an error
+  object *buffer = maketypedarray(2*n*sizeof(object *)/ElementSize[SBYTE32], SBYTE32, number(0), env);
+  protect(buffer);
+  // With a key, the array holds (key . cell) pairs from a protected list, leaving the list itself untouched
+  object *pairs = cons(NULL, NULL);
+  protect(pairs);
+  object **src = (object **)typeddata(buffer), **dst = src + n, *ptr = list, *tail = pairs;
+  for (int i=0; i<n; i++) {
+    if (key != NULL) {
+      object *pair = cons(apply(key, cons(car(ptr), NULL), env), ptr);
+      cdr(tail) = cons(pair, NULL);
+      tail = cdr(tail);
+      src[i] = pair;
+    } else src[i] = ptr;
+    ptr = cdr(ptr);
+  }
+  int kind = sortpredicate(predicate);
+  object *args = cons(NULL, cons(NULL, NULL));
+  protect(args);
+  for (int width=1; width<n; width=width*2) {
+    for (int lo=0; lo<n; lo=lo+2*width) {
+      int mid = min(lo+width, n), hi = min(lo+2*width, n), i = lo, j = mid, k = lo;
+      // Runs already in order are copied
+      if (mid == hi || !sortbefore(src[mid], src[mid-1], predicate, kind, args, env)) {
+        while (k < hi) { dst[k] = src[k]; k++; }
+        continue;
+      }
+      while (i < mid && j < hi) {
+        if (sortbefore(src[j], src[i], predicate, kind, args, env)) dst[k++] = src[j++];
+        else dst[k++] = src[i++];
+      }
+      while (i < mid) dst[k++] = src[i++];
+      while (j < hi) dst[k++] = src[j++];
+    }
+    object **swap = src; src = dst; dst = swap;
+  }
+  unprotect(); unprotect(); unprotect();
+  if (key != NULL) for (int i=0; i<n; i++) src[i] = cdr(src[i]);
+  for (int i=0; i<n; i++) cdr(src[i]) = (i == n-1) ? NULL : src[i+1];
+  return src[0];
+}
+
 // String utilities
 
 void indent (uint8_t spaces, char ch, pfun_t pfun) {
@@ -1367,6 +2289,19 @@ void buildstring (char ch, object** tail) {
   car(cell) = NULL; cell->chars = ch<<24; *tail = cell;
 }
 
+// Appends n bytes to a string being built, packing whole cells at a time where it can
+void buildchars (const uint8_t *bytes, int n, object **tail) {
+  while (n > 0 && ((*tail)->chars & 0xFF) == 0) { buildstring(*bytes++, tail); n--; }
+  for (; n >= 4; n = n - 4, bytes = bytes + 4) {
+    if (!bytes[0] || !bytes[1] || !bytes[2] || !bytes[3]) break;
+    object *cell = myalloc(); car(*tail) = cell;
+    car(cell) = NULL;
+    cell->chars = (chars_t)((uint32_t)bytes[0]<<24 | bytes[1]<<16 | bytes[2]<<8 | bytes[3]);
+    *tail = cell;
+  }
+  while (n-- > 0) buildstring(*bytes++, tail);
+}
+
 object *copystring (object *arg) {
   object *obj = newstring();
   object *ptr = obj;
@@ -1394,29 +2329,50 @@ object *readstring (uint8_t delim, bool esc, gfun_t gfun) {
   return obj;
 }
 
+// String cursors - remember where the last lookups in a string got to, so stepping through
+// a string in order, or taking its length again, doesn't walk the chain from the start
+
+void clearcursors () {
+  CursorString[0] = NULL; CursorString[1] = NULL;
+  LengthString[0] = NULL; LengthString[1] = NULL;
+}
+
 int stringlength (object *form) {
   int length = 0;
-  form = cdr(form);
-  while (form != NULL) {
-    int chars = form->chars;
+  object *cell = cdr(form);
+  int c = (LengthString[0] == form) ? 0 : (LengthString[1] == form) ? 1 : -1;
+  if (c >= 0) { cell = LengthCell[c]; length = LengthChars[c]; }
+  object *last = NULL;
+  int before = 0;
+  while (cell != NULL) {
+    last = cell; before = length;
+    int chars = cell->chars;
     for (int i=(sizeof(int)-1)*8; i>=0; i=i-8) {
       if (chars>>i & 0xFF) length++;
     }
-    form = car(form);
+    cell = car(cell);
   }
+  // Strings only grow at the end, so start from the last cell next time
+  if (last == NULL) return length;
+  if (c < 0) { c = LengthNext; LengthNext = 1 - c; LengthString[c] = form; }
+  LengthCell[c] = last; LengthChars[c] = before;
   return length;
 }
 
 object **getcharplace (object *string, int n, int *shift) {
   object **arg = &cdr(string);
-  int top;
+  int top, i = 0;
   if (sizeof(int) == 4) { top = n>>2; *shift = 3 - (n&3); }
   else { top = n>>1; *shift = 1 - (n&1); }
   *shift = - (*shift + 2);
-  for (int i=0; i<top; i++) {
+  int c = (CursorString[0] == string) ? 0 : (CursorString[1] == string) ? 1 : -1;
+  if (c >= 0 && CursorCell[c] <= top) { arg = CursorPlace[c]; i = CursorCell[c]; }
+  for (; i<top; i++) {
     if (*arg == NULL) break;
     arg = &car(*arg);
   }
+  if (c < 0) { c = CursorNext; CursorNext = 1 - c; CursorString[c] = string; }
+  CursorPlace[c] = arg; CursorCell[c] = i;
   return arg;
 }
 
@@ -1471,13 +2427,84 @@ int stringcompare (object *args, bool lt, bool gt, bool eq) {
   if (eq) { m = m - sizeof(int); while (a != 0) { m++; a = a << 8;} return m;} else return -1;
 }
 
+// String search - a word-at-a-time scan for single characters, otherwise Horspool's algorithm
+// reading the target once through a ring buffer
+
+int searchchar (object *target, uint8_t ch, int start) {
+  int shift;
+  object *cell = *getcharplace(target, start, &shift);
+  int i = start, pos = (-shift-2)<<3;
+  if (cell != NULL && pos != 24) {
+    for (; pos>=0; pos=pos-8) {
+      uint8_t c = cell->chars>>pos & 0xFF;
+      if (c == ch) return i;
+      if (c == 0) return -1;
+      i++;
+    }
+    cell = car(cell);
+  }
+  chars_t pattern = ch * 0x01010101;
+  while (cell != NULL) {
+    chars_t x = cell->chars ^ pattern;
+    if (((x - 0x01010101) & ~x & 0x80808080) != 0) { // Some byte matches
+      for (pos=24; pos>=0; pos=pos-8) if ((cell->chars>>pos & 0xFF) == ch) return i + ((24-pos)>>3);
+    }
+    i = i + 4; cell = car(cell);
+  }
+  return -1;
+}
+
+int searchstring (object *pattern, object *target, int start) {
+  int m = stringlength(pattern), l = stringlength(target);
+  if (start > l - m) return -1;
+  if (m == 0) return start;
+  if (m == 1) return searchchar(target, nthchar(pattern, 0), start);
+  int size = 64;
+  while (size < m) size = size<<1;
+  uint8_t local[128];
+  uint8_t *pat = (size == 64) ? local : (uint8_t *)malloc(size*2);
+  if (pat == NULL) error2("no room to search");
+  uint8_t *ring = pat + size;
+  int mask = size - 1, shift, pos = 24, i = 0;
+  for (object *cell = cdr(pattern); i < m; i++) {
+    pat[i] = cell->chars>>pos & 0xFF;
+    pos = pos - 8;
+    if (pos < 0) { cell = car(cell); pos = 24; }
+  }
+  // Shifts are capped to fit a byte, which is still safe
+  uint8_t skip[256];
+  memset(skip, (m < 255) ? m : 255, 256);
+  for (int j=0; j<m-1; j++) skip[pat[j]] = (m-1-j < 255) ? m-1-j : 255;
+  object *cell = *getcharplace(target, start, &shift);
+  pos = (-shift-2)<<3;
+  int loaded = start, result = -1;
+  i = start;
+  while (i <= l - m) {
+    while (loaded < i + m) {
+      ring[loaded & mask] = cell->chars>>pos & 0xFF;
+      loaded++; pos = pos - 8;
+      if (pos < 0) { cell = car(cell); pos = 24; }
+    }
+    uint8_t last = ring[(i+m-1) & mask];
+    if (last == pat[m-1]) {
+      int j = m-2;
+      while (j >= 0 && ring[(i+j) & mask] == pat[j]) j--;
+      if (j < 0) { result = i; break; }
+    }
+    i = i + skip[last];
+  }
+  if (pat != local) free(pat);
+  return result;
+}
+
 object *documentation (object *arg, object *env) {
   if (arg == NULL) return nil;
   if (!symbolp(arg)) error(notasymbol, arg);
   object *pair = findpair(arg, env);
   if (pair != NULL) {
     object *val = cdr(pair);
-    if (listp(val) && first(val)->name == sym(LAMBDA) && cdr(val) != NULL && cddr(val) != NULL) {
+    if (bytecodep(val)) val = cddr(bytecodeheader(val)); // Its source
+    if (consp(val) && isbuiltin(first(val), LAMBDA) && cdr(val) != NULL && cddr(val) != NULL) {
       if (stringp(third(val))) return third(val);
     }
   }
@@ -1506,7 +2533,8 @@ object *apropos (object *arg, bool print) {
       if (print) {
         printsymbol(var, pserial); pserial(' '); pserial('(');
         if (consp(val) && isbuiltin(car(val), LAMBDA)) pfstring("user function", pserial);
-        else if (consp(val) && car(val)->type == CODE) pfstring("code", pserial);
+        else if (consp(val) && codep(car(val))) pfstring("code", pserial);
+        else if (bytecodep(val)) pfstring("compiled function", pserial);
         else pfstring("user symbol", pserial);
         pserial(')'); pln(pserial);
       } else {
@@ -1579,127 +2607,1080 @@ uint32_t ipstring (object *form) {
         else ipbytes[p] = (ipbytes[p] * 10) + ch - '0';
       }
     }
-    form = car(form);
+    form = car(form);
+  }
+  return ipaddress;
+}
+
+object *value (symbol_t n, object *env) {
+  while (env != NULL) {
+    object *pair = car(env);
+    if (pair != NULL && car(pair)->name == n) return pair;
+    env = cdr(env);
+  }
+  return nil;
+}
+
+object *findpair (object *var, object *env) {
+  symbol_t name = var->name;
+  object *pair = value(name, env);
+  if (pair == NULL) pair = globalpair(name);
+  return pair;
+}
+
+bool boundp (object *var, object *env) {
+  if (!symbolp(var)) error(notasymbol, var);
+  return (findpair(var, env) != NULL);
+}
+
+object *findvalue (object *var, object *env) {
+  if (!symbolp(var)) error(notasymbol, var);
+  object *pair = findpair(var, env);
+  if (pair == NULL) error("unknown variable", var);
+  return pair;
+}
+
+// Handling closures
+
+object *closure (int tc, symbol_t name, object *function, object *args, object **env) {
+  object *state = car(function);
+  function = cdr(function);
+  int trace = tracing(name);
+  if (trace) {
+    indent(TraceDepth[trace-1]<<1, ' ', pserial);
+    pint(TraceDepth[trace-1]++, pserial);
+    pserial(':'); pserial(' '); pserial('('); printsymbol(symbol(name), pserial);
+  }
+  object *params = first(function);
+  if (!listp(params)) errorsym(name, notalist, params);
+  function = cdr(function);
+  // Dropframe
+  if (tc) {
+    if (*env != NULL && car(*env) == NULL) {
+      pop(*env);
+      while (*env != NULL && car(*env) != NULL) pop(*env);
+    } else push(nil, *env);
+  }
+  // Push state
+  while (consp(state)) {
+    object *pair = first(state);
+    push(pair, *env);
+    state = cdr(state);
+  }
+  // Add arguments to environment
+  bool optional = false;
+  while (params != NULL) {
+    object *value;
+    object *var = first(params);
+    if (isbuiltin(var, OPTIONAL)) optional = true;
+    else {
+      if (consp(var)) {
+        if (!optional) errorsym(name, "invalid default value", var);
+        if (args == NULL) value = eval(second(var), *env);
+        else { value = first(args); args = cdr(args); }
+        var = first(var);
+        if (!symbolp(var)) errorsym(name, "illegal optional parameter", var);
+      } else if (!symbolp(var)) {
+        errorsym(name, "illegal function parameter", var);
+      } else if (isbuiltin(var, AMPREST)) {
+        params = cdr(params);
+        var = first(params);
+        value = args;
+        args = NULL;
+      } else {
+        if (args == NULL) {
+          if (optional) value = nil;
+          else errorsym2(name, toofewargs);
+        } else { value = first(args); args = cdr(args); }
+      }
+      push(cons(var,value), *env);
+      if (trace) { pserial(' '); printobject(value, pserial); }
+    }
+    params = cdr(params);
+  }
+  if (args != NULL) errorsym2(name, toomanyargs);
+  if (trace) { pserial(')'); pln(pserial); }
+  // Do an implicit progn
+  if (tc) push(nil, *env);
+  return tf_progn(function, *env);
+}
+
+object *apply (object *function, object *args, object *env) {
+  if (symbolp(function)) {
+    builtin_t fname = builtin(function->name);
+    if ((fname < ENDFUNCTIONS) && (fntype(fname) == FUNCTIONS)) {
+      Context = fname;
+      checkargs(args);
+      return ((fn_ptr_type)lookupfn(fname))(args, env);
+    } else function = eval(function, env);
+  }
+  if (bytecodep(function)) return callbytecode(function, args, env);
+  if (consp(function) && isbuiltin(car(function), LAMBDA)) {
+    object *result = closure(0, sym(NIL), function, args, &env);
+    return eval(result, env);
+  }
+  if (consp(function) && isbuiltin(car(function), CLOSURE)) {
+    function = cdr(function);
+    object *result = closure(0, sym(NIL), function, args, &env);
+    return eval(result, env);
+  }
+  error(illegalfn, function);
+  return NULL;
+}
+
+// Bytecode compiler - turns a lambda into a list of instructions, run by vm()
+// An instruction is a number holding the opcode and an operand, sometimes followed by an object;
+// jumps are followed by the instruction they go to
+
+void emit (object *obj) {
+  object *cell = cons(obj, NULL);
+  cdr(CompileTail) = cell;
+  CompileTail = cell;
+}
+
+void emitop (int op, int operand) {
+  emit(number(op | operand<<8));
+}
+
+// A global reference is followed by the symbol and a cache cell for its pair
+void emitglobal (int op, int operand, object *var) {
+  emitop(op, operand);
+  emit(var);
+  emit(nil);
+}
+
+void emitjump (int op, int operand, object *label) {
+  emitop(op, operand);
+  emit(NULL);
+  push(cons(CompileTail, label), CompileFixups);
+}
+
+// A label is placed after an instruction, and jumps go to the one that follows it
+object *newlabel () {
+  return cons(NULL, NULL);
+}
+
+void placelabel (object *label) {
+  car(label) = CompileTail;
+}
+
+void changedepth (int n) {
+  CompileDepth = CompileDepth + n;
+  if (CompileDepth > CompileMax) CompileMax = CompileDepth;
+}
+
+// Local variables are resolved to a frame slot at compile time; the scope holds (var . slot*2+boxed)
+// A variable that is both captured by a closure and assigned is kept in a box, a cons shared with the closure
+
+bool mentions (object *form, symbol_t name) {
+  while (consp(form)) {
+    if (mentions(car(form), name)) return true;
+    form = cdr(form);
+  }
+  return symbolp(form) && form->name == name;
+}
+
+bool captured (object *form, symbol_t name) {
+  if (!consp(form)) return false;
+  if (isbuiltin(car(form), LAMBDA)) return mentions(cdr(form), name);
+  for (; consp(form); form = cdr(form)) if (captured(car(form), name)) return true;
+  return false;
+}
+
+bool assigned (object *form, symbol_t name) {
+  if (!consp(form)) return false;
+  object *function = car(form);
+  if (symbolp(function) && builtinp(function->name)) {
+    fn_ptr_type fn = (fn_ptr_type)lookupfn(builtin(function->name));
+    if (fn == sp_setq || fn == sp_setf || fn == sp_incf || fn == sp_decf || fn == sp_push || fn == sp_pop) {
+      for (object *args = cdr(form); consp(args); args = cdr(args)) {
+        if (symbolp(car(args)) && car(args)->name == name) return true;
+      }
+    }
+  }
+  for (; consp(form); form = cdr(form)) if (assigned(car(form), name)) return true;
+  return false;
+}
+
+// Returns the scope entry for var in slot, boxing it if the forms in its scope need that
+object *localentry (object *var, int slot, object *forms, bool loopvar) {
+  if (!symbolp(var)) error(notasymbol, var);
+  bool boxed = captured(forms, var->name) && (loopvar || assigned(forms, var->name));
+  if (boxed) emitop(OPBOX, slot);
+  return cons(var, number(slot<<1 | boxed));
+}
+
+void bindlocal (object *var, int slot, object *forms, bool loopvar) {
+  push(localentry(var, slot, forms, loopvar), CompileScope);
+}
+
+int localslot (object *var) {
+  for (object *scope = CompileScope; scope != NULL; scope = cdr(scope)) {
+    if (car(first(scope))->name == var->name) return intval(cdr(first(scope)));
+  }
+  return -1;
+}
+
+void compilelocal (int local) {
+  emitop((local & 1) ? OPBOXREF : OPLOCAL, local>>1); changedepth(1);
+}
+
+void compilesetlocal (int local) {
+  emitop((local & 1) ? OPSETBOX : OPSETLOCAL, local>>1);
+}
+
+void compileconst (object *obj) {
+  emitop(OPCONST, 0); emit(obj);
+  changedepth(1);
+}
+
+// After calling something that might do a return, leave the loop or the function
+void compilecheck () {
+  if (CompileExit != NULL) emitjump(OPCHECKEXIT, CompileDepth-1-CompileExitDepth, CompileExit);
+  else emitop(OPCHECKRETURN, 0);
+}
+
+void compilesymbol (object *var) {
+  int local = localslot(var);
+  if (colonp(var->name)) compileconst(var);
+  else if (local >= 0) compilelocal(local);
+  else { emitglobal(OPGLOBAL, 0, var); changedepth(1); }
+}
+
+void compilesetq (object *var, object *form) {
+  if (!symbolp(var)) error(notasymbol, var);
+  compileform(form, false);
+  int local = localslot(var);
+  if (local >= 0) compilesetlocal(local);
+  else { emitglobal(OPSETGLOBAL, 0, var); }
+}
+
+void compilebody (object *forms, bool tail) {
+  if (forms == NULL) { compileconst(nil); return; }
+  while (cdr(forms) != NULL) {
+    compileform(car(forms), false);
+    emitop(OPPOP, 0); changedepth(-1);
+    forms = cdr(forms);
+  }
+  compileform(car(forms), tail);
+}
+
+int compileargs (object *args) {
+  int nargs = 0;
+  while (args != NULL) {
+    compileform(car(args), false);
+    nargs++;
+    args = cdr(args);
+  }
+  return nargs;
+}
+
+void compilelet (object *args, bool star, bool tail) {
+  if (args == NULL) error2(noargument);
+  object *assigns = first(args);
+  if (!listp(assigns)) error(notalist, assigns);
+  object *scope = CompileScope, *newscope = CompileScope;
+  int n = 0;
+  while (assigns != NULL) {
+    object *assign = car(assigns), *var = assign;
+    if (!consp(assign)) compileconst(nil);
+    else {
+      var = first(assign);
+      if (cdr(assign) == NULL) compileconst(nil); else compileform(second(assign), false);
+    }
+    push(localentry(var, CompileDepth-1, args, false), newscope);
+    if (star) CompileScope = newscope;
+    n++;
+    assigns = cdr(assigns);
+  }
+  CompileScope = newscope;
+  compilebody(cdr(args), tail);
+  if (n > 0) { emitop(OPSLIDE, n); changedepth(-n); }
+  CompileScope = scope;
+}
+
+void compileif (object *args, bool tail) {
+  if (args == NULL || cdr(args) == NULL) error2(toofewargs);
+  object *otherwise = newlabel(), *end = newlabel();
+  compileform(first(args), false);
+  emitjump(OPJUMPNIL, 0, otherwise); changedepth(-1);
+  compileform(second(args), tail);
+  emitjump(OPJUMP, 0, end); changedepth(-1);
+  placelabel(otherwise);
+  args = cddr(args);
+  if (args != NULL) compileform(first(args), tail); else compileconst(nil);
+  placelabel(end);
+}
+
+void compilewhen (object *args, bool when, bool tail) {
+  if (args == NULL) error2(noargument);
+  object *end = newlabel();
+  compileform(first(args), false);
+  if (when) {
+    emitjump(OPANDJUMP, 0, end); changedepth(-1);
+  } else {
+    object *body = newlabel();
+    emitjump(OPJUMPNIL, 0, body); changedepth(-1);
+    compileconst(nil);
+    emitjump(OPJUMP, 0, end); changedepth(-1);
+    placelabel(body);
+  }
+  compilebody(cdr(args), tail);
+  placelabel(end);
+}
+
+void compilecond (object *args, bool tail) {
+  object *end = newlabel();
+  while (args != NULL) {
+    object *clause = first(args);
+    if (!consp(clause)) error(illegalclause, clause);
+    compileform(first(clause), false);
+    if (cdr(clause) == NULL) {
+      emitjump(OPORJUMP, 0, end); changedepth(-1);
+    } else {
+      object *next = newlabel();
+      emitjump(OPJUMPNIL, 0, next); changedepth(-1);
+      compilebody(cdr(clause), tail);
+      emitjump(OPJUMP, 0, end); changedepth(-1);
+      placelabel(next);
+    }
+    args = cdr(args);
+  }
+  compileconst(nil);
+  placelabel(end);
+}
+
+void compileandor (object *args, bool andp, bool tail) {
+  if (args == NULL) { compileconst(andp ? tee : nil); return; }
+  object *end = newlabel();
+  while (cdr(args) != NULL) {
+    compileform(car(args), false);
+    emitjump(andp ? OPANDJUMP : OPORJUMP, 0, end); changedepth(-1);
+    args = cdr(args);
+  }
+  compileform(car(args), tail);
+  placelabel(end);
+}
+
+void compilesetqs (object *args) {
+  if (args == NULL) { compileconst(nil); return; }
+  while (args != NULL) {
+    if (cdr(args) == NULL) error2(oddargs);
+    compilesetq(first(args), second(args));
+    args = cddr(args);
+    if (args != NULL) { emitop(OPPOP, 0); changedepth(-1); }
+  }
+}
+
+void compileincf (object *args, int op, builtin_t name) {
+  object *var = first(args);
+  compileform(var, false);
+  if (cdr(args) != NULL) compileform(second(args), false); else compileconst(number(1));
+  emitop(op, name); changedepth(-1);
+  int local = localslot(var);
+  if (local >= 0) compilesetlocal(local);
+  else { emitglobal(OPSETGLOBAL, 0, var); }
+}
+
+void compilepush (object *args) {
+  object *var = second(args);
+  compileform(first(args), false);
+  compilesymbol(var);
+  emitop(OPCONS, 0); changedepth(-1);
+  int local = localslot(var);
+  if (local >= 0) compilesetlocal(local);
+  else { emitglobal(OPSETGLOBAL, 0, var); }
+}
+
+void compilepop (object *args, builtin_t name) {
+  object *var = first(args);
+  compilesymbol(var); compilesymbol(var);
+  emitop(OPCDR, name);
+  int local = localslot(var);
+  if (local >= 0) compilesetlocal(local);
+  else { emitglobal(OPSETGLOBAL, 0, var); }
+  emitop(OPPOP, 0); changedepth(-1);
+  emitop(OPCAR, name);
+}
+
+void compilereturn (object *args) {
+  if (args != NULL) compileform(first(args), false); else compileconst(nil);
+  if (CompileExit == NULL) { emitop(OPRETURNFLAG, 0); return; }
+  int slide = CompileDepth-1-CompileExitDepth;
+  if (slide > 0) emitop(OPSLIDE, slide);
+  emitjump(OPJUMP, 0, CompileExit);
+}
+
+// Loops leave their value at the depth they started, which is where a return slides its value down to
+void beginloop (object **exit, int *depth) {
+  *exit = CompileExit; *depth = CompileExitDepth;
+  CompileExit = newlabel(); CompileExitDepth = CompileDepth;
+}
+
+void endloop (object *exit, int depth) {
+  placelabel(CompileExit);
+  CompileExit = exit; CompileExitDepth = depth;
+}
+
+void compileloop (object *args) {
+  object *exit; int depth;
+  beginloop(&exit, &depth);
+  object *start = newlabel();
+  placelabel(start);
+  while (args != NULL) {
+    compileform(car(args), false);
+    emitop(OPPOP, 0); changedepth(-1);
+    args = cdr(args);
+  }
+  emitjump(OPLOOP, 0, start);
+  changedepth(1);
+  endloop(exit, depth);
+}
+
+void compiledotimes (object *args, builtin_t name) {
+  object *params = checkarguments(args, 2, 3);
+  object *scope = CompileScope;
+  int d = CompileDepth;
+  compileform(second(params), false); // Count
+  compileconst(number(0)); // Index
+  compileconst(number(0)); // Variable
+  object *var = first(params);
+  bindlocal(var, d+2, args, true);
+  int local = localslot(var);
+  object *exit; int depth;
+  beginloop(&exit, &depth);
+  object *start = newlabel(), *done = newlabel();
+  placelabel(start);
+  emitop(OPLOCAL, d+1); emitop(OPLOCAL, d); changedepth(2);
+  emitop(OPLESS, name); changedepth(-1);
+  emitjump(OPJUMPNIL, 0, done); changedepth(-1);
+  emitop(OPLOCAL, d+1); compilesetlocal(local); emitop(OPPOP, 0);
+  for (object *forms = cdr(args); forms != NULL; forms = cdr(forms)) {
+    compileform(car(forms), false);
+    emitop(OPPOP, 0); changedepth(-1);
+  }
+  emitop(OPLOCAL, d+1); emitop(OPONEPLUS, name); emitop(OPSETLOCAL, d+1); emitop(OPPOP, 0);
+  emitjump(OPLOOP, 0, start);
+  placelabel(done);
+  emitop(OPLOCAL, d+1); compilesetlocal(local); emitop(OPPOP, 0);
+  params = cddr(params);
+  if (params != NULL) compileform(car(params), false); else compileconst(nil);
+  endloop(exit, depth);
+  emitop(OPSLIDE, 3); changedepth(-3);
+  CompileScope = scope;
+}
+
+void compiledolist (object *args, builtin_t name) {
+  object *params = checkarguments(args, 2, 3);
+  object *scope = CompileScope;
+  int d = CompileDepth;
+  compileform(second(params), false); // List
+  compileconst(nil); // Variable
+  object *var = first(params);
+  bindlocal(var, d+1, args, true);
+  int local = localslot(var);
+  object *exit; int depth;
+  beginloop(&exit, &depth);
+  object *start = newlabel(), *done = newlabel();
+  placelabel(start);
+  emitop(OPLOCAL, d); changedepth(1);
+  emitjump(OPJUMPNIL, 0, done); changedepth(-1);
+  emitop(OPLOCAL, d); emitop(OPCAR, name); compilesetlocal(local); emitop(OPPOP, 0);
+  for (object *forms = cdr(args); forms != NULL; forms = cdr(forms)) {
+    compileform(car(forms), false);
+    emitop(OPPOP, 0); changedepth(-1);
+  }
+  emitop(OPLOCAL, d); emitop(OPCDR, name); emitop(OPSETLOCAL, d); emitop(OPPOP, 0);
+  emitjump(OPLOOP, 0, start);
+  placelabel(done);
+  compileconst(nil); compilesetlocal(local); emitop(OPPOP, 0); changedepth(-1);
+  params = cddr(params);
+  if (params != NULL) compileform(car(params), false); else compileconst(nil);
+  endloop(exit, depth);
+  emitop(OPSLIDE, 2); changedepth(-2);
+  CompileScope = scope;
+}
+
+// Anything else is handed to eval with the local variables in an environment, and copied back afterwards
+void compileeval (object *form) {
+  if (mentions(form, sym(LAMBDA))) error("can't compile a closure", form);
+  emitop(OPEVALFORM, 0); emit(cons(form, CompileScope));
+  changedepth(1);
+  compilecheck();
+}
+
+void compilebuiltin (object *form, builtin_t name, bool tail) {
+  object *args = cdr(form);
+  fn_ptr_type fn = (fn_ptr_type)lookupfn(name);
+  switch (fntype(name)) {
+    case OTHER_FORMS: error(illegalfn, car(form));
+    case SPECIAL_FORMS: case TAIL_FORMS:
+      if (fn == sp_quote) compileconst(first(args));
+      else if (fn == tf_progn) compilebody(args, tail);
+      else if (fn == tf_if) compileif(args, tail);
+      else if (fn == tf_when) compilewhen(args, true, tail);
+      else if (fn == tf_unless) compilewhen(args, false, tail);
+      else if (fn == tf_cond) compilecond(args, tail);
+      else if (fn == tf_case) compilecase(args, tail);
+      else if (fn == tf_and) compileandor(args, true, tail);
+      else if (fn == sp_or) compileandor(args, false, tail);
+      else if (fn == sp_setq) compilesetqs(args);
+      else if (fn == sp_setf && cddr(args) == NULL && symbolp(first(args))) compilesetqs(args);
+      else if (fn == sp_incf && symbolp(first(args))) compileincf(args, OPADD, name);
+      else if (fn == sp_decf && symbolp(first(args))) compileincf(args, OPSUBTRACT, name);
+      else if (fn == sp_push && cdr(args) != NULL && symbolp(second(args))) compilepush(args);
+      else if (fn == sp_pop && args != NULL && symbolp(first(args))) compilepop(args, name);
+      else if (fn == sp_loop) compileloop(args);
+      else if (fn == sp_dotimes) compiledotimes(args, name);
+      else if (fn == sp_dolist) compiledolist(args, name);
+      else compileeval(form);
+      return;
+  }
+  if (fn == fn_return) { compilereturn(args); return; }
+  int nargs = compileargs(args), op = -1;
+  // A global function with the builtin's name takes precedence, as in eval
+  emitglobal(OPSHADOWED, nargs, car(form));
+  if (nargs == 2) {
+    if (fn == fn_add) op = OPADD;
+    else if (fn == fn_subtract) op = OPSUBTRACT;
+    else if (fn == fn_less) op = OPLESS;
+    else if (fn == fn_greater) op = OPGREATER;
+    else if (fn == fn_lesseq) op = OPLESSEQ;
+    else if (fn == fn_greatereq) op = OPGREATEREQ;
+    else if (fn == fn_numeq) op = OPNUMEQ;
+    else if (fn == fn_cons) op = OPCONS;
+    else if (fn == fn_eq) op = OPEQ;
+  } else if (nargs == 1) {
+    if (fn == fn_oneplus) op = OPONEPLUS;
+    else if (fn == fn_oneminus) op = OPONEMINUS;
+    else if (fn == fn_car) op = OPCAR;
+    else if (fn == fn_cdr) op = OPCDR;
+    else if (fn == fn_zerop) op = OPZEROP;
+    else if (fn == fn_not) op = OPNOT;
+  }
+  if (op >= 0) emitop(op, name);
+  else {
+    if (nargs > 255) error2("too many arguments to compile");
+    emitop(OPCALLBUILTIN, nargs | name<<8);
+  }
+  changedepth(1-nargs);
+  if (fn == fn_funcall || fn == fn_apply) compilecheck();
+}
+
+void compileform (object *form, bool tail) {
+  if (form == NULL || !consp(form)) {
+    if (symbolp(form)) compilesymbol(form); else compileconst(form);
+    return;
+  }
+  object *function = car(form), *args = cdr(form);
+  if (!listp(args)) error("can't evaluate a dotted pair", args);
+  if (!symbolp(function)) error("can't compile", form);
+  int local = localslot(function);
+  if (local >= 0) {
+    compilelocal(local);
+    int nargs = compileargs(args);
+    emitop(OPCALLVALUE, nargs); changedepth(-nargs);
+    compilecheck();
+  } else if (builtinp(function->name)) {
+    builtin_t name = builtin(function->name);
+    if (name == QUOTE) compileconst(first(args));
+    else if (name == LAMBDA) compileclosure(form);
+    else if (name == LET || name == LETSTAR) compilelet(args, name == LETSTAR, tail);
+    else compilebuiltin(form, name, tail);
+  } else {
+    int nargs = compileargs(args);
+    if (tail && CompileName != NULL && function->name == CompileName->name && nargs == CompileSimple) {
+      emitglobal(OPSELFTAIL, nargs, function); changedepth(1-nargs);
+    } else {
+      emitglobal(OPCALL, nargs, function); changedepth(1-nargs);
+      compilecheck();
+    }
+  }
+}
+
+void compilecase (object *args, bool tail) {
+  if (args == NULL) error2(noargument);
+  object *end = newlabel();
+  compileform(first(args), false);
+  for (args = cdr(args); args != NULL; args = cdr(args)) {
+    object *clause = first(args);
+    if (!consp(clause)) error(illegalclause, clause);
+    object *key = car(clause), *body = newlabel();
+    if (consp(key)) {
+      for (; key != NULL; key = cdr(key)) {
+        emitop(OPMATCH, 0); emit(car(key)); emit(NULL);
+        push(cons(CompileTail, body), CompileFixups);
+      }
+    } else if (key == tee) emitjump(OPJUMP, 0, body);
+    else {
+      emitop(OPMATCH, 0); emit(key); emit(NULL);
+      push(cons(CompileTail, body), CompileFixups);
+    }
+    object *next = newlabel();
+    emitjump(OPJUMP, 0, next);
+    placelabel(body);
+    emitop(OPPOP, 0); changedepth(-1);
+    compilebody(cdr(clause), tail);
+    emitjump(OPJUMP, 0, end);
+    placelabel(next);
+  }
+  emitop(OPPOP, 0); changedepth(-1);
+  compileconst(nil);
+  placelabel(end);
+}
+
+// A lambda becomes a flat closure, holding just the values or boxes of the local variables it mentions
+void compileclosure (object *form) {
+  if (cdr(form) == NULL) error2(noargument);
+  object *free = NULL;
+  int n = 0;
+  for (object *scope = CompileScope; scope != NULL; scope = cdr(scope)) {
+    object *var = car(first(scope));
+    if (mentions(cdr(form), var->name) && localslot(var) == intval(cdr(first(scope)))) { push(first(scope), free); n++; }
+  }
+  for (object *f = free; f != NULL; f = cdr(f)) {
+    emitop(OPLOCAL, intval(cdr(first(f)))>>1); changedepth(1);
+  }
+  // Compile the lambda, keeping this function's state
+  object *tail = CompileTail, *scope = CompileScope, *fixups = CompileFixups, *name = CompileName, *exit = CompileExit;
+  int depth = CompileDepth, max = CompileMax, exitdepth = CompileExitDepth, simple = CompileSimple;
+  object *bytecode = compilelambda(NULL, form, free);
+  CompileTail = tail; CompileScope = scope; CompileFixups = fixups; CompileName = name; CompileExit = exit;
+  CompileDepth = depth; CompileMax = max; CompileExitDepth = exitdepth; CompileSimple = simple;
+  if (n == 0) { compileconst(bytecode); return; }
+  emitop(OPCLOSURE, n); emit(bytecode);
+  changedepth(1-n);
+}
+
+// Returns a bytecode object holding (code name . function); a closure's frame has the free variables after the function
+object *compilelambda (object *name, object *function, object *free) {
+  object *params = second(function);
+  if (!listp(params)) error(notalist, params);
+  object *code = cons(NULL, NULL);
+  CompileTail = code; CompileScope = NULL; CompileFixups = NULL; CompileExit = NULL; CompileName = name;
+  int nreq = 0, nopt = 0, rest = 0;
+  bool optional = false;
+  for (object *p = params; p != NULL; p = cdr(p)) {
+    object *var = first(p);
+    if (isbuiltin(var, OPTIONAL)) optional = true;
+    else if (isbuiltin(var, AMPREST)) {
+      if (cdr(p) == NULL) error2("missing &rest variable");
+      rest = 1;
+      break;
+    } else {
+      if (consp(var) && !optional) error("invalid default value", var);
+      if (optional) nopt++; else nreq++;
+    }
+  }
+  CompileDepth = nreq + nopt + rest + 1; // The function itself is kept above the parameters
+  for (object *f = free; f != NULL; f = cdr(f)) {
+    push(cons(car(first(f)), number(CompileDepth<<1 | (intval(cdr(first(f))) & 1))), CompileScope);
+    CompileDepth++;
+  }
+  CompileMax = CompileDepth;
+  CompileSimple = (nopt == 0 && rest == 0 && free == NULL) ? nreq : -1;
+  emitop(OPENTRY, nreq | nopt<<8 | rest<<16);
+  emit(NULL);
+  object *maxdepth = CompileTail;
+  // Bind the parameters, with the default values of optional ones
+  object *forms = cdr(function);
+  int i = 0;
+  optional = false;
+  for (object *p = params; p != NULL; p = cdr(p)) {
+    object *var = first(p);
+    if (isbuiltin(var, OPTIONAL)) optional = true;
+    else if (isbuiltin(var, AMPREST)) { bindlocal(second(p), nreq+nopt, forms, false); break; }
+    else {
+      if (optional && consp(var)) {
+        if (cdr(var) != NULL) {
+          object *skip = newlabel();
+          emitjump(OPOPTIONAL, i, skip);
+          compileform(second(var), false);
+          emitop(OPSETLOCAL, i); emitop(OPPOP, 0); changedepth(-1);
+          placelabel(skip);
+        }
+        var = first(var);
+      }
+      bindlocal(var, i, forms, false);
+      i++;
+    }
   }
-  return ipaddress;
+  compilebody(cddr(function), true);
+  emitop(OPRETURN, 0);
+  car(maxdepth) = number(CompileMax + 1); // Room for an argument list
+  for (object *f = CompileFixups; f != NULL; f = cdr(f)) {
+    object *fixup = first(f);
+    car(car(fixup)) = cdr(car(cdr(fixup)));
+  }
+  CompileTail = NULL; CompileScope = NULL; CompileFixups = NULL;
+  object *ptr = myalloc();
+  ptr->type = BYTECODE;
+  cdr(ptr) = cons(cdr(code), cons(name, function));
+  return ptr;
 }
 
-object *value (symbol_t n, object *env) {
-  while (env != NULL) {
-    object *pair = car(env);
-    #if !defined(BOARD_HAS_PSRAM)
-    if (pair != NULL && car(pair)->name == n) return pair;
-    #else
-    if (pair != NULL && eqsymbol(car(pair)->name, n)) return pair;
-    #endif
-    env = cdr(env);
-  }
-  return nil;
+// Bytecode virtual machine - the arguments and local variables of each call are a frame on VMStack
+
+// A closure holds (template . free values), and shares the (code name . function) of its template
+object *bytecodeheader (object *function) {
+  object *header = cdr(function);
+  return bytecodep(car(header)) ? cdr(car(header)) : header;
 }
 
-object *findpair (object *var, object *env) {
-  symbol_t name = var->name;
-  object *pair = value(name, env);
-  if (pair == NULL) pair = value(name, GlobalEnv);
-  return pair;
+// Reached on calls and loops, as eval does on every form
+void vmcheck (int top) {
+  if (Freespace <= WORKSPACESIZE>>4) { VMTop = top; gc(NULL, NULL); }
+  if (tstflag(ESCAPE)) { clrflag(ESCAPE); error2("escape!");}
+  if (!tstflag(NOESC)) testescape();
 }
 
-bool boundp (object *var, object *env) {
-  if (!symbolp(var)) error(notasymbol, var);
-  return (findpair(var, env) != NULL);
+// Calls fn with the nargs values at args on the stack as a list, kept on the stack above them
+object *vmapply (fn_ptr_type fn, int args, int nargs) {
+  object *list = NULL;
+  for (int i=nargs-1; i>=0; i--) list = cons(VMStack[args+i], list);
+  VMStack[args+nargs] = list;
+  VMTop = args+nargs+1;
+  return fn(list, NULL);
 }
 
-object *findvalue (object *var, object *env) {
-  object *pair = findpair(var, env);
-  if (pair == NULL) error("unknown variable", var);
-  return pair;
+const fn_ptr_type Fallbacks[] = { fn_add, fn_subtract, fn_less, fn_greater, fn_lesseq, fn_greatereq, fn_numeq,
+  fn_oneplus, fn_oneminus, fn_car, fn_cdr, fn_cons, fn_zerop };
+
+object *vmfallback (int op, builtin_t name, int args, int nargs) {
+  Context = name;
+  object *result = vmapply(Fallbacks[op-OPADD], args, nargs);
+  VMTop = args+nargs;
+  return result;
 }
 
-// Handling closures
+// Makes a closure from template and the n free values at values on the stack
+object *vmclosure (object *bytecode, int values, int n) {
+  object *list = NULL;
+  for (int i=n-1; i>=0; i--) list = cons(VMStack[values+i], list);
+  object *ptr = myalloc();
+  ptr->type = BYTECODE;
+  cdr(ptr) = cons(bytecode, list);
+  return ptr;
+}
 
-object *closure (int tc, symbol_t name, object *function, object *args, object **env) {
-  object *state = car(function);
-  function = cdr(function);
-  int trace = tracing(name);
-  if (trace) {
-    indent(TraceDepth[trace-1]<<1, ' ', pserial);
-    pint(TraceDepth[trace-1]++, pserial);
-    pserial(':'); pserial(' '); pserial('('); printsymbol(symbol(name), pserial);
-  }
-  object *params = first(function);
-  if (!listp(params)) errorsym(name, notalist, params);
-  function = cdr(function);
-  // Dropframe
-  if (tc) {
-    if (*env != NULL && car(*env) == NULL) {
-      pop(*env);
-      while (*env != NULL && car(*env) != NULL) pop(*env);
-    } else push(nil, *env);
-  }
-  // Push state
-  while (consp(state)) {
-    object *pair = first(state);
-    push(pair, *env);
-    state = cdr(state);
-  }
-  // Add arguments to environment
-  bool optional = false;
-  while (params != NULL) {
-    object *value;
-    object *var = first(params);
-    if (isbuiltin(var, OPTIONAL)) optional = true;
-    else {
-      if (consp(var)) {
-        if (!optional) errorsym(name, "invalid default value", var);
-        if (args == NULL) value = eval(second(var), *env);
-        else { value = first(args); args = cdr(args); }
-        var = first(var);
-        if (!symbolp(var)) errorsym(name, "illegal optional parameter", var);
-      } else if (!symbolp(var)) {
-        errorsym(name, "illegal function parameter", var);
-      } else if (isbuiltin(var, AMPREST)) {
-        params = cdr(params);
-        var = first(params);
-        value = args;
-        args = NULL;
-      } else {
-        if (args == NULL) {
-          if (optional) value = nil;
-          else errorsym2(name, toofewargs);
-        } else { value = first(args); args = cdr(args); }
-      }
-      push(cons(var,value), *env);
-      if (trace) { pserial(' '); printobject(value, pserial); }
-    }
-    params = cdr(params);
+// Interprets form with the locals it mentions bound in an environment, then writes them back
+object *vmevalform (object *form, int base, int sp) {
+  object **stack = &VMStack[base];
+  object *env = NULL, *tail = NULL;
+  for (object *scope = cdr(form); scope != NULL; scope = cdr(scope)) {
+    int local = intval(cdr(first(scope)));
+    object *value = (local & 1) ? car(stack[local>>1]) : stack[local>>1];
+    object *cell = cons(cons(car(first(scope)), value), NULL);
+    if (env == NULL) env = cell; else cdr(tail) = cell;
+    tail = cell;
+    stack[sp] = env; // Keep it safe from gc
+  }
+  stack[sp] = env;
+  VMTop = base+sp+1;
+  object *result = eval(car(form), env);
+  for (object *scope = cdr(form); scope != NULL; scope = cdr(scope)) {
+    int local = intval(cdr(first(scope)));
+    if (local & 1) car(stack[local>>1]) = cdr(first(env)); else stack[local>>1] = cdr(first(env));
+    env = cdr(env);
   }
-  if (args != NULL) errorsym2(name, toomanyargs);
-  if (trace) { pserial(')'); pln(pserial); }
-  // Do an implicit progn
-  if (tc) push(nil, *env);
-  return tf_progn(function, *env);
+  return result;
 }
 
-object *apply (object *function, object *args, object *env) {
+object *vmcall (object *function, int args, int nargs) {
+  if (bytecodep(function)) return vm(function, args, nargs);
   if (symbolp(function)) {
-    builtin_t fname = builtin(function->name);
-    if ((fname < ENDFUNCTIONS) && (fntype(fname) == FUNCTIONS)) {
-      Context = fname;
-      checkargs(args);
-      return ((fn_ptr_type)lookupfn(fname))(args, env);
-    } else function = eval(function, env);
+    builtin_t name = builtin(function->name);
+    if (!builtinp(function->name) || fntype(name) != FUNCTIONS) { Context = NIL; error(illegalfn, function); }
+    Context = name;
+    checkminmax(name, nargs);
+    return vmapply((fn_ptr_type)lookupfn(name), args, nargs);
   }
-  if (consp(function) && isbuiltin(car(function), LAMBDA)) {
-    object *result = closure(0, sym(NIL), function, args, &env);
-    return eval(result, env);
+  object *list = NULL;
+  for (int i=nargs-1; i>=0; i--) list = cons(VMStack[args+i], list);
+  VMStack[args+nargs] = list;
+  VMTop = args+nargs+1;
+  return apply(function, list, NULL);
+}
+
+// Calls a bytecode function from eval or apply, keeping the caller's environment safe from gc
+object *callbytecode (object *function, object *args, object *env) {
+  int base = VMTop, top = base;
+  while (args != NULL) {
+    if (top >= VMSTACKSIZE-1) { Context = NIL; error2("stack overflow"); }
+    VMStack[top++] = car(args);
+    args = cdr(args);
   }
-  if (consp(function) && isbuiltin(car(function), CLOSURE)) {
-    function = cdr(function);
-    object *result = closure(0, sym(NIL), function, args, &env);
-    return eval(result, env);
+  VMTop = top;
+  protect(env);
+  object *result = vm(function, base, top-base);
+  unprotect();
+  VMTop = base;
+  return result;
+}
+
+// The cached pair is valid until makunbound retires it
+object *vmglobal (object *pc) {
+  object *var = car(pc), *pair = second(pc);
+  if (pair == NULL || car(pair) == NULL || car(pair)->name != var->name) {
+    if (GlobalShadows == 0 && builtinp(var->name)) return nil;
+    pair = globalpair(var->name);
+    second(pc) = pair;
+  }
+  return pair;
+}
+
+object *vm (object *function, int base, int nargs) {
+  bool stackpos;
+  if ((uint32_t)StackBottom - (uint32_t)&stackpos > MAX_STACK) { Context = NIL; error2("stack overflow"); }
+  object *header = cdr(function), *free = NULL;
+  if (bytecodep(car(header))) { free = cdr(header); header = cdr(car(header)); }
+  object *pc = car(header);
+  int info = intval(car(pc))>>8, nreq = info & 0xFF, nfixed = nreq + (info>>8 & 0xFF);
+  pc = cdr(pc);
+  int maxdepth = intval(car(pc));
+  pc = cdr(pc);
+  if (nargs < nreq || (nargs > nfixed && !(info & 0x10000))) {
+    symbol_t name = (second(header) == NULL) ? sym(NIL) : second(header)->name;
+    errorsym2(name, (nargs < nreq) ? toofewargs : toomanyargs);
+  }
+  if (base + nargs + maxdepth > VMSTACKSIZE) { Context = NIL; error2("stack overflow"); }
+  object **stack = &VMStack[base];
+  int sp = nargs;
+  while (sp < nfixed) stack[sp++] = nil;
+  if (info & 0x10000) {
+    object *rest = NULL;
+    while (sp > nfixed) rest = cons(stack[--sp], rest);
+    stack[sp++] = rest;
+  }
+  stack[sp++] = function;
+  while (free != NULL) { stack[sp++] = car(free); free = cdr(free); }
+  object *start = pc;
+  vmcheck(base+sp);
+  for (;;) {
+    int instruction = intval(car(pc)), a = instruction>>8;
+    pc = cdr(pc);
+    switch (instruction & 0xFF) {
+      case OPCONST:
+        stack[sp++] = car(pc); pc = cdr(pc);
+        break;
+      case OPLOCAL:
+        stack[sp] = stack[a]; sp++;
+        break;
+      case OPSETLOCAL:
+        stack[a] = stack[sp-1];
+        break;
+      case OPGLOBAL: {
+        object *var = car(pc), *pair = vmglobal(pc); pc = cddr(pc);
+        if (pair != NULL) stack[sp++] = cdr(pair);
+        else if (builtinp(var->name)) {
+          VMTop = base+sp;
+          stack[sp] = (var->name == sym(FEATURES)) ? features() : var; sp++;
+        }
+        else { Context = NIL; error("undefined", var); }
+        break;
+      }
+      case OPSETGLOBAL: {
+        object *var = car(pc), *pair = vmglobal(pc); pc = cddr(pc);
+        if (pair == NULL) { Context = NIL; error("unknown variable", var); }
+        cdr(pair) = stack[sp-1];
+        break;
+      }
+      case OPPOP:
+        sp--;
+        break;
+      case OPSLIDE:
+        stack[sp-1-a] = stack[sp-1]; sp = sp - a;
+        break;
+      case OPJUMP:
+        pc = car(pc);
+        break;
+      case OPLOOP:
+        pc = car(pc);
+        vmcheck(base+sp);
+        break;
+      case OPJUMPNIL:
+        pc = (stack[--sp] == nil) ? car(pc) : cdr(pc);
+        break;
+      case OPANDJUMP:
+        if (stack[sp-1] == nil) pc = car(pc); else { sp--; pc = cdr(pc); }
+        break;
+      case OPORJUMP:
+        if (stack[sp-1] != nil) pc = car(pc); else { sp--; pc = cdr(pc); }
+        break;
+      case OPOPTIONAL:
+        pc = (nargs > a) ? car(pc) : cdr(pc);
+        break;
+      case OPCALL: {
+        object *var = car(pc), *pair = vmglobal(pc); pc = cddr(pc);
+        if (pair == NULL) { Context = NIL; error(illegalfn, var); }
+        VMTop = base+sp;
+        object *fn = cdr(pair), *slot;
+        if (a == 1 && bytecodep(fn) && (slot = accessorcode(fn)) != NULL) {
+          stack[sp-1] = *recordslot(stack[sp-1], second(slot), intval(car(slot))>>8);
+          break;
+        }
+        object *result = bytecodep(fn) ? vm(fn, base+sp-a, a) : vmcall(fn, base+sp-a, a);
+        sp = sp - a; stack[sp++] = result; VMTop = base+sp;
+        break;
+      }
+      case OPCALLVALUE: {
+        VMTop = base+sp;
+        object *result = vmcall(stack[sp-a-1], base+sp-a, a);
+        sp = sp - a - 1; stack[sp++] = result; VMTop = base+sp;
+        break;
+      }
+      case OPCALLBUILTIN: {
+        int n = a & 0xFF;
+        builtin_t name = a>>8;
+        Context = name;
+        checkminmax(name, n);
+        object *result = vmapply((fn_ptr_type)lookupfn(name), base+sp-n, n);
+        sp = sp - n; stack[sp++] = result; VMTop = base+sp;
+        break;
+      }
+      case OPSHADOWED: {
+        object *pair = vmglobal(pc); pc = cddr(pc);
+        if (pair == NULL) break;
+        // Call the global function instead of the builtin instruction that follows
+        VMTop = base+sp;
+        object *fn = cdr(pair);
+        object *result = bytecodep(fn) ? vm(fn, base+sp-a, a) : vmcall(fn, base+sp-a, a);
+        sp = sp - a; stack[sp++] = result; VMTop = base+sp;
+        pc = cdr(pc);
+        break;
+      }
+      case OPSELFTAIL: {
+        object *var = car(pc), *pair = vmglobal(pc); pc = cddr(pc);
+        if (pair != NULL && cdr(pair) == function) {
+          for (int i=0; i<a; i++) stack[i] = stack[sp-a+i];
+          sp = a; stack[sp++] = function;
+          pc = start;
+          vmcheck(base+sp);
+          break;
+        }
+        // The name has been redefined since this was compiled, so make an ordinary call
+        if (pair == NULL) { Context = NIL; error(illegalfn, var); }
+        VMTop = base+sp;
+        object *fn = cdr(pair);
+        object *result = bytecodep(fn) ? vm(fn, base+sp-a, a) : vmcall(fn, base+sp-a, a);
+        sp = sp - a; stack[sp++] = result; VMTop = base+sp;
+        break;
+      }
+      case OPRETURN:
+        return stack[sp-1];
+      case OPRETURNFLAG:
+        setflag(RETURNFLAG);
+        return stack[sp-1];
+      case OPCHECKEXIT:
+        if (tstflag(RETURNFLAG)) {
+          clrflag(RETURNFLAG);
+          stack[sp-1-a] = stack[sp-1]; sp = sp - a;
+          pc = car(pc);
+        } else pc = cdr(pc);
+        break;
+      case OPCHECKRETURN:
+        if (tstflag(RETURNFLAG)) return stack[sp-1];
+        break;
+      case OPEVALFORM:
+        stack[sp] = vmevalform(car(pc), base, sp); sp++;
+        VMTop = base+sp;
+        pc = cdr(pc);
+        break;
+      case OPBOX:
+        stack[a] = cons(stack[a], NULL);
+        break;
+      case OPBOXREF:
+        stack[sp] = car(stack[a]); sp++;
+        break;
+      case OPSETBOX:
+        car(stack[a]) = stack[sp-1];
+        break;
+      case OPCLOSURE:
+        sp = sp - a; stack[sp] = vmclosure(car(pc), base+sp, a); sp++;
+        pc = cdr(pc);
+        break;
+      case OPMATCH:
+        pc = eq(stack[sp-1], car(pc)) ? second(pc) : cddr(pc);
+        break;
+      case OPSLOT:
+        stack[sp-1] = *recordslot(stack[sp-1], car(pc), a);
+        pc = cdr(pc);
+        break;
+      case OPRECORD:
+        VMTop = base+sp;
+        // The VM stack is marked up to VMTop, and the caller's env is protected by callbytecode
+        stack[sp-1] = makerecord(car(pc), stack[sp-1], NULL);
+        pc = cdr(pc);
+        break;
+      case OPRECORDP:
+        stack[sp-1] = (recordp(stack[sp-1]) && car(cdr(stack[sp-1])) == car(pc)) ? tee : nil;
+        pc = cdr(pc);
+        break;
+      case OPADD: {
+        object *x = stack[sp-2], *y = stack[sp-1];
+        int r;
+        if (integerp(x) && integerp(y) && !__builtin_add_overflow(intval(x), intval(y), &r)) stack[sp-2] = number(r);
+        else stack[sp-2] = vmfallback(OPADD, a, base+sp-2, 2);
+        sp--;
+        break;
+      }
+      case OPSUBTRACT: {
+        object *x = stack[sp-2], *y = stack[sp-1];
+        int r;
+        if (integerp(x) && integerp(y) && !__builtin_sub_overflow(intval(x), intval(y), &r)) stack[sp-2] = number(r);
+        else stack[sp-2] = vmfallback(OPSUBTRACT, a, base+sp-2, 2);
+        sp--;
+        break;
+      }
+      case OPLESS: case OPGREATER: case OPLESSEQ: case OPGREATEREQ: case OPNUMEQ: {
+        object *x = stack[sp-2], *y = stack[sp-1];
+        int op = instruction & 0xFF;
+        if (integerp(x) && integerp(y)) {
+          int p = intval(x), q = intval(y);
+          bool r = (op == OPLESS) ? p < q : (op == OPGREATER) ? p > q : (op == OPLESSEQ) ? p <= q :
+            (op == OPGREATEREQ) ? p >= q : p == q;
+          stack[sp-2] = r ? tee : nil;
+        } else stack[sp-2] = vmfallback(op, a, base+sp-2, 2);
+        sp--;
+        break;
+      }
+      case OPONEPLUS: {
+        object *x = stack[sp-1];
+        if (integerp(x) && intval(x) != INT_MAX) stack[sp-1] = number(intval(x) + 1);
+        else stack[sp-1] = vmfallback(OPONEPLUS, a, base+sp-1, 1);
+        break;
+      }
+      case OPONEMINUS: {
+        object *x = stack[sp-1];
+        if (integerp(x) && intval(x) != INT_MIN) stack[sp-1] = number(intval(x) - 1);
+        else stack[sp-1] = vmfallback(OPONEMINUS, a, base+sp-1, 1);
+        break;
+      }
+      case OPCAR:
+        if (listp(stack[sp-1])) { if (stack[sp-1] != NULL) stack[sp-1] = car(stack[sp-1]); }
+        else stack[sp-1] = vmfallback(OPCAR, a, base+sp-1, 1);
+        break;
+      case OPCDR:
+        if (listp(stack[sp-1])) { if (stack[sp-1] != NULL) stack[sp-1] = cdr(stack[sp-1]); }
+        else stack[sp-1] = vmfallback(OPCDR, a, base+sp-1, 1);
+        break;
+      case OPCONS:
+        stack[sp-2] = cons(stack[sp-2], stack[sp-1]); sp--;
+        break;
+      case OPZEROP:
+        if (integerp(stack[sp-1])) stack[sp-1] = (intval(stack[sp-1]) == 0) ? tee : nil;
+        else stack[sp-1] = vmfallback(OPZEROP, a, base+sp-1, 1);
+        break;
+      case OPEQ:
+        stack[sp-2] = eq(stack[sp-2], stack[sp-1]) ? tee : nil; sp--;
+        break;
+      case OPNOT:
+        stack[sp-1] = (stack[sp-1] == nil) ? tee : nil;
+        break;
+      default:
+        error2("bad bytecode");
+    }
   }
-  error(illegalfn, function);
-  return NULL;
 }
 
 // In-place operations
@@ -1741,9 +3722,33 @@ object **place (object *args, object *env, int *bit) {
     }
     if (sname == sym(AREF)) {
       object *array = eval(second(args), env);
+      if (typedarrayp(array)) {
+        protect(array);
+        *bit = TYPEDPLACE + typedindex(array, cddr(args), env);
+        unprotect();
+        Placearray = array;
+        return &Placearray;
+      }
       if (!arrayp(array)) { Context = AREF; error("first argument is not an array", array); }
       return getarray(array, cddr(args), env, bit);
     }
+    if (builtinp(sname) && lookupfn(builtin(sname)) == (intptr_t)fn_gethash) {
+      object *key = eval(second(args), env);
+      protect(key);
+      object *table = eval(third(args), env);
+      protect(table);
+      object *entry = hashentry(table, key);
+      if (entry == NULL) {
+        object *value = (cdr(cddr(args)) != NULL) ? eval(first(cdr(cddr(args))), env) : nil;
+        entry = puthash(table, key, value, env);
+      }
+      unprotect(); unprotect();
+      return &cdr(entry);
+    }
+    object *pair = builtinp(sname) ? NULL : globalpair(sname), *slot;
+    if (pair != NULL && bytecodep(cdr(pair)) && (slot = accessorcode(cdr(pair))) != NULL) {
+      return recordslot(eval(second(args), env), second(slot), intval(car(slot))>>8);
+    }
   }
   error2("illegal place");
   return nil;
@@ -1969,14 +3974,73 @@ inline int i2c1read () { return I2Cread(&Wire1); }
 #endif
 inline int serial1read () { while (!Serial1.available()) testescape(); return Serial1.read(); }
 #if defined(sdcardsupport)
+// SD card streams move data through these buffers in blocks, rather than a byte at a time
+#define SDBUFFERSIZE 4096
 File SDpfile, SDgfile;
+uint8_t SDgbuf[SDBUFFERSIZE], SDpbuf[SDBUFFERSIZE];
+int SDgpos = 0, SDglen = 0, SDplen = 0;
+
+// Refills the read buffer, returning false at the end of the file
+bool SDfill () {
+  SDgpos = 0;
+  SDglen = SDgfile.read(SDgbuf, SDBUFFERSIZE);
+  if (SDglen < 0) SDglen = 0;
+  return SDglen > 0;
+}
+
 inline int SDread () {
   if (LastChar) {
     char temp = LastChar;
     LastChar = 0;
     return temp;
   }
-  return SDgfile.read();
+  if (SDgpos == SDglen && !SDfill()) return -1;
+  return SDgbuf[SDgpos++];
+}
+
+// Copies up to n bytes from the file to buffer, returning how many there were
+int SDreadbytes (uint8_t *buffer, int n) {
+  int done = 0;
+  if (LastChar && n > 0) { buffer[done++] = LastChar; LastChar = 0; }
+  while (done < n) {
+    if (SDgpos == SDglen && !SDfill()) break;
+    int chunk = min(n - done, SDglen - SDgpos);
+    memcpy(buffer + done, SDgbuf + SDgpos, chunk);
+    SDgpos = SDgpos + chunk; done = done + chunk;
+  }
+  return done;
+}
+
+// Reads a line as a string straight from the read buffer, or returns nil at the end of the file
+object *SDreadline () {
+  if (LastChar) return readstring('\n', false, (gfun_t)SDread);
+  object *obj = newstring();
+  object *tail = obj;
+  bool any = false;
+  for (;;) {
+    if (SDgpos == SDglen && !SDfill()) return any ? obj : nil;
+    any = true;
+    uint8_t *start = SDgbuf + SDgpos;
+    uint8_t *newline = (uint8_t *)memchr(start, '\n', SDglen - SDgpos);
+    int n = (newline != NULL) ? newline - start : SDglen - SDgpos;
+    buildchars(start, n, &tail);
+    SDgpos = SDgpos + n;
+    if (newline != NULL) { SDgpos++; return obj; }
+  }
+}
+
+void SDflush () {
+  if (SDplen > 0) SDpfile.write(SDpbuf, SDplen);
+  SDplen = 0;
+}
+
+void SDwritebytes (const uint8_t *buffer, int n) {
+  while (n > 0) {
+    if (SDplen == SDBUFFERSIZE) SDflush();
+    int chunk = min(n, SDBUFFERSIZE - SDplen);
+    memcpy(SDpbuf + SDplen, buffer, chunk);
+    SDplen = SDplen + chunk; buffer = buffer + chunk; n = n - chunk;
+  }
 }
 #endif
 
@@ -2037,10 +4101,16 @@ inline void i2c1write (char c) { I2Cwrite(&Wire1, c); }
 inline void serial1write (char c) { Serial1.write(c); }
 inline void WiFiwrite (char c) { client.write(c); }
 #if defined(sdcardsupport)
-inline void SDwrite (char c) { SDpfile.write(c); }
+inline void SDwrite (char c) { if (SDplen == SDBUFFERSIZE) SDflush(); SDpbuf[SDplen++] = c; }
 #endif
 #if defined(gfxsupport)
-inline void gfxwrite (char c) { tft.write(c); }
+void gfxwrite (char c) {
+  int x = Gfx->getCursorX(), y = Gfx->getCursorY();
+  Gfx->write(c);
+  int y1 = Gfx->getCursorY();
+  if (y1 == y) gfxdirty(x, y, Gfx->getCursorX() - x, 8*Textsize);
+  else if (c != '\n') gfxdirty(0, y, 320, y1 - y + 8*Textsize);
+}
 #endif
 
 pfun_t pstreamfun (object *args) {
@@ -2148,12 +4218,12 @@ uint8_t atomwidth (object *obj) {
 
 uint8_t basewidth (object *obj, uint8_t base) {
   PrintCount = 0;
-  pintbase(obj->integer, base, pcount);
+  pintbase(intval(obj), base, pcount);
   return PrintCount;
 }
 
 bool quoted (object *obj) {
-  return (consp(obj) && car(obj) != NULL && car(obj)->name == sym(QUOTE) && consp(cdr(obj)) && cddr(obj) == NULL);
+  return (consp(obj) && isbuiltin(car(obj), QUOTE) && consp(cdr(obj)) && cddr(obj) == NULL);
 }
 
 int subwidth (object *obj, int w) {
@@ -2172,7 +4242,7 @@ int subwidthlist (object *form, int w) {
 }
 
 bool highlighted (object *obj) {
-  return (consp(obj) && car(obj) != NULL && car(obj)->name == sym(HIGHLIGHT));
+  return (consp(obj) && isbuiltin(car(obj), HIGHLIGHT));
 }
 
 const char STX = 2; // Code to invert text
@@ -2302,9 +4372,9 @@ object *sp_defun (object *args, object *env) {
   object *var = first(args);
   if (!symbolp(var)) error(notasymbol, var);
   object *val = cons(bsymbol(LAMBDA), cdr(args));
-  object *pair = value(var->name, GlobalEnv);
+  object *pair = globalpair(var->name);
   if (pair != NULL) cdr(pair) = val;
-  else push(cons(var, val), GlobalEnv);
+  else { push(cons(var, val), GlobalEnv); addglobal(car(GlobalEnv)); }
   return var;
 }
 
@@ -2314,9 +4384,9 @@ object *sp_defvar (object *args, object *env) {
   object *val = NULL;
   args = cdr(args);
   if (args != NULL) { setflag(NOESC); val = eval(first(args), env); clrflag(NOESC); }
-  object *pair = value(var->name, GlobalEnv);
+  object *pair = globalpair(var->name);
   if (pair != NULL) cdr(pair) = val;
-  else push(cons(var, val), GlobalEnv);
+  else { push(cons(var, val), GlobalEnv); addglobal(car(GlobalEnv)); }
   return var;
 }
 
@@ -2373,21 +4443,28 @@ object *sp_pop (object *args, object *env) {
 // Accessors
 
 object *sp_incf (object *args, object *env) {
-  int bit;
+  int bit, index = 0;
   object **loc = place(first(args), env, &bit);
   if (bit < -1) error2(notanumber);
   args = cdr(args);
 
+  object *array = NULL, *element;
+  if (bit >= TYPEDPLACE) {
+    array = *loc; index = bit - TYPEDPLACE; bit = -1;
+    protect(array);
+    element = typedref(array, index); loc = &element;
+  }
+
   object *x = *loc;
   object *inc = (args != NULL) ? eval(first(args), env) : NULL;
 
   if (bit != -1) {
     int increment;
     if (inc == NULL) increment = 1; else increment = checkbitvalue(inc);
-    int newvalue = (((*loc)->integer)>>bit & 1) + increment;
+    int newvalue = (intval(*loc)>>bit & 1) + increment;
 
     if (newvalue & ~1) error2("result is not a bit value");
-    *loc = number((((*loc)->integer) & ~(1<<bit)) | newvalue<<bit);
+    *loc = number((intval(*loc) & ~(1<<bit)) | newvalue<<bit);
     return number(newvalue);
   }
 
@@ -2400,9 +4477,9 @@ object *sp_incf (object *args, object *env) {
     *loc = makefloat(value + increment);
   } else if (integerp(x) && (integerp(inc) || inc == NULL)) {
     int increment;
-    int value = x->integer;
+    int value = intval(x);
 
-    if (inc == NULL) increment = 1; else increment = inc->integer;
+    if (inc == NULL) increment = 1; else increment = intval(inc);
 
     if (increment < 1) {
       if (INT_MIN - increment > value) *loc = makefloat((float)value + (float)increment);
@@ -2412,25 +4489,33 @@ object *sp_incf (object *args, object *env) {
       else *loc = number(value + increment);
     }
   } else error2(notanumber);
+  if (array != NULL) { settypedref(array, index, *loc); unprotect(); }
   return *loc;
 }
 
 object *sp_decf (object *args, object *env) {
-  int bit;
+  int bit, index = 0;
   object **loc = place(first(args), env, &bit);
   if (bit < -1) error2(notanumber);
   args = cdr(args);
 
+  object *array = NULL, *element;
+  if (bit >= TYPEDPLACE) {
+    array = *loc; index = bit - TYPEDPLACE; bit = -1;
+    protect(array);
+    element = typedref(array, index); loc = &element;
+  }
+
   object *x = *loc;
   object *dec = (args != NULL) ? eval(first(args), env) : NULL;
 
   if (bit != -1) {
     int decrement;
     if (dec == NULL) decrement = 1; else decrement = checkbitvalue(dec);
-    int newvalue = (((*loc)->integer)>>bit & 1) - decrement;
+    int newvalue = (intval(*loc)>>bit & 1) - decrement;
 
     if (newvalue & ~1) error2("result is not a bit value");
-    *loc = number((((*loc)->integer) & ~(1<<bit)) | newvalue<<bit);
+    *loc = number((intval(*loc) & ~(1<<bit)) | newvalue<<bit);
     return number(newvalue);
   }
 
@@ -2443,9 +4528,9 @@ object *sp_decf (object *args, object *env) {
     *loc = makefloat(value - decrement);
   } else if (integerp(x) && (integerp(dec) || dec == NULL)) {
     int decrement;
-    int value = x->integer;
+    int value = intval(x);
 
-    if (dec == NULL) decrement = 1; else decrement = dec->integer;
+    if (dec == NULL) decrement = 1; else decrement = intval(dec);
 
     if (decrement < 1) {
       if (INT_MAX + decrement < value) *loc = makefloat((float)value - (float)decrement);
@@ -2455,6 +4540,7 @@ object *sp_decf (object *args, object *env) {
       else *loc = number(value - decrement);
     }
   } else error2(notanumber);
+  if (array != NULL) { settypedref(array, index, *loc); unprotect(); }
   return *loc;
 }
 
@@ -2464,9 +4550,21 @@ object *sp_setf (object *args, object *env) {
   while (args != NULL) {
     if (cdr(args) == NULL) { Context = setf; error2(oddargs); }
     object **loc = place(first(args), env, &bit);
+    if (bit >= TYPEDPLACE) {
+      object *array = *loc;
+      protect(array);
+      arg = eval(second(args), env);
+      settypedref(array, bit - TYPEDPLACE, arg);
+      unprotect();
+      args = cddr(args);
+      continue;
+    }
     arg = eval(second(args), env);
     if (bit == -1) *loc = arg;
-    else if (bit < -1) (*loc)->chars = ((*loc)->chars & ~(0xff<<((-bit-2)<<3))) | checkchar(arg)<<((-bit-2)<<3);
+    else if (bit < -1) {
+      (*loc)->chars = ((*loc)->chars & ~(0xff<<((-bit-2)<<3))) | checkchar(arg)<<((-bit-2)<<3);
+      LengthString[0] = NULL; LengthString[1] = NULL;
+    }
     else *loc = number((checkinteger(*loc) & ~(1<<bit)) | checkbitvalue(arg)<<bit);
     args = cddr(args);
   }
@@ -2650,7 +4748,7 @@ object *sp_withi2c (object *args, object *env) {
   I2Ccount = 0;
   if (params != NULL) {
     object *rw = eval(first(params), env);
-    if (integerp(rw)) I2Ccount = rw->integer;
+    if (integerp(rw)) I2Ccount = intval(rw);
     read = (rw != NULL);
   }
   // Top bit of address is I2C port
@@ -2722,16 +4820,19 @@ object *sp_withsdcard (object *args, object *env) {
     char buffer[BUFFERSIZE*4];
     SDpfile = SD.open(MakeFilename(filename, buffer), oflag);
     if (!SDpfile) error2("problem writing to SD card or invalid filename");
+    SDplen = 0;
+    dircacheclear();
   } else {
     char buffer[BUFFERSIZE*4];
     SDgfile = SD.open(MakeFilename(filename, buffer), oflag);
     if (!SDgfile) error2("problem reading from SD card or invalid filename");
+    SDgpos = 0; SDglen = 0;
   }
   object *pair = cons(var, stream(SDSTREAM, 1));
   push(pair,env);
   object *forms = cdr(args);
   object *result = eval(tf_progn(forms,env), env);
-  if (mode >= 1) SDpfile.close(); else SDgfile.close();
+  if (mode >= 1) { SDflush(); SDpfile.close(); } else SDgfile.close();
   return result;
   #else
   (void) args, (void) env;
@@ -2852,7 +4953,7 @@ object *fn_symbolp (object *args, object *env) {
 
 object *fn_arrayp (object *args, object *env) {
   (void) env;
-  return arrayp(first(args)) ? tee : nil;
+  return (arrayp(first(args)) || typedarrayp(first(args))) ? tee : nil;
 }
 
 object *fn_boundp (object *args, object *env) {
@@ -2971,16 +5072,18 @@ object *fn_length (object *args, object *env) {
   object *arg = first(args);
   if (listp(arg)) return number(listlength(arg));
   if (stringp(arg)) return number(stringlength(arg));
+  if (typedarrayp(arg)) return number(typedlength(arg));
   if (!(arrayp(arg) && cdr(cddr(arg)) == NULL)) error("argument is not a list, 1d array, or string", arg);
-  return number(abs(first(cddr(arg))->integer));
+  return number(abs(intval(first(cddr(arg)))));
 }
 
 object *fn_arraydimensions (object *args, object *env) {
   (void) env;
   object *array = first(args);
+  if (typedarrayp(array)) return cons(number(typedlength(array)), NULL);
   if (!arrayp(array)) error("argument is not an array", array);
   object *dimensions = cddr(array);
-  return (first(dimensions)->integer < 0) ? cons(number(-(first(dimensions)->integer)), cdr(dimensions)) : dimensions;
+  return (intval(first(dimensions)) < 0) ? cons(number(-intval(first(dimensions))), cdr(dimensions)) : dimensions;
 }
 
 object *fn_list (object *args, object *env) {
@@ -3002,8 +5105,7 @@ object *fn_copylist (object *args, object *env) {
 }
 
 object *fn_makearray (object *args, object *env) {
-  (void) env;
-  object *def = nil;
+  object *def = nil, *type = NULL;
   bool bitp = false;
   object *dims = first(args);
   if (dims == NULL) error2("dimensions can't be nil");
@@ -3013,9 +5115,14 @@ object *fn_makearray (object *args, object *env) {
     object *var = first(args);
     if (isbuiltin(first(args), INITIALELEMENT)) def = second(args);
     else if (isbuiltin(first(args), ELEMENTTYPE) && isbuiltin(second(args), BIT)) bitp = true;
+    else if (isbuiltin(first(args), ELEMENTTYPE) && second(args) != nil) type = second(args);
     else error("argument not recognised", var);
     args = cddr(args);
   }
+  if (type != NULL) {
+    if (cdr(dims) != NULL) error2("typed arrays must have one dimension");
+    return maketypedarray(checkinteger(first(dims)), elementtype(type), (def == nil) ? number(0) : def, env);
+  }
   if (bitp) {
     if (def == nil) def = number(0);
     else def = number(-checkbitvalue(def)); // 1 becomes all ones
@@ -3053,10 +5160,11 @@ object *fn_aref (object *args, object *env) {
   (void) env;
   int bit;
   object *array = first(args);
+  if (typedarrayp(array)) return typedref(array, typedindex(array, cdr(args), NULL));
   if (!arrayp(array)) error("first argument is not an array", array);
   object *loc = *getarray(array, cdr(args), 0, &bit);
   if (bit == -1) return loc;
-  else return number((loc->integer)>>bit & 1);
+  else return number(intval(loc)>>bit & 1);
 }
 
 object *fn_assoc (object *args, object *env) {
@@ -3157,7 +5265,7 @@ object *fn_add (object *args, object *env) {
     object *arg = car(args);
     if (floatp(arg)) return add_floats(args, (float)result);
     else if (integerp(arg)) {
-      int val = arg->integer;
+      int val = intval(arg);
       if (val < 1) { if (INT_MIN - val > result) return add_floats(args, (float)result); }
       else { if (INT_MAX - val < result) return add_floats(args, (float)result); }
       result = result + val;
@@ -3174,12 +5282,12 @@ object *fn_subtract (object *args, object *env) {
   if (args == NULL) return negate(arg);
   else if (floatp(arg)) return subtract_floats(args, arg->single_float);
   else if (integerp(arg)) {
-    int result = arg->integer;
+    int result = intval(arg);
     while (args != NULL) {
       arg = car(args);
       if (floatp(arg)) return subtract_floats(args, result);
       else if (integerp(arg)) {
-        int val = (car(args))->integer;
+        int val = intval(car(args));
         if (val < 1) { if (INT_MAX + val < result) return subtract_floats(args, result); }
         else { if (INT_MIN + val > result) return subtract_floats(args, result); }
         result = result - val;
@@ -3198,7 +5306,7 @@ object *fn_multiply (object *args, object *env) {
     object *arg = car(args);
     if (floatp(arg)) return multiply_floats(args, result);
     else if (integerp(arg)) {
-      int64_t val = result * (int64_t)(arg->integer);
+      int64_t val = result * (int64_t)intval(arg);
       if ((val > INT_MAX) || (val < INT_MIN)) return multiply_floats(args, result);
       result = val;
     } else error(notanumber, arg);
@@ -3218,7 +5326,7 @@ object *fn_divide (object *args, object *env) {
       if (f == 0.0) error2(divisionbyzero);
       return makefloat(1.0 / f);
     } else if (integerp(arg)) {
-      int i = arg->integer;
+      int i = intval(arg);
       if (i == 0) error2(divisionbyzero);
       else if (i == 1) return number(1);
       else return makefloat(1.0 / i);
@@ -3227,13 +5335,13 @@ object *fn_divide (object *args, object *env) {
   // Multiple arguments
   if (floatp(arg)) return divide_floats(args, arg->single_float);
   else if (integerp(arg)) {
-    int result = arg->integer;
+    int result = intval(arg);
     while (args != NULL) {
       arg = car(args);
       if (floatp(arg)) {
         return divide_floats(args, result);
       } else if (integerp(arg)) {
-        int i = arg->integer;
+        int i = intval(arg);
         if (i == 0) error2(divisionbyzero);
         if ((result % i) != 0) return divide_floats(args, result);
         if ((result == INT_MIN) && (i == -1)) return divide_floats(args, result);
@@ -3261,8 +5369,8 @@ object *fn_oneplus (object *args, object *env) {
   object* arg = first(args);
   if (floatp(arg)) return makefloat((arg->single_float) + 1.0);
   else if (integerp(arg)) {
-    int result = arg->integer;
-    if (result == INT_MAX) return makefloat((arg->integer) + 1.0);
+    int result = intval(arg);
+    if (result == INT_MAX) return makefloat(intval(arg) + 1.0);
     else return number(result + 1);
   } else error(notanumber, arg);
   return nil;
@@ -3273,8 +5381,8 @@ object *fn_oneminus (object *args, object *env) {
   object* arg = first(args);
   if (floatp(arg)) return makefloat((arg->single_float) - 1.0);
   else if (integerp(arg)) {
-    int result = arg->integer;
-    if (result == INT_MIN) return makefloat((arg->integer) - 1.0);
+    int result = intval(arg);
+    if (result == INT_MIN) return makefloat(intval(arg) - 1.0);
     else return number(result - 1);
   } else error(notanumber, arg);
   return nil;
@@ -3285,7 +5393,7 @@ object *fn_abs (object *args, object *env) {
   object *arg = first(args);
   if (floatp(arg)) return makefloat(abs(arg->single_float));
   else if (integerp(arg)) {
-    int result = arg->integer;
+    int result = intval(arg);
     if (result == INT_MIN) return makefloat(abs((float)result));
     else return number(abs(result));
   } else error(notanumber, arg);
@@ -3295,7 +5403,7 @@ object *fn_abs (object *args, object *env) {
 object *fn_random (object *args, object *env) {
   (void) env;
   object *arg = first(args);
-  if (integerp(arg)) return number(random(arg->integer));
+  if (integerp(arg)) return number(random(intval(arg)));
   else if (floatp(arg)) return makefloat((float)rand()/(float)(RAND_MAX/(arg->single_float)));
   else error(notanumber, arg);
   return nil;
@@ -3308,7 +5416,7 @@ object *fn_maxfn (object *args, object *env) {
   while (args != NULL) {
     object *arg = car(args);
     if (integerp(result) && integerp(arg)) {
-      if ((arg->integer) > (result->integer)) result = arg;
+      if (intval(arg) > intval(result)) result = arg;
     } else if ((checkintfloat(arg) > checkintfloat(result))) result = arg;
     args = cdr(args);
   }
@@ -3322,7 +5430,7 @@ object *fn_minfn (object *args, object *env) {
   while (args != NULL) {
     object *arg = car(args);
     if (integerp(result) && integerp(arg)) {
-      if ((arg->integer) < (result->integer)) result = arg;
+      if (intval(arg) < intval(result)) result = arg;
     } else if ((checkintfloat(arg) < checkintfloat(result))) result = arg;
     args = cdr(args);
   }
@@ -3340,7 +5448,7 @@ object *fn_noteq (object *args, object *env) {
     while (nargs != NULL) {
       object *arg2 = first(nargs);
       if (integerp(arg1) && integerp(arg2)) {
-        if ((arg1->integer) == (arg2->integer)) return nil;
+        if (intval(arg1) == intval(arg2)) return nil;
       } else if ((checkintfloat(arg1) == checkintfloat(arg2))) return nil;
       nargs = cdr(nargs);
     }
@@ -3378,7 +5486,7 @@ object *fn_plusp (object *args, object *env) {
   (void) env;
   object *arg = first(args);
   if (floatp(arg)) return ((arg->single_float) > 0.0) ? tee : nil;
-  else if (integerp(arg)) return ((arg->integer) > 0) ? tee : nil;
+  else if (integerp(arg)) return (intval(arg) > 0) ? tee : nil;
   else error(notanumber, arg);
   return nil;
 }
@@ -3387,7 +5495,7 @@ object *fn_minusp (object *args, object *env) {
   (void) env;
   object *arg = first(args);
   if (floatp(arg)) return ((arg->single_float) < 0.0) ? tee : nil;
-  else if (integerp(arg)) return ((arg->integer) < 0) ? tee : nil;
+  else if (integerp(arg)) return (intval(arg) < 0) ? tee : nil;
   else error(notanumber, arg);
   return nil;
 }
@@ -3396,7 +5504,7 @@ object *fn_zerop (object *args, object *env) {
   (void) env;
   object *arg = first(args);
   if (floatp(arg)) return ((arg->single_float) == 0.0) ? tee : nil;
-  else if (integerp(arg)) return ((arg->integer) == 0) ? tee : nil;
+  else if (integerp(arg)) return (intval(arg) == 0) ? tee : nil;
   else error(notanumber, arg);
   return nil;
 }
@@ -3431,7 +5539,7 @@ object *fn_numberp (object *args, object *env) {
 object *fn_floatfn (object *args, object *env) {
   (void) env;
   object *arg = first(args);
-  return (floatp(arg)) ? arg : makefloat((float)(arg->integer));
+  return (floatp(arg)) ? arg : makefloat((float)checkinteger(arg));
 }
 
 object *fn_floatp (object *args, object *env) {
@@ -3512,10 +5620,10 @@ object *fn_expt (object *args, object *env) {
   object *arg1 = first(args); object *arg2 = second(args);
   float float1 = checkintfloat(arg1);
   float value = log(abs(float1)) * checkintfloat(arg2);
-  if (integerp(arg1) && integerp(arg2) && ((arg2->integer) >= 0) && (abs(value) < 21.4875))
-    return number(intpower(arg1->integer, arg2->integer));
+  if (integerp(arg1) && integerp(arg2) && (intval(arg2) >= 0) && (abs(value) < 21.4875))
+    return number(intpower(intval(arg1), intval(arg2)));
   if (float1 < 0) {
-    if (integerp(arg2)) return makefloat((arg2->integer & 1) ? -exp(value) : exp(value));
+    if (integerp(arg2)) return makefloat((intval(arg2) & 1) ? -exp(value) : exp(value));
     else error2("invalid result");
   }
   return makefloat(exp(value));
@@ -3624,30 +5732,15 @@ object *fn_stringgreatereq (object *args, object *env) {
 }
 
 object *fn_sort (object *args, object *env) {
-  if (first(args) == NULL) return nil;
-  object *list = cons(nil,first(args));
-  protect(list);
-  object *predicate = second(args);
-  object *compare = cons(NULL, cons(NULL, NULL));
-  protect(compare);
-  object *ptr = cdr(list);
-  while (cdr(ptr) != NULL) {
-    object *go = list;
-    while (go != ptr) {
-      car(compare) = car(cdr(ptr));
-      car(cdr(compare)) = car(cdr(go));
-      if (apply(predicate, compare, env)) break;
-      go = cdr(go);
-    }
-    if (go != ptr) {
-      object *obj = cdr(ptr);
-      cdr(ptr) = cdr(obj);
-      cdr(obj) = cdr(go);
-      cdr(go) = obj;
-    } else ptr = cdr(ptr);
+  object *list = first(args), *predicate = second(args), *key = NULL;
+  if (!listp(list)) error(notalist, list);
+  args = cddr(args);
+  if (args != NULL) {
+    if (cdr(args) == NULL) error2("unpaired keyword");
+    if (symbolp(first(args)) && first(args)->name == bufsymbol((char *)":key")->name) key = second(args);
+    else error("unsupported keyword", first(args));
   }
-  unprotect(); unprotect();
-  return cdr(list);
+  return sortlist(list, predicate, key, env);
 }
 
 object *fn_stringfn (object *args, object *env) {
@@ -3657,7 +5750,7 @@ object *fn_stringfn (object *args, object *env) {
 object *fn_concatenate (object *args, object *env) {
   (void) env;
   object *arg = first(args);
-  if (builtin(arg->name) != STRINGFN) error2("only supports strings");
+  if (!symbolp(arg) || builtin(arg->name) != STRINGFN) error2("only supports strings");
   args = cdr(args);
   object *result = newstring();
   object *tail = result;
@@ -3666,6 +5759,13 @@ object *fn_concatenate (object *args, object *env) {
     obj = cdr(obj);
     while (obj != NULL) {
       int quad = obj->chars;
+      // Copy whole cells while the result is a multiple of the cell size
+      if ((quad & 0xFF) != 0 && (tail == result || (tail->chars & 0xFF) != 0)) {
+        object *cell = myalloc(); car(cell) = NULL; cell->chars = quad;
+        if (tail == result) cdr(result) = cell; else car(tail) = cell;
+        tail = cell; obj = car(obj);
+        continue;
+      }
       while (quad != 0) {
          char ch = quad>>((sizeof(int)-1)*8) & 0xFF;
          buildstring(ch, &tail);
@@ -3701,9 +5801,14 @@ object *fn_subseq (object *args, object *env) {
     if (start > end || end > length) error2(indexrange);
     object *result = newstring();
     object *tail = result;
-    for (int i=start; i<end; i++) {
-      char ch = nthchar(arg, i);
-      buildstring(ch, &tail);
+    if (start == end) return result;
+    int shift;
+    object *cell = *getcharplace(arg, start, &shift);
+    int i = start, pos = (-shift-2)<<3;
+    while (i < end) {
+      buildstring((cell->chars)>>pos & 0xFF, &tail);
+      i++; pos = pos - 8;
+      if (pos < 0) { cell = car(cell); pos = (sizeof(int)-1)*8; }
     }
     return result;
   } else error2("argument is not a list or string");
@@ -3734,13 +5839,8 @@ object *fn_search (object *args, object *env) {
 
   } else if (stringp(pattern) && stringp(target)) {
     if (cddr(args) != NULL) error2("keyword argument not supported for strings");
-    int l = stringlength(target);
-    int m = stringlength(pattern);
-    for (int i = 0; i <= l-m; i++) {
-      int j = 0;
-      while (j < m && nthchar(target, i+j) == nthchar(pattern, j)) j++;
-      if (j == m) return number(i);
-    }
+    int i = searchstring(pattern, target, 0);
+    if (i >= 0) return number(i);
     return nil;
   } else error2("arguments are not both lists or strings");
   return nil;
@@ -3855,7 +5955,10 @@ object *fn_makunbound (object *args, object *env) {
   (void) env;
   object *var = first(args);
   if (!symbolp(var)) error(notasymbol, var);
+  object *pair = globalpair(var->name);
   delassoc(var, &GlobalEnv);
+  removeglobal(var->name);
+  if (pair != NULL) car(pair) = nil; // Retire it for the bytecode caches
   return var;
 }
 
@@ -3917,6 +6020,9 @@ object *fn_readbyte (object *args, object *env) {
 object *fn_readline (object *args, object *env) {
   (void) env;
   gfun_t gfun = gstreamfun(args);
+  #if defined(sdcardsupport)
+  if (gfun == (gfun_t)SDread) return SDreadline();
+  #endif
   return readstring('\n', false, gfun);
 }
 
@@ -3959,7 +6065,7 @@ object *fn_restarti2c (object *args, object *env) {
   I2Ccount = 0;
   if (args != NULL) {
     object *rw = first(args);
-    if (integerp(rw)) I2Ccount = rw->integer;
+    if (integerp(rw)) I2Ccount = intval(rw);
     read = (rw != NULL);
   }
   int address = stream & 0xFF;
@@ -4027,7 +6133,7 @@ object *fn_pinmode (object *args, object *env) {
   arg = second(args);
   if (keywordp(arg)) pm = checkkeyword(arg);
   else if (integerp(arg)) {
-    int mode = arg->integer;
+    int mode = intval(arg);
     if (mode == 1) pm = OUTPUT; else if (mode == 2) pm = INPUT_PULLUP;
     #if defined(INPUT_PULLDOWN)
     else if (mode == 4) pm = INPUT_PULLDOWN;
@@ -4055,7 +6161,7 @@ object *fn_digitalwrite (object *args, object *env) {
   arg = second(args);
   int mode;
   if (keywordp(arg)) mode = checkkeyword(arg);
-  else if (integerp(arg)) mode = arg->integer ? HIGH : LOW;
+  else if (integerp(arg)) mode = intval(arg) ? HIGH : LOW;
   else mode = (arg != nil) ? HIGH : LOW;
   digitalWrite(pin, mode);
   return arg;
@@ -4261,7 +6367,7 @@ object *fn_format (object *args, object *env) {
             if (integerp(arg)) {
               uint8_t base = (ch2 == 'B') ? 2 : 16;
               uint8_t hw = basewidth(arg, base); if (width < hw) w = 0; else w = width-hw;
-              indent(w, pad, pfun); pintbase(arg->integer, base, pfun);
+              indent(w, pad, pfun); pintbase(intval(arg), base, pfun);
             } else {
               indent(w, pad, pfun); prin1object(arg, pfun);
             }
@@ -4353,6 +6459,7 @@ object *fn_aproposlist (object *args, object *env) {
 object *sp_unwindprotect (object *args, object *env) {
   if (args == NULL) error2(toofewargs);
   object *current_GCStack = GCStack;
+  int current_VMTop = VMTop;
   jmp_buf dynamic_handler;
   jmp_buf *previous_handler = handler;
   handler = &dynamic_handler;
@@ -4364,6 +6471,7 @@ object *sp_unwindprotect (object *args, object *env) {
     result = eval(protected_form, env);
   } else {
     GCStack = current_GCStack;
+    VMTop = current_VMTop;
     signaled = true;
   }
   handler = previous_handler;
@@ -4382,6 +6490,7 @@ object *sp_unwindprotect (object *args, object *env) {
 
 object *sp_ignoreerrors (object *args, object *env) {
   object *current_GCStack = GCStack;
+  int current_VMTop = VMTop;
   jmp_buf dynamic_handler;
   jmp_buf *previous_handler = handler;
   handler = &dynamic_handler;
@@ -4398,6 +6507,7 @@ object *sp_ignoreerrors (object *args, object *env) {
     }
   } else {
     GCStack = current_GCStack;
+    VMTop = current_VMTop;
     signaled = true;
   }
   handler = previous_handler;
@@ -4463,7 +6573,7 @@ object *sp_withclient (object *args, object *env) {
     object *port = eval(second(params), env);
     int success;
     if (stringp(address)) success = client.connect(cstring(address, buffer, BUFFERSIZE), checkinteger(port));
-    else if (integerp(address)) success = client.connect(address->integer, checkinteger(port));
+    else if (integerp(address)) success = client.connect(intval(address), checkinteger(port));
     else error2("invalid address");
     if (!success) return nil;
     n = 1;
@@ -4534,6 +6644,88 @@ object *fn_wificonnect (object *args, object *env) {
   return nil;
 }
 
+// Framebuffer
+
+// Records that a rectangle of the framebuffer has changed, merging it into a dirty rectangle it overlaps
+// or touches, or into the one it enlarges least when the list is full
+void gfxdirty (int x, int y, int w, int h) {
+  if (Gfx == &tft) return;
+  int x1 = min(x + w, 320), y1 = min(y + h, 240);
+  x = max(x, 0); y = max(y, 0);
+  if (x >= x1 || y >= y1) return;
+  int best = -1;
+  long growth = 0;
+  for (int i=0; i<Dirtyrects; i++) {
+    dirtyrect_t *r = &Dirty[i];
+    if (x <= r->x1 && x1 >= r->x0 && y <= r->y1 && y1 >= r->y0) { best = i; break; }
+    if (Dirtyrects == DIRTYRECTS) {
+      long area = (long)(max(x1, (int)r->x1) - min(x, (int)r->x0)) * (max(y1, (int)r->y1) - min(y, (int)r->y0))
+        - (long)(r->x1 - r->x0) * (r->y1 - r->y0);
+      if (best == -1 || area < growth) { best = i; growth = area; }
+    }
+  }
+  if (best == -1) {
+    dirtyrect_t *r = &Dirty[Dirtyrects++];
+    r->x0 = x; r->y0 = y; r->x1 = x1; r->y1 = y1;
+    return;
+  }
+  dirtyrect_t *r = &Dirty[best];
+  r->x0 = min(x, (int)r->x0); r->y0 = min(y, (int)r->y0);
+  r->x1 = max(x1, (int)r->x1); r->y1 = max(y1, (int)r->y1);
+  // The enlarged rectangle may now reach others, so absorb them too
+  for (int i=0; i<Dirtyrects; i++) {
+    dirtyrect_t *s = &Dirty[i];
+    if (i != best && s->x0 <= r->x1 && s->x1 >= r->x0 && s->y0 <= r->y1 && s->y1 >= r->y0) {
+      r->x0 = min(r->x0, s->x0); r->y0 = min(r->y0, s->y0);
+      r->x1 = max(r->x1, s->x1); r->y1 = max(r->y1, s->y1);
+      Dirty[i] = Dirty[--Dirtyrects];
+      if (best == Dirtyrects) { best = i; r = s; }
+      i = -1;
+    }
+  }
+}
+
+// Marks the bounding box of n/2 points as dirty, for lines and triangles
+void gfxdirtypoints (uint16_t *params, int n) {
+  int x0 = params[0], y0 = params[1], x1 = x0, y1 = y0;
+  for (int i=2; i<n; i=i+2) {
+    x0 = min(x0, (int)params[i]); x1 = max(x1, (int)params[i]);
+    y0 = min(y0, (int)params[i+1]); y1 = max(y1, (int)params[i+1]);
+  }
+  gfxdirty(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
+
+// Copies the dirty rectangles of the framebuffer to the display in a single SPI transaction
+void gfxflush () {
+  if (Dirtyrects == 0) return;
+  tft.startWrite();
+  for (int i=0; i<Dirtyrects; i++) {
+    dirtyrect_t *r = &Dirty[i];
+    Frame.pushSprite(r->x0, r->y0, r->x0, r->y0, r->x1 - r->x0, r->y1 - r->y0);
+  }
+  tft.endWrite();
+  Dirtyrects = 0;
+}
+
+// Directs drawing to the framebuffer or back to the display; returns false if there's no room for the framebuffer
+bool gfxframebuffer (bool on) {
+  if (on == (Gfx == &Frame)) return true;
+  if (on) {
+    Frame.setColorDepth(16);
+    if (Frame.createSprite(320, 240) == NULL) return false;
+    Frame.setCursor(tft.getCursorX(), tft.getCursorY());
+    Gfx = &Frame;
+    RedrawDisplay();
+    Dirtyrects = 0;
+  } else {
+    gfxflush();
+    tft.setCursor(Frame.getCursorX(), Frame.getCursorY());
+    Gfx = &tft;
+    Frame.deleteSprite();
+  }
+  return true;
+}
+
 // Graphics functions
 
 object *sp_withgfx (object *args, object *env) {
@@ -4557,7 +6749,9 @@ object *fn_drawpixel (object *args, object *env) {
   #if defined(gfxsupport)
   uint16_t colour = COLOR_WHITE;
   if (cddr(args) != NULL) colour = checkinteger(third(args));
-  tft.drawPixel(checkinteger(first(args)), checkinteger(second(args)), colour);
+  int x = checkinteger(first(args)), y = checkinteger(second(args));
+  Gfx->drawPixel(x, y, colour);
+  gfxdirty(x, y, 1, 1);
   #else
   (void) args;
   #endif
@@ -4570,7 +6764,8 @@ object *fn_drawline (object *args, object *env) {
   uint16_t params[4], colour = COLOR_WHITE;
   for (int i=0; i<4; i++) { params[i] = checkinteger(car(args)); args = cdr(args); }
   if (args != NULL) colour = checkinteger(car(args));
-  tft.drawLine(params[0], params[1], params[2], params[3], colour);
+  Gfx->drawLine(params[0], params[1], params[2], params[3], colour);
+  gfxdirtypoints(params, 4);
   #else
   (void) args;
   #endif
@@ -4583,7 +6778,8 @@ object *fn_drawrect (object *args, object *env) {
   uint16_t params[4], colour = COLOR_WHITE;
   for (int i=0; i<4; i++) { params[i] = checkinteger(car(args)); args = cdr(args); }
   if (args != NULL) colour = checkinteger(car(args));
-  tft.drawRect(params[0], params[1], params[2], params[3], colour);
+  Gfx->drawRect(params[0], params[1], params[2], params[3], colour);
+  gfxdirty(params[0], params[1], params[2], params[3]);
   #else
   (void) args;
   #endif
@@ -4596,7 +6792,8 @@ object *fn_fillrect (object *args, object *env) {
   uint16_t params[4], colour = COLOR_WHITE;
   for (int i=0; i<4; i++) { params[i] = checkinteger(car(args)); args = cdr(args); }
   if (args != NULL) colour = checkinteger(car(args));
-  tft.fillRect(params[0], params[1], params[2], params[3], colour);
+  Gfx->fillRect(params[0], params[1], params[2], params[3], colour);
+  gfxdirty(params[0], params[1], params[2], params[3]);
   #else
   (void) args;
   #endif
@@ -4609,7 +6806,8 @@ object *fn_drawcircle (object *args, object *env) {
   uint16_t params[3], colour = COLOR_WHITE;
   for (int i=0; i<3; i++) { params[i] = checkinteger(car(args)); args = cdr(args); }
   if (args != NULL) colour = checkinteger(car(args));
-  tft.drawCircle(params[0], params[1], params[2], colour);
+  Gfx->drawCircle(params[0], params[1], params[2], colour);
+  gfxdirty(params[0] - params[2], params[1] - params[2], 2*params[2] + 1, 2*params[2] + 1);
   #else
   (void) args;
   #endif
@@ -4622,7 +6820,8 @@ object *fn_fillcircle (object *args, object *env) {
   uint16_t params[3], colour = COLOR_WHITE;
   for (int i=0; i<3; i++) { params[i] = checkinteger(car(args)); args = cdr(args); }
   if (args != NULL) colour = checkinteger(car(args));
-  tft.fillCircle(params[0], params[1], params[2], colour);
+  Gfx->fillCircle(params[0], params[1], params[2], colour);
+  gfxdirty(params[0] - params[2], params[1] - params[2], 2*params[2] + 1, 2*params[2] + 1);
   #else
   (void) args;
   #endif
@@ -4635,7 +6834,8 @@ object *fn_drawroundrect (object *args, object *env) {
   uint16_t params[5], colour = COLOR_WHITE;
   for (int i=0; i<5; i++) { params[i] = checkinteger(car(args)); args = cdr(args); }
   if (args != NULL) colour = checkinteger(car(args));
-  tft.drawRoundRect(params[0], params[1], params[2], params[3], params[4], colour);
+  Gfx->drawRoundRect(params[0], params[1], params[2], params[3], params[4], colour);
+  gfxdirty(params[0], params[1], params[2], params[3]);
   #else
   (void) args;
   #endif
@@ -4648,7 +6848,8 @@ object *fn_fillroundrect (object *args, object *env) {
   uint16_t params[5], colour = COLOR_WHITE;
   for (int i=0; i<5; i++) { params[i] = checkinteger(car(args)); args = cdr(args); }
   if (args != NULL) colour = checkinteger(car(args));
-  tft.fillRoundRect(params[0], params[1], params[2], params[3], params[4], colour);
+  Gfx->fillRoundRect(params[0], params[1], params[2], params[3], params[4], colour);
+  gfxdirty(params[0], params[1], params[2], params[3]);
   #else
   (void) args;
   #endif
@@ -4661,7 +6862,8 @@ object *fn_drawtriangle (object *args, object *env) {
   uint16_t params[6], colour = COLOR_WHITE;
   for (int i=0; i<6; i++) { params[i] = checkinteger(car(args)); args = cdr(args); }
   if (args != NULL) colour = checkinteger(car(args));
-  tft.drawTriangle(params[0], params[1], params[2], params[3], params[4], params[5], colour);
+  Gfx->drawTriangle(params[0], params[1], params[2], params[3], params[4], params[5], colour);
+  gfxdirtypoints(params, 6);
   #else
   (void) args;
   #endif
@@ -4674,7 +6876,8 @@ object *fn_filltriangle (object *args, object *env) {
   uint16_t params[6], colour = COLOR_WHITE;
   for (int i=0; i<6; i++) { params[i] = checkinteger(car(args)); args = cdr(args); }
   if (args != NULL) colour = checkinteger(car(args));
-  tft.fillTriangle(params[0], params[1], params[2], params[3], params[4], params[5], colour);
+  Gfx->fillTriangle(params[0], params[1], params[2], params[3], params[4], params[5], colour);
+  gfxdirtypoints(params, 6);
   #else
   (void) args;
   #endif
@@ -4695,8 +6898,9 @@ object *fn_drawchar (object *args, object *env) {
       if (more != NULL) size = checkinteger(car(more));
     }
   }
-  tft.drawChar(checkinteger(first(args)), checkinteger(second(args)), checkchar(third(args)),
-    colour, bg, size);
+  int x = checkinteger(first(args)), y = checkinteger(second(args));
+  Gfx->drawChar(x, y, checkchar(third(args)), colour, bg, size);
+  gfxdirty(x, y, 6*size, 8*size);
   #else
   (void) args;
   #endif
@@ -4706,7 +6910,7 @@ object *fn_drawchar (object *args, object *env) {
 object *fn_setcursor (object *args, object *env) {
   (void) env;
   #if defined(gfxsupport)
-  tft.setCursor(checkinteger(first(args)), checkinteger(second(args)));
+  Gfx->setCursor(checkinteger(first(args)), checkinteger(second(args)));
   #else
   (void) args;
   #endif
@@ -4716,8 +6920,13 @@ object *fn_setcursor (object *args, object *env) {
 object *fn_settextcolor (object *args, object *env) {
   (void) env;
   #if defined(gfxsupport)
-  if (cdr(args) != NULL) tft.setTextColor(checkinteger(first(args)), checkinteger(second(args)));
-  else tft.setTextColor(checkinteger(first(args)));
+  if (cdr(args) != NULL) {
+    tft.setTextColor(checkinteger(first(args)), checkinteger(second(args)));
+    Frame.setTextColor(checkinteger(first(args)), checkinteger(second(args)));
+  } else {
+    tft.setTextColor(checkinteger(first(args)));
+    Frame.setTextColor(checkinteger(first(args)));
+  }
   #else
   (void) args;
   #endif
@@ -4727,7 +6936,9 @@ object *fn_settextcolor (object *args, object *env) {
 object *fn_settextsize (object *args, object *env) {
   (void) env;
   #if defined(gfxsupport)
-  tft.setTextSize(checkinteger(first(args)));
+  int size = checkinteger(first(args));
+  Textsize = (size < 1) ? 1 : (size > 255) ? 255 : size; // As the display clamps it, and text runs divide by it
+  tft.setTextSize(Textsize); Frame.setTextSize(Textsize);
   #else
   (void) args;
   #endif
@@ -4737,7 +6948,7 @@ object *fn_settextsize (object *args, object *env) {
 object *fn_settextwrap (object *args, object *env) {
   (void) env;
   #if defined(gfxsupport)
-  tft.setTextWrap(first(args) != NULL);
+  tft.setTextWrap(first(args) != NULL); Frame.setTextWrap(first(args) != NULL);
   #else
   (void) args;
   #endif
@@ -4749,7 +6960,8 @@ object *fn_fillscreen (object *args, object *env) {
   #if defined(gfxsupport)
   uint16_t colour = COLOR_BLACK;
   if (args != NULL) colour = checkinteger(first(args));
-  tft.fillScreen(colour);
+  Gfx->fillScreen(colour);
+  gfxdirty(0, 0, 320, 240);
   #else
   (void) args;
   #endif
@@ -5467,8 +7679,9 @@ const char doc160[] PROGMEM = "(string<= string string)\n"
 const char doc161[] PROGMEM = "(string>= string string)\n"
 "Returns the index to the first mismatch if the first string is alphabetically greater than or equal to\n"
 "the second string, or nil otherwise.";
-const char doc162[] PROGMEM = "(sort list test)\n"
-"Destructively sorts list according to the test function, using an insertion sort, and returns the sorted list.";
+const char doc162[] PROGMEM = "(sort list test [:key key])\n"
+"Destructively sorts list according to the test function, using a stable merge sort, and returns the sorted list.\n"
+"If key is given, test compares the results of calling key on each item.";
 const char doc163[] PROGMEM = "(concatenate 'string string*)\n"
 "Joins together the strings given in the second and subsequent arguments, and returns a single string.";
 const char doc164[] PROGMEM = "(subseq seq start [end])\n"
@@ -5832,7 +8045,7 @@ const tbl_entry_t lookup_table[] PROGMEM = {
   { string159, fn_stringnoteq, 0222, doc159 },
   { string160, fn_stringlesseq, 0222, doc160 },
   { string161, fn_stringgreatereq, 0222, doc161 },
-  { string162, fn_sort, 0222, doc162 },
+  { string162, fn_sort, 0224, doc162 },
   { string163, fn_concatenate, 0217, doc163 },
   { string164, fn_subseq, 0223, doc164 },
   { string165, fn_search, 0224, doc165 },
@@ -5941,15 +8154,46 @@ unsigned int tablesize (int n) {
 
 // Table lookup functions
 
+uint16_t BuiltinIndex[BUILTINSLOTS];
+bool BuiltinIndexed = false;
+
+uint32_t namehash (const char *c) {
+  uint32_t hash = 0;
+  while (*c != 0) {
+    char ch = *c++;
+    if (ch >= 'A' && ch <= 'Z') ch = ch + 'a' - 'A';
+    hash = hashword(hash, ch);
+  }
+  return hash;
+}
+
+const char *builtinname (builtin_t name) {
+  bool n = name<tablesize(0);
+  return table(n?0:1)[n?name:name-tablesize(0)].string;
+}
+
+void indexbuiltins () {
+  // Extensions first, so they take precedence over core entries with the same name
+  unsigned int entries = tablesize(0) + tablesize(1);
+  // The probes need an empty slot to stop at
+  if (entries >= BUILTINSLOTS) error2("too many builtins for BUILTINSLOTS");
+  for (unsigned int e=0; e<entries; e++) {
+    builtin_t name = (e < tablesize(1)) ? tablesize(0) + e : e - tablesize(1);
+    unsigned int i = hashslot(namehash(builtinname(name)), BUILTINSLOTS);
+    while (BuiltinIndex[i] != 0 && strcasecmp(builtinname(BuiltinIndex[i]-1), builtinname(name)) != 0)
+      i = (i+1) & (BUILTINSLOTS-1);
+    if (BuiltinIndex[i] == 0) BuiltinIndex[i] = name+1;
+  }
+  BuiltinIndexed = true;
+}
+
 builtin_t lookupbuiltin (char* c) {
-  unsigned int start = tablesize(0);
-  for (int n=1; n>=0; n--) {
-    int entries = tablesize(n);
-    for (int i=0; i<entries; i++) {
-      if (strcasecmp(c, (char*)(table(n)[i].string)) == 0)
-        return (builtin_t)(start + i);
-    }
-    start = 0;
+  if (!BuiltinIndexed) indexbuiltins();
+  unsigned int i = hashslot(namehash(c), BUILTINSLOTS);
+  while (BuiltinIndex[i] != 0) {
+    builtin_t name = BuiltinIndex[i]-1;
+    if (strcasecmp(c, builtinname(name)) == 0) return name;
+    i = (i+1) & (BUILTINSLOTS-1);
   }
   return ENDFUNCTIONS;
 }
@@ -5964,13 +8208,35 @@ uint8_t getminmax (builtin_t name) {
   return table(n?0:1)[n?name:name-tablesize(0)].minmax;
 }
 
-void checkminmax (builtin_t name, int nargs) {
-  if (!(name < ENDFUNCTIONS)) error2("not a builtin");
-  uint8_t minmax = getminmax(name);
+void checkcount (uint8_t minmax, int nargs) {
   if (nargs<((minmax >> 3) & 0x07)) error2(toofewargs);
   if ((minmax & 0x07) != 0x07 && nargs>(minmax & 0x07)) error2(toomanyargs);
 }
 
+void checkminmax (builtin_t name, int nargs) {
+  if (!(name < ENDFUNCTIONS)) error2("not a builtin");
+  checkcount(getminmax(name), nargs);
+}
+
+// Returns the cached global pair and builtin entry for a call form headed by function
+callsite_t *callsite (object *form, object *function) {
+  symbol_t name = function->name;
+  callsite_t *site = &CallSites[((uintptr_t)form>>3) & (CALLSITES-1)];
+  if (site->site == form && site->name == name && site->epoch == GlobalEpoch) return site;
+  site->site = form; site->name = name; site->epoch = GlobalEpoch;
+  site->pair = globalpair(name);
+  site->fptr = NULL; site->builtin = ENDFUNCTIONS; site->minmax = 0;
+  if (builtinp(name)) {
+    builtin_t bname = builtin(name);
+    if (bname < ENDFUNCTIONS) {
+      site->builtin = bname;
+      site->fptr = (fn_ptr_type)lookupfn(bname);
+      site->minmax = getminmax(bname);
+    }
+  }
+  return site;
+}
+
 char *lookupdoc (builtin_t name) {
   bool n = name<tablesize(0);
   return (char*)table(n?0:1)[n?name:name-tablesize(0)].doc;
@@ -6023,14 +8289,14 @@ object *eval (object *form, object *env) {
 
   if (form == NULL) return nil;
 
-  if (form->type >= NUMBER && form->type <= STRING) return form;
+  if (immediatep(form) || (form->type >= NUMBER && form->type <= STRING)) return form;
 
   if (symbolp(form)) {
     symbol_t name = form->name;
     if (colonp(name)) return form; // Keyword
     object *pair = value(name, env);
     if (pair != NULL) return cdr(pair);
-    pair = value(name, GlobalEnv);
+    pair = globalpair(name);
     if (pair != NULL) return cdr(pair);
     else if (builtinp(name)) {
       if (name == sym(FEATURES)) return features();
@@ -6049,7 +8315,10 @@ object *eval (object *form, object *env) {
 
   // List starts with a builtin symbol?
   if (symbolp(function) && builtinp(function->name)) {
-    builtin_t name = builtin(function->name);
+    callsite_t *site = callsite(form, function);
+    builtin_t name = site->builtin;
+    fn_ptr_type fptr = site->fptr;
+    uint8_t minmax = site->minmax;
 
     if ((name == LET) || (name == LETSTAR)) {
       if (args == NULL) error2(noargument);
@@ -6060,6 +8329,8 @@ object *eval (object *form, object *env) {
       protect(newenv);
       while (assigns != NULL) {
         object *assign = car(assigns);
+        object *var = consp(assign) ? first(assign) : assign;
+        if (!symbolp(var)) error(notasymbol, var);
         if (!consp(assign)) push(cons(assign,nil), newenv);
         else if (cdr(assign) == NULL) push(cons(first(assign),nil), newenv);
         else push(cons(first(assign), eval(second(assign),env)), newenv);
@@ -6084,16 +8355,16 @@ object *eval (object *form, object *env) {
       return cons(bsymbol(CLOSURE), cons(envcopy,args));
     }
 
-    switch(fntype(name)) {    
+    switch(minmax>>6) {    
       case SPECIAL_FORMS:
         Context = name;
         checkargs(args);
-        return ((fn_ptr_type)lookupfn(name))(args, env);
+        return fptr(args, env);
   
       case TAIL_FORMS:
         Context = name;
         checkargs(args);
-        form = ((fn_ptr_type)lookupfn(name))(args, env);
+        form = fptr(args, env);
         TC = 1;
         goto EVAL;
      
@@ -6105,9 +8376,11 @@ object *eval (object *form, object *env) {
   int TCstart = TC;
   object *head;
   if (consp(function) && !(isbuiltin(car(function), LAMBDA) || isbuiltin(car(function), CLOSURE)
-    || car(function)->type == CODE)) { Context = NIL; error(illegalfn, function); }
+    || codep(car(function)))) { Context = NIL; error(illegalfn, function); }
+  object *call = form;
   if (symbolp(function)) {
-    object *pair = findpair(function, env);
+    object *pair = value(function->name, env);
+    if (pair == NULL) pair = callsite(form, function)->pair;
     if (pair != NULL) head = cons(cdr(pair), NULL); else head = cons(function, NULL);
   } else head = cons(eval(function, env), NULL);
   protect(head); // Don't GC the result list
@@ -6127,12 +8400,21 @@ object *eval (object *form, object *env) {
   function = car(head);
   args = cdr(head);
 
+  if (bytecodep(function)) {
+    object *slot = (nargs == 1) ? accessorcode(function) : NULL;
+    object *result = (slot != NULL) ? *recordslot(first(args), second(slot), intval(car(slot))>>8)
+      : callbytecode(function, args, env);
+    unprotect();
+    return result;
+  }
+
   if (symbolp(function)) {
     if (!builtinp(function->name)) { Context = NIL; error(illegalfn, function); }
-    builtin_t bname = builtin(function->name);
-    Context = bname;
-    checkminmax(bname, nargs);
-    object *result = ((fn_ptr_type)lookupfn(bname))(args, env);
+    callsite_t *site = callsite(call, function);
+    Context = site->builtin;
+    if (site->fptr == NULL) error2("not a builtin");
+    checkcount(site->minmax, nargs);
+    object *result = site->fptr(args, env);
     unprotect();
     return result;
   }
@@ -6378,12 +8660,16 @@ void printobject (object *form, pfun_t pfun) {
   if (form == NULL) pfstring("nil", pfun);
   else if (listp(form) && isbuiltin(car(form), CLOSURE)) pfstring("<closure>", pfun);
   else if (listp(form)) plist(form, pfun);
-  else if (integerp(form)) pint(form->integer, pfun);
+  else if (bytecodep(form)) pfstring("<compiled>", pfun);
+  else if (integerp(form)) pint(intval(form), pfun);
   else if (floatp(form)) pfloat(form->single_float, pfun);
   else if (symbolp(form)) { if (form->name != sym(NOTHING)) printsymbol(form, pfun); }
-  else if (characterp(form)) pcharacter(form->chars, pfun);
+  else if (characterp(form)) pcharacter(charval(form), pfun);
   else if (stringp(form)) printstring(form, pfun);
   else if (arrayp(form)) printarray(form, pfun);
+  else if (hashtablep(form)) pfstring("<hash-table>", pfun);
+  else if (recordp(form)) printrecord(form, pfun);
+  else if (typedarrayp(form)) printtypedarray(form, pfun);
   else if (streamp(form)) pstream(form, pfun);
   else error2("error in print");
 }
@@ -6419,39 +8705,54 @@ void PlotChar (uint8_t ch, uint8_t line, uint8_t column) {
   uint16_t x = column*6;
   ScrollBuf[column][(line+Scroll) % Lines] = ch;
   if (ch & 0x80) {
-    tft.drawChar(x, y, ch & 0x7f, COLOR_BLACK, COLOR_GREEN, 1);
+    Gfx->drawChar(x, y, ch & 0x7f, COLOR_BLACK, COLOR_GREEN, 1);
   } else {
-    tft.drawChar(x, y, ch & 0x7f, COLOR_WHITE, COLOR_BLACK, 1);
+    Gfx->drawChar(x, y, ch & 0x7f, COLOR_WHITE, COLOR_BLACK, 1);
   }
+  gfxdirty(x, y, 6, 8);
 #endif
 }
 
 // Clears the bottom line and then scrolls the display up by one line
 void ScrollDisplay () {
   #if defined(gfxsupport)
-  tft.fillRect(0, 240-Leading, 320, 10, COLOR_BLACK);
+  Gfx->fillRect(0, 240-Leading, 320, 10, COLOR_BLACK);
   for (uint8_t x = 0; x < Columns; x++) {
     char c = ScrollBuf[x][Scroll];
     for (uint8_t y = 0; y < Lines-1; y++) {
       char c2 = ScrollBuf[x][(y+Scroll+1) % Lines];
       if (c != c2) {
         if (c2 & 0x80) {
-          tft.drawChar(x*6, y*Leading, c2 & 0x7f, COLOR_BLACK, COLOR_GREEN, 1);
+          Gfx->drawChar(x*6, y*Leading, c2 & 0x7f, COLOR_BLACK, COLOR_GREEN, 1);
         } else {
-          tft.drawChar(x*6, y*Leading, c2 & 0x7f, COLOR_WHITE, COLOR_BLACK, 1);
+          Gfx->drawChar(x*6, y*Leading, c2 & 0x7f, COLOR_WHITE, COLOR_BLACK, 1);
         }
         c = c2;
       }
     }
   }
   // Tidy up graphics
-  for (uint8_t y = 0; y < Lines-1; y++) tft.fillRect(0, y*Leading+8, 320, 2, COLOR_BLACK);
-  tft.fillRect(318, 0, 3, 240, COLOR_BLACK);
+  for (uint8_t y = 0; y < Lines-1; y++) Gfx->fillRect(0, y*Leading+8, 320, 2, COLOR_BLACK);
+  Gfx->fillRect(318, 0, 3, 240, COLOR_BLACK);
+  gfxdirty(0, 0, 320, 240);
   for (int x=0; x<Columns; x++) ScrollBuf[x][Scroll] = 0;
   Scroll = (Scroll + 1) % Lines;
   #endif
 }
 
+// Redraws the terminal from the scroll buffer, used when a new framebuffer takes over
+void RedrawDisplay () {
+  #if defined(gfxsupport)
+  Gfx->fillScreen(COLOR_BLACK);
+  for (uint8_t y = 0; y < Lines; y++) {
+    for (uint8_t x = 0; x < Columns; x++) {
+      char c = ScrollBuf[x][(y+Scroll) % Lines];
+      if (c) PlotChar(c, y, x);
+    }
+  }
+  #endif
+}
+
 const char VT = 11; // Vertical tab
 const char BEEP = 7;
 
@@ -6502,7 +8803,7 @@ void Display (char c) {
     }
   // Control characters
   } else if (c == 12) {            // Clear display
-    tft.fillScreen(COLOR_BLACK); line = 0; column = 0; Scroll = 0;
+    Gfx->fillScreen(COLOR_BLACK); gfxdirty(0, 0, 320, 240); line = 0; column = 0; Scroll = 0;
     for (int col = 0; col < Columns; col++) {
       for (int row = 0; row < Lines; row++) {
         ScrollBuf[col][row] = 0;
@@ -6607,6 +8908,7 @@ int gserial () {
   #if defined (serialmonitor)
   unsigned long start = millis();
   while (!KybdAvailable) {
+    gfxflush();
     if (millis() - start > 1000) clrflag(NOECHO);
     if (Serial.available()) {
       char temp = Serial.read();
@@ -6636,6 +8938,7 @@ int gserial () {
   return '\n';
   #else
   while (!KybdAvailable) {
+    gfxflush();
     Wire1.requestFrom(0x55, 1);
     if (Wire1.available()) {
       char temp = Wire1.read();
@@ -6776,12 +9079,7 @@ object *nextitem (gfun_t gfun) {
     if (index == 3) return character((buffer[0]*10+buffer[1])*10+buffer[2]-5328);
     error2("unknown character");
   }
-
-  builtin_t x = lookupbuiltin(buffer);
-  if (x == NIL) return nil;
-  if (x != ENDFUNCTIONS) return bsymbol(x);
-  if (index <= 6 && valid40(buffer)) return intern(twist(pack40(buffer)));
-  return internlong(buffer);
+  return bufsymbol(buffer);
 }
 
 object *readrest (gfun_t gfun) {
@@ -6822,6 +9120,7 @@ object *read (gfun_t gfun) {
 
 void initenv () {
   GlobalEnv = NULL;
+  rehashglobals();
   tee = bsymbol(TEE);
 }
 
@@ -6861,6 +9160,9 @@ void setup () {
   if (!psramInit()) { Serial.print("the PSRAM couldn't be initialized"); for(;;); }
   Workspace = (object*) ps_malloc(WORKSPACESIZE*8);
   if (!Workspace) { Serial.print("the Workspace couldn't be allocated"); for(;;); }
+  Markbits = (uint32_t *) malloc(MARKWORDS*4);
+  if (!Markbits) Markbits = (uint32_t *) ps_malloc(MARKWORDS*4);
+  if (!Markbits) { Serial.print("the mark bitmap couldn't be allocated"); for(;;); }
   #endif
   int stackhere = 0; StackBottom = &stackhere;
   initworkspace();
@@ -6872,6 +9174,7 @@ void setup () {
   initsound();
   initTouch();
   inittrackball();
+  initevents();
 
   pfstring(PSTR("uLisp 4.7a "), pserial); pln(pserial);
 }
@@ -6933,13 +9236,20 @@ void loop () {
 void ulisperror () {
   // Come here after error
   delay(100); while (Serial.available()) Serial.read();
-  clrflag(NOESC); BreakLevel = 0; TraceStart = 0; TraceTop = 0;
+  clrflag(NOESC); BreakLevel = 0; TraceStart = 0; TraceTop = 0; VMTop = 0;
   for (int i=0; i<TRACEMAX; i++) TraceDepth[i] = 0;
   #if defined(sdcardsupport)
-  SDpfile.close(); SDgfile.close();
+  SDflush(); SDpfile.close(); SDgfile.close();
   #endif
   #if defined(lisplibrary)
-  if (!tstflag(LIBRARYLOADED)) { setflag(LIBRARYLOADED); loadfromlibrary(NULL); }
+  if (!tstflag(LIBRARYLOADED)) {
+    setflag(LIBRARYLOADED);
+    #if defined(LITTLEFS)
+    if (!loadlibraryimage()) { loadfromlibrary(NULL); savelibraryimage(); }
+    #else
+    loadfromlibrary(NULL);
+    #endif
+  }
   #endif
   client.stop();
 }